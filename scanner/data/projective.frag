@@ -0,0 +1,55 @@
+#version 330
+
+// Blends the cameras by their interpolated weights, each scaled by its gain so the
+// exposures match. Sampler arrays can only take constant indices here, so the camera
+// is chosen with a switch
+
+uniform sampler2DRect uCamTex[8];
+uniform vec3 uCamGain[8];
+uniform float uShininess;
+uniform vec3 mLight0;
+
+in vec3 vNormal;
+in vec3 vPosition;
+in vec2 vTexCoord[8];
+in vec4 vBlend0;
+in vec4 vBlend1;
+
+out vec4 fragColour;
+
+vec4 sampleCamera(int c, vec2 t) {
+	switch (c) {
+		case 0: return texture(uCamTex[0], t);
+		case 1: return texture(uCamTex[1], t);
+		case 2: return texture(uCamTex[2], t);
+		case 3: return texture(uCamTex[3], t);
+		case 4: return texture(uCamTex[4], t);
+		case 5: return texture(uCamTex[5], t);
+		case 6: return texture(uCamTex[6], t);
+		default: return texture(uCamTex[7], t);
+	}
+}
+
+void main() {
+	vec3 n = normalize(vNormal);
+	vec3 l = normalize(mLight0 - vPosition);
+	vec3 e = normalize(-vPosition);
+	vec3 h = normalize(l + e);
+	
+	float diffuse = max(dot(n, l), 0.0);
+	float specular = pow(max(dot(n, h), 0.0), uShininess);
+	
+	float w[8] = float[8](vBlend0.x, vBlend0.y, vBlend0.z, vBlend0.w, vBlend1.x, vBlend1.y, vBlend1.z, vBlend1.w);
+	vec3 base = vec3(0.0);
+	float total = 0.0;
+	
+	for (int c = 0; c < 8; c++){
+		if (w[c] > 0.001) {
+			base += w[c] * uCamGain[c] * sampleCamera(c, vTexCoord[c]).rgb;
+			total += w[c];
+		}
+	}
+	base = total > 0.0 ? base / total : vec3(0.5);
+	
+	fragColour = vec4(base * (0.3 + 0.7 * diffuse) + vec3(0.2 * specular), 1.0);
+}
@@ -0,0 +1,53 @@
+#version 330
+
+// Projective texturing - each vertex is projected into every camera with the same pinhole
+// and distortion model as OpenCV's projectPoints. The blend weights say how much of each
+// camera to use, a single camera being a weight of one
+
+layout(location = 0) in vec3 aVertex;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec4 aBlend0;	// Weights for cameras 0 - 3
+layout(location = 3) in vec4 aBlend1;	// and 4 - 7
+
+uniform mat4 mMVPMatrix;
+uniform mat4 mMVMatrix;
+uniform mat4 mNormalMatrix;
+
+uniform int uCamCount;
+uniform mat3 uCamR[8];
+uniform vec3 uCamT[8];
+uniform vec4 uCamK[8];		// fx, fy, cx, cy
+uniform vec4 uCamD[8];		// k1, k2, p1, p2
+uniform float uCamK3[8];
+
+out vec3 vNormal;
+out vec3 vPosition;
+out vec2 vTexCoord[8];
+out vec4 vBlend0;
+out vec4 vBlend1;
+
+vec2 project(int c, vec3 v) {
+	vec3 p = uCamR[c] * v + uCamT[c];
+	
+	float x = p.x / p.z;
+	float y = p.y / p.z;
+	float r2 = x * x + y * y;
+	float radial = 1.0 + r2 * (uCamD[c].x + r2 * (uCamD[c].y + r2 * uCamK3[c]));
+	
+	float xd = x * radial + 2.0 * uCamD[c].z * x * y + uCamD[c].w * (r2 + 2.0 * x * x);
+	float yd = y * radial + uCamD[c].z * (r2 + 2.0 * y * y) + 2.0 * uCamD[c].w * x * y;
+	
+	return vec2(uCamK[c].x * xd + uCamK[c].z, uCamK[c].y * yd + uCamK[c].w);
+}
+
+void main() {
+	for (int c = 0; c < 8; c++)
+		vTexCoord[c] = c < uCamCount ? project(c, aVertex) : vec2(0.0);
+	
+	vBlend0 = aBlend0;
+	vBlend1 = aBlend1;
+	
+	vNormal = normalize((mNormalMatrix * vec4(aNormal, 0.0)).xyz);
+	vPosition = (mMVMatrix * vec4(aVertex, 1.0)).xyz;
+	gl_Position = mMVPMatrix * vec4(aVertex, 1.0);
+}
@@ -0,0 +1,76 @@
+/**
+* @brief Bakes the camera textures for a mesh into one atlas for export
+* @file atlas.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 08/08/2012
+*
+*/
+
+#ifndef _ATLAS_HPP_
+#define _ATLAS_HPP_
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "halfedge.hpp"
+#include "camera_manager.hpp"
+
+
+/*
+ * Faces that touch and share a camera form a chart. Each chart is laid out as it appears
+ * in its camera, the charts are packed on shelves into one image and every texel is
+ * sampled from the camera. Near an edge with a chart from another camera the two cameras
+ * are blended so the seam does not show
+ */
+
+class AtlasBaker {
+public:
+	AtlasBaker(int padding = 2, float seam = 4.0f) : pMesh(NULL), mPadding(padding), mSeam(seam) {};
+
+	bool bake(HalfEdgeMesh &mesh, std::vector<boost::shared_ptr<LeedsCam> > &cameras);
+	bool save(std::string filename);	// OBJ, with the MTL and PNG next to it
+	void setGains(const std::vector<GLfloat> &gains) { mGains = gains; };	// RGB per camera
+
+	cv::Mat& getAtlas() { return mAtlas; };
+	size_t numCharts() { return mCharts.size(); };
+
+protected:
+
+	struct Chart {
+		GLuint camera;
+		std::vector<uint32_t> faces;
+		cv::Rect source;	// Area of the camera image, padding included
+		cv::Point offset;	// Where that area sits in the atlas
+	};
+
+	struct Projection {
+		bool valid;
+		double R[9], T[3], K[4], D[5];
+	};
+
+	void _findCharts();
+	void _pack();
+	void _bakeCharts(size_t c0, size_t c1);
+	void _dilate(Chart &chart, cv::Mat &mask);
+
+	cv::Point2f _project(const Projection &p, float x, float y, float z);
+	cv::Vec3f _sample(const cv::Mat &image, cv::Point2f p);
+	cv::Vec3f _gain(GLuint camera);
+
+	HalfEdgeMesh *pMesh;
+	int mPadding;
+	float mSeam;
+
+	std::vector<Chart> mCharts;
+	std::vector<uint32_t> mChartOf;			// Chart for each face
+	std::vector<cv::Point2f> mUV;			// Atlas position of each face corner
+	std::vector<Projection> mProjections;
+	std::vector<cv::Mat> mImages;
+	std::vector<GLfloat> mGains;
+	cv::Mat mAtlas;
+};
+
+#endif
@@ -0,0 +1,77 @@
+/**
+* @brief Bundle adjustment of the camera extrinsics over several board poses
+* @file bundle.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 27/07/2012
+*
+*/
+
+#ifndef _BUNDLE_HPP_
+#define _BUNDLE_HPP_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <boost/thread.hpp>
+
+#include "config.hpp"
+#include "utils.hpp"
+
+
+/*
+ * Levenberg-Marquardt over every camera and every board pose at once. Board poses are 
+ * eliminated with the Schur complement so only the small camera system is solved densely.
+ * Pose 0 is the world, as with CalibratorWorld, so it stays fixed
+ */
+
+class BundleAdjuster {
+public:
+	BundleAdjuster(cv::Size &board, bool intrinsics = false) : mBoardSize(board), mIntrinsics(intrinsics) {};
+	
+	void addCamera(CameraParameters &p);
+	size_t addPose();
+	void addObservation(size_t camera, size_t pose, std::vector<cv::Point2f> &corners);
+	
+	size_t numPoses() { return mPoses.size(); };
+	
+	double solve(int iterations = 50);		// Writes back into the cameras, returns the overall RMS
+	std::vector<double>& getErrors() { return mErrors; };	// RMS per camera in pixels
+	
+protected:
+	
+	struct Observation {
+		size_t camera;
+		size_t pose;
+		std::vector<cv::Point2f> corners;
+	};
+	
+	// Blocks of the normal equations. U per camera, V per pose, W per camera / pose pair
+	struct Normals {
+		std::vector<cv::Mat> U, gU, V, gV, W;
+		boost::mutex mMutex;
+	};
+	
+	void initialise();
+	void pack(size_t c, cv::Mat &r, cv::Mat &t, cv::Mat &M, cv::Mat &D, const cv::Mat &params);
+	cv::Mat residual(const Observation &o, const cv::Mat &cam, const cv::Mat &pose, cv::Mat *Jc, cv::Mat *Jb);
+	
+	void linearise(Normals *n, size_t p0, size_t p1);
+	void cost(std::vector<cv::Mat> *cams, std::vector<cv::Mat> *poses, std::vector<double> *sums, size_t o0, size_t o1);
+	double totalCost(std::vector<cv::Mat> &cams, std::vector<cv::Mat> &poses, std::vector<double> &perCamera);
+	
+	cv::Size &mBoardSize;
+	bool mIntrinsics;
+	std::vector<size_t> mBlock;		// Parameters per camera, as distortion models can differ
+	std::vector<size_t> mOffset;	// Where each camera block starts in the reduced system
+	size_t mCamParams;
+	
+	std::vector<CameraParameters*> mCameras;
+	std::vector<cv::Mat> mCams;		// r, t and optionally fx, fy, cx, cy, distortion
+	std::vector<cv::Mat> mPoses;	// r, t of the board in the world
+	std::vector<Observation> mObs;
+	std::vector< std::vector<size_t> > mByPose;
+	std::vector<cv::Point3f> mBoard;
+	std::vector<size_t> mCounts;	// Observed corners per camera
+	std::vector<double> mErrors;
+};
+
+#endif
@@ -16,6 +16,7 @@
 #include "config.hpp"
 #include "utils.hpp"
 #include "uvc_camera.hpp"
+#include "chessboard.hpp"
 
 /*
  * A threaded calibrator for the single camera error values
@@ -23,19 +24,24 @@
 
 class CalibratorCamera {
 public:
-	CalibratorCamera(CameraParameters &p, cv::Size &isize, cv::Size &bsize) : mP(p), mImageSize(isize), mBoardSize(bsize) {};
+	CalibratorCamera(CameraParameters &p, cv::Size &isize, cv::Size &bsize) : mP(p), mImageSize(isize), mBoardSize(bsize), mDetector(bsize) {};
 	
-	virtual double operator ()(uint8_t threadCount); // Called when performing calibration
+	virtual double operator ()(); // Called when performing calibration
 	
 	bool addImage(cv::Mat &cam, cv::Mat &board);
+	bool addImage(LeedsFrame &frame, cv::Mat &board);
 	
 	void clear() { imagePoints.clear(); objectPoints.clear(); };
 	
 protected:
 
+	void addCorners(std::vector<cv::Point2f> &corners);
+
 	CameraParameters &mP;
 	cv::Size &mImageSize;
 	cv::Size &mBoardSize;
+	
+	ChessboardDetector mDetector;	// Keeps its buffers between frames
 
 	std::vector< std::vector<cv::Point2f> > imagePoints;
 	std::vector< std::vector<cv::Point3f> > objectPoints;
@@ -51,13 +57,35 @@ class CalibratorWorld : public CalibratorCamera {
 public:
 	CalibratorWorld(CameraParameters &ip, cv::Size &isize, cv::Size &bsize) : CalibratorCamera(ip,isize,bsize) {};
 	
-	double operator ()(uint8_t threadCount); // Called when performing calibration
+	double operator ()(); // Called when performing calibration
+	
+	void setCorners(std::vector<cv::Point2f> &corners) { imagePoints.clear(); imagePoints.push_back(corners); };
 	
 };
 
 
 /*
- * 
+ * Calibrates the projector as an inverse camera. Each view pairs the chessboard corners seen by one
+ * camera with that camera's decoded projector co-ordinate map, giving the corners in projector pixels
  */
 
+class CalibratorProjector : public CalibratorCamera {
+public:
+	CalibratorProjector(CameraParameters &pp, cv::Size &psize, cv::Size &bsize) : CalibratorCamera(pp,psize,bsize) {};
+	
+	double operator ()(); // Called when performing calibration
+	
+	bool addView(std::vector<cv::Point2f> &corners, cv::Mat &map, cv::Mat &mask, CameraParameters &camera);
+	
+	size_t numViews() { return imagePoints.size(); };
+	
+protected:
+	
+	bool toProjector(cv::Point2f corner, cv::Mat &map, cv::Mat &mask, cv::Point2f &result);
+	
+	std::vector< std::vector<cv::Point2f> > mCameraPoints;	// Corners as the camera saw them
+	std::vector<CameraParameters> mCameras;					// The camera that saw each view
+	
+};
+
 #endif
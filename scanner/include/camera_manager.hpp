@@ -15,9 +15,15 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/assign/std/vector.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "uvc_camera.hpp"
 #include "calibrator.hpp"
+#include "bundle.hpp"
+#include "store.hpp"
+#include "frame.hpp"
 #include "config.hpp"
 #include "utils.hpp"
 
@@ -28,7 +34,7 @@
  
 class LeedsCam {
 public:
-	LeedsCam(UVCVideo &cam, cv::Size size);
+	LeedsCam(UVCVideo &cam, cv::Size size, std::string filename);
 	
 	void setParams(CameraParameters cp) {mP = cp;}; // eventually cx!
 	
@@ -37,8 +43,7 @@ public:
 	bool isSecondary() { return mSecondary;};
 	bool isRectified() { return mP.mCalibrated;};
 		
-	cv::Mat& getImage() { return mImage; };
-	cv::Mat& getImageRectified() {return mImageRectified; };
+	SharedFrame getFrame() { boost::lock_guard<boost::mutex> lock(mFrameMutex); return pFrame; };
 	cv::Mat& getResult() {return mResult; };
 	void computeNormal();
 	GLuint getTexture() {return mTexID; };
@@ -46,23 +51,32 @@ public:
 	cv::Mat& getNormal() {return mPlaneNormal; };
 	VBOData& getVBO(){ return mVBONormal; };
 	
+	std::string getFilename() { return mFilename; };
+	CalibrationTables& getTables() { return mTables; };
+	void setTables(CalibrationTables &t) { mTables = t; };
+	
 	void bind();	// Texture bind
 	void bindRectified();
 	void bindResult();
 	void unbind();
 	void update();
-	void updateTexture();
+	void updateTexture(SharedFrame frame, bool capture = true);	// Capture false keeps the raw texture as it was
 	void updateResultTexture();
 	
 protected:
 
 	UVCVideo &mCam;
 	CameraParameters mP;
+	CalibrationTables mTables;	// Rebuilt whenever the intrinsics change
+	std::string mFilename;
 	bool mSecondary;
 	cv::Mat mPlaneNormal;	// Normal to the camera plane
 	cv::Mat mTransform;		// The computed transform to the world
-	cv::Mat mImage;
-	cv::Mat mImageRectified;
+	cv::Mat mImage;				// Views of the latest frame, for the GL thread only - others
+	cv::Mat mImageRectified;	// hold on to the frame from getFrame
+	SharedPool pPool;
+	SharedFrame pFrame;		// Latest frame, shared by anything that wants its pyramid
+	boost::mutex mFrameMutex;
 	cv::Mat mResult;
 	GLuint mTexID;
 	GLuint mRectifiedTexID;
@@ -93,9 +107,18 @@ public:
 	void calibrateWorld();
 	void setControl(CameraControl c, unsigned int v);
 	
-	cv::Point3f solveForAll(std::vector< std::pair<cv::Point2f, CameraParameters > > points);
+	cv::Point3f solveForAll(std::vector< std::pair<cv::Point2f, CameraParameters > > points, std::vector<CalibrationTables*> *tables = NULL);
+	void solveForPlane(std::vector<cv::Point2f> &points, CameraParameters &in, CalibrationTables &tables, cv::Vec4d plane, std::vector<cv::Point3f> &results);
+	
+	// The projector treated as an inverse camera, in the same world as the cameras
+	bool loadProjector(std::string filename, cv::Size size);
+	bool hasProjector() { return mObj->mProjector.mCalibrated; };
+	CameraParameters& getProjector() { return mObj->mProjector; };
+	void setProjector(CameraParameters &p, cv::Size size) { mObj->mProjector = p; mObj->mProjectorSize = size; };
+	cv::Size getProjectorSize() { return mObj->mProjectorSize; };
+	cv::Vec4d projectorPlane(float column);
 	
-	bool isThreading() {return sThreads > 0;};
+	bool isThreading() {return mObj->mJob && !mObj->mJob->ready(); };
 	
 	std::vector<boost::shared_ptr<LeedsCam> >& getCams() { return mObj->mCams; };
 	
@@ -103,28 +126,37 @@ public:
 	
 	cv::Mat& getResult() { return mObj->mResult; };
 	
-	void saveSettings(std::vector<std::string> filenames);
+	bool loadBundle(std::string filename);
+	void saveSettings();
 	void shutdown();
 	
 	int waitingOn() {return mObj->mWaitingOn; };
+	std::vector<int> calibrationProgress() { boost::lock_guard<boost::mutex> lock(mObj->mProgressMutex); return mObj->mProgress; };
+	std::vector<int> pendingCameras() { boost::lock_guard<boost::mutex> lock(mObj->mProgressMutex); return mObj->mPending; };
+	
+	// Blocks until the cameras have a frame newer than last, returns the new frame count
+	uint64_t waitForFrame(uint64_t last);
 	
 	void bind();
 	void unbind();
 
 protected:
 
-	///\todo we need some sort of internal state and thread pool here -  time to go and what not
+	void _calibrateCameras(); 	// On the pool
+	void _calibrateWorld(); 	// On the pool
+	bool _goodFrame(LeedsFrame &frame);
+	void _findBoards(std::vector<boost::shared_ptr<CalibratorCamera> > *calibrators, std::vector<SharedFrame> *frames, 
+		std::vector<cv::Mat> *boards, std::vector<uint8_t> *wanted, std::vector<uint8_t> *found, size_t c0, size_t c1);
+	void _findWorldBoards(std::vector<boost::shared_ptr<ChessboardDetector> > *detectors, std::vector<SharedFrame> *frames, 
+		std::vector< std::vector<cv::Point2f> > *corners, std::vector<uint8_t> *wanted, std::vector<uint8_t> *found, size_t c0, size_t c1);
+	void _solveWorld(std::vector<boost::shared_ptr<CalibratorWorld> > *calibrators, size_t c0, size_t c1);
+	size_t _waitForBoards(std::vector< std::vector<cv::Point2f> > &kept, std::vector<uint8_t> &ready, size_t need);
 
-	void _calibrateCameras(); 	// Threaded
-	void _calibrateWorld(); 	// Threaded
-
-	static uint8_t sThreads;	// Counts the threads this has launched. Passed to each thread
-	
 	
 
 	struct SharedObj {
 	
-		SharedObj(GlobalConfig &config) : mConfig(config) {};
+		SharedObj(GlobalConfig &config) : mConfig(config) { mFrameCount = 0; mStop = false; };
 
 		GlobalConfig &mConfig;
 		
@@ -133,10 +165,25 @@ protected:
 		
 		cv::Mat mResult; // results of any processing
 		
-		boost::thread *pWorkerThread;
+		boost::shared_ptr<CalibrationStore> pStore;	// Mapped bundle, the cameras' tables point into it
+		
+		CameraParameters mProjector;
+		cv::Size mProjectorSize;
+		
+		TaskFuture mJob;	// Calibration, while it runs
 		
 		int mWaitingOn; ///\todo remove eventually as this is related to state! :S
 		
+		// New frame events so calibration waits on the cameras rather than polling
+		boost::mutex mFrameMutex;
+		boost::condition_variable mFrameCond;
+		uint64_t mFrameCount;
+		bool mStop;
+		
+		boost::mutex mProgressMutex;
+		std::vector<int> mProgress;		// Boards found so far, per camera
+		std::vector<int> mPending;		// Cameras still without a stable board in world calibration
+		
 		GLuint mTexID;	
 	
 	};
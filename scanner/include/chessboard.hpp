@@ -0,0 +1,43 @@
+/**
+* @brief Chessboard detection on a downscaled image with full resolution refinement
+* @file chessboard.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 25/07/2012
+*
+*/
+
+#ifndef _CHESSBOARD_HPP_
+#define _CHESSBOARD_HPP_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "frame.hpp"
+
+
+/*
+ * Finds the board on a pyramid level first so empty frames are thrown out cheaply, then
+ * scales the corners back up for cornerSubPix. Keep one per camera - the buffers are reused
+ * Frames already carry their own pyramid so nothing is converted twice
+ */
+
+class ChessboardDetector {
+public:
+	ChessboardDetector(cv::Size &board, int levels = 2, int minWidth = 320) : mBoardSize(board), mLevels(levels), mMinWidth(minWidth) {};
+	
+	bool detect(cv::Mat &rgb, std::vector<cv::Point2f> &corners, cv::Mat &board);
+	bool detect(LeedsFrame &frame, bool rectified, std::vector<cv::Point2f> &corners, cv::Mat &board);
+	
+protected:
+	
+	bool search(cv::Mat &level, int scale, cv::Mat &grey, cv::Mat &rgb, std::vector<cv::Point2f> &corners, cv::Mat &board);
+	
+	cv::Size &mBoardSize;
+	int mLevels;		// Most pyramid levels to go down
+	int mMinWidth;		// Never search an image narrower than this
+	
+	cv::Mat mGrey;
+	std::vector<cv::Mat> mPyramid;
+};
+
+#endif
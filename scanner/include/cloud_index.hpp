@@ -0,0 +1,87 @@
+/**
+* @brief Shared kd-tree for the point cloud stages
+* @file cloud_index.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 10/08/2012
+*
+*/
+
+#ifndef _CLOUD_INDEX_HPP_
+#define _CLOUD_INDEX_HPP_
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+#include <pcl/search/search.h>
+#include <boost/shared_ptr.hpp>
+
+
+/*
+ * A kd-tree that PCL can use as its search method. The points are copied into one packed
+ * array in tree order, so a leaf is a short run of memory, and the tree itself is implicit -
+ * each node is the median of its range with only its split axis stored. The top levels are
+ * split in parallel, then each subtree is built on its own thread.
+ *
+ * PCL hands every search method the cloud again before it searches. If it is the cloud this
+ * was last built for, nothing is rebuilt, so one index can be passed from stage to stage
+ */
+
+class CloudIndex : public pcl::search::Search<pcl::PointXYZ> {
+public:
+	typedef boost::shared_ptr<CloudIndex> Ptr;
+	typedef pcl::search::Search<pcl::PointXYZ> Base;
+
+	CloudIndex(size_t leaf = 8) : Base("CloudIndex", false), mLeaf(leaf < 1 ? 1 : leaf), mBuiltSize(0), mBuilds(0) {};
+
+	void setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr());
+
+	using Base::nearestKSearch;
+	using Base::radiusSearch;
+
+	int nearestKSearch(const pcl::PointXYZ &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const;
+	int radiusSearch(const pcl::PointXYZ &point, double radius, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances, unsigned int max_nn = 0) const;
+
+	// Batched queries, split across the cores. Empty indices means every point in the cloud
+	void nearestKSearch(const PointCloud &cloud, const std::vector<int> &indices, int k, std::vector< std::vector<int> > &k_indices, std::vector< std::vector<float> > &k_sqr_distances) const;
+	void radiusSearch(const PointCloud &cloud, const std::vector<int> &indices, double radius, std::vector< std::vector<int> > &k_indices, std::vector< std::vector<float> > &k_sqr_distances, unsigned int max_nn = 0) const;
+
+	size_t size() const { return mEntries.size(); };
+	size_t builds() const { return mBuilds; };
+
+protected:
+
+	struct Entry {
+		float p[3];
+		int index;	// Into the cloud
+	};
+
+	struct AxisLess {
+		AxisLess(int a) : axis(a) {};
+		bool operator () (const Entry &a, const Entry &b) const { return a.p[axis] < b.p[axis]; };
+		int axis;
+	};
+
+	typedef std::pair<size_t, size_t> Range;
+	typedef std::pair<float, int> Candidate;	// Squared distance and position in the tree
+
+	void _build();
+	bool _split(size_t lo, size_t hi);
+	void _buildRange(size_t lo, size_t hi);
+	void _splitRanges(std::vector<Range> *from, std::vector<Range> *to, size_t r0, size_t r1);
+	void _buildRanges(std::vector<Range> *ranges, size_t r0, size_t r1);
+
+	void _knn(size_t lo, size_t hi, const float *q, size_t k, std::vector<Candidate> &heap) const;
+	void _radius(size_t lo, size_t hi, const float *q, float r2, size_t max, std::vector<Candidate> &found) const;
+	void _knnBatch(const PointCloud *cloud, const std::vector<int> *indices, int k, std::vector< std::vector<int> > *k_indices, std::vector< std::vector<float> > *k_sqr_distances, size_t q0, size_t q1) const;
+	void _radiusBatch(const PointCloud *cloud, const std::vector<int> *indices, double radius, std::vector< std::vector<int> > *k_indices, std::vector< std::vector<float> > *k_sqr_distances, unsigned int max_nn, size_t q0, size_t q1) const;
+
+	std::vector<Entry> mEntries;	// Points in tree order
+	std::vector<uint8_t> mAxis;		// Split axis of the node whose median sits at each position
+	size_t mLeaf;
+	size_t mBuiltSize;
+	size_t mBuilds;
+};
+
+#endif
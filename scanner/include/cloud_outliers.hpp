@@ -0,0 +1,84 @@
+/**
+* @brief Outlier removal over a hash grid
+* @file cloud_outliers.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 12/08/2012
+*
+*/
+
+#ifndef _CLOUD_OUTLIERS_HPP_
+#define _CLOUD_OUTLIERS_HPP_
+
+#include <vector>
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+
+/*
+ * Statistical outlier removal as PCL does it - the mean distance to the k nearest is found
+ * for every point, and points further than the mean of those plus a multiple of their
+ * deviation are dropped. Or, with a radius set, points with too few neighbours inside it.
+ *
+ * The points are binned on a uniform grid, hashed into one flat table in bucket order. The
+ * grid cell comes from the spread of the middle of the cloud, assuming a scanned surface,
+ * so a cell holds about k points and a few stray points far off cannot blow it up. A k
+ * nearest search grows a shell of cells at a time until nothing closer can be outside it,
+ * working on flat runs of squared distances rather than a heap. Every point is searched on
+ * its own, across all the cores
+ */
+
+class CloudOutliers {
+public:
+	CloudOutliers() : mMeanK(50), mStddevMul(1.0f), mRadius(0.0f), mMinCount(4) {};
+
+	size_t filter(const pcl::PointCloud<pcl::PointXYZ> &in, pcl::PointCloud<pcl::PointXYZ> &out);
+
+	void setMeanK(int k) { mMeanK = k < 1 ? 1 : k; };
+	void setStddevMulThresh(float mul) { mStddevMul = mul; };
+	void setRadiusSearch(float radius, int count) { mRadius = radius; mMinCount = count; };	// 0 for k nearest
+
+	const std::vector<uint8_t>& getKept() { return mKept; };
+
+protected:
+
+	static const size_t sBlock = 64;	// Distances worked out in one go
+	static const size_t sSpreadSamples = 65536;	// Points the percentiles are taken from
+	static const float sSpreadTail;		// Fraction left off each end for the spread
+
+	void _build(const pcl::PointCloud<pcl::PointXYZ> &in);
+	void _keys(const pcl::PointCloud<pcl::PointXYZ> *in, size_t p0, size_t p1);
+	void _meanDistances(size_t s0, size_t s1);
+	void _radiusCounts(size_t s0, size_t s1);
+
+	uint64_t _cellKey(int x, int y, int z) const;
+	uint32_t _bucket(int x, int y, int z) const;
+	void _cell(const float *q, int *c) const;
+	void _distances(size_t s, size_t e, const float *q, float *d) const;
+	void _gatherCell(int x, int y, int z, const float *q, std::vector<float> &found) const;
+	size_t _countCell(int x, int y, int z, const float *q, float r2, size_t enough) const;
+
+	int mMeanK;
+	float mStddevMul;
+	float mRadius;
+	int mMinCount;
+
+	float mOrigin[3];
+	float mCellSize;
+	int mDims[3];
+	uint32_t mMask;
+
+	std::vector<uint32_t> mStart;		// First table entry of each bucket
+	std::vector<float> mX, mY, mZ;		// Table, in bucket order
+	std::vector<uint64_t> mKey;			// Cell of each table entry
+	std::vector<uint32_t> mIndex;		// Cloud index of each table entry
+	std::vector<uint32_t> mBucketOf;	// Bucket of each cloud point, or sNone
+	std::vector<uint64_t> mKeyOf;		// Cell of each cloud point
+	std::vector<float> mMeanDist;		// Per table entry
+	std::vector<uint8_t> mKept;			// Per cloud point
+
+	static const uint32_t sNone;
+};
+
+#endif
@@ -0,0 +1,66 @@
+/**
+* @brief Voxel grid reduction of the point cloud before meshing
+* @file cloud_voxels.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 11/08/2012
+*
+*/
+
+#ifndef _CLOUD_VOXELS_HPP_
+#define _CLOUD_VOXELS_HPP_
+
+#include <vector>
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+
+/*
+ * Replaces every occupied voxel with the centroid of its points, keeping how many points
+ * went into each one. Points are hashed on their voxel into one partition per piece of work,
+ * so each partition can be summed on its own core with no locks and no merge afterwards
+ */
+
+class CloudVoxels {
+public:
+	CloudVoxels(float size = 0.0f) : mSize(size) {};
+
+	size_t filter(const pcl::PointCloud<pcl::PointXYZ> &in, pcl::PointCloud<pcl::PointXYZ> &out);
+
+	void setSize(float size) { mSize = size; };
+	float getSize() { return mSize; };
+	const std::vector<uint32_t>& getCounts() { return mCounts; };	// Points in each output point
+
+protected:
+
+	struct Voxel {
+		double x, y, z;
+		uint32_t count;
+	};
+
+	static const uint64_t sEmpty;
+
+	void _makeKeys(const pcl::PointCloud<pcl::PointXYZ> *in, size_t p0, size_t p1);
+	void _countParts(size_t c0, size_t c1);
+	void _scatter(size_t c0, size_t c1);
+	void _accumulate(const pcl::PointCloud<pcl::PointXYZ> *in, size_t r0, size_t r1);
+	void _emit(pcl::PointCloud<pcl::PointXYZ> *out, size_t r0, size_t r1);
+
+	size_t _part(uint64_t key) const;
+
+	float mSize;
+	size_t mParts;
+	size_t mChunks;
+
+	std::vector<uint64_t> mKeys;				// Voxel of each point
+	std::vector<size_t> mChunkBounds;			// Points in each chunk
+	std::vector<size_t> mOffsets;				// Chunk by partition start in mOrder
+	std::vector<size_t> mPartBounds;			// Points in each partition of mOrder
+	std::vector<uint32_t> mOrder;				// Point indices grouped by partition
+	std::vector< std::vector<Voxel> > mVoxels;	// Per partition
+	std::vector<size_t> mVoxelBounds;			// Output start of each partition
+	std::vector<uint32_t> mCounts;
+};
+
+#endif
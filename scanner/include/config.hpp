@@ -13,6 +13,7 @@
 #include "s9gear.hpp"
 
 #include <vector>
+#include <string>
 #include <opencv/highgui.h>
 
 #include <GL/glew.h>
@@ -30,11 +31,56 @@ typedef struct {
 	int endCam;
 	float interval;
 	int maxImages;
+	std::string calibrationBundle;	// Binary store of every camera's calibration
+	int worldPoses;			// Board poses for the bundle adjuster - 1 just uses solvePnP
+	bool worldIntrinsics;	// Let the bundle adjuster refine M and D too
+	
+	// Frame quality gate - blurred, clipped or badly exposed frames are not worth a board search
+	float qualitySharpness;
+	float qualitySaturation;
+	float qualityDark;
+	float qualityBright;
 	
 	// Point Detection Parameters
 	double_t pointThreshold;
 	double_t scanInterval;
 	
+	// Phase shifting scan - steps per frequency, periods across the projector and cell size
+	int phaseSteps;
+	std::vector<int> phaseFrequencies;
+	float phaseMinModulation;
+	int phasePitch;
+	
+	// Line stripe scan - minimum peak brightness, refinement window and fit type
+	int stripeThreshold;
+	int stripeWindow;
+	bool stripeGaussian;
+	bool stripeColumns;
+	
+	// Planned dot scan - coarse and fine pitch in projector pixels, depth jump that counts as an edge
+	int planCoarse;
+	int planFine;
+	float planJump;
+	
+	// Multiple dot scan - dots per frame, detection threshold and epipolar tolerance in pixels
+	int dotCount;
+	int dotThreshold;
+	float dotTolerance;
+	
+	// Texturing - blend every camera that sees a vertex rather than one camera per face, and
+	// balance the camera exposures from where they overlap
+	bool textureBlend;
+	bool textureGain;
+	
+	// Worker threads for the whole program - 0 for one per core - and whether each is kept
+	// on its own core
+	int threads;
+	bool threadAffinity;
+	
+	// Projector as an inverse camera
+	cv::Size projectorSize;
+	std::string projectorFile;
+	
 	// World Sizes
 	float xs,ys,zs;
 	float xe,ye,ze;
@@ -53,6 +99,12 @@ typedef struct {
 	
 	float pclFilterMeanK;
 	float pclFilterThresh;
+	float pclFilterRadius;	// Above 0 drops points with fewer than pclFilterCount neighbours this close instead
+	int pclFilterCount;
+	
+	// Voxel size the cloud is reduced to before meshing. 0 takes it from the world size over
+	// the mesh resolution, below 0 keeps every point
+	float pclVoxelSize;
 
 
 }GlobalConfig;
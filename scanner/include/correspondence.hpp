@@ -0,0 +1,59 @@
+/**
+* @brief Multiple dot detection and epipolar correspondence between views
+* @file correspondence.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 20/07/2012
+*
+*/
+
+#ifndef _CORRESPONDENCE_HPP_
+#define _CORRESPONDENCE_HPP_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "config.hpp"
+
+
+/*
+ * A dot found in a view - pixel position plus the colour it was projected in
+ */
+
+typedef struct {
+	cv::Point2f p;
+	int code;
+}Dot;
+
+void detectDots(cv::Mat &rgb, uint8_t threshold, std::vector<Dot> &dots);
+
+
+/*
+ * Groups dots across views using the epipolar geometry of the calibrated cameras
+ * The first view added is the reference - ideally the projector as it sees every dot
+ */
+
+class DotMatcher {
+public:
+	DotMatcher(float tolerance, float ratio = 0.7f) : mTolerance(tolerance), mRatio(ratio) {};
+	
+	void addView(std::vector<Dot> &dots, CameraParameters &params);
+	void match(std::vector< std::vector< std::pair<cv::Point2f, CameraParameters> > > &groups);
+	void clear() { mViews.clear(); };
+	
+protected:
+	
+	struct View {
+		std::vector<Dot> dots;
+		std::vector<cv::Point2f> normalised;	// Undistorted, normalised image co-ordinates
+		CameraParameters params;
+		cv::Mat R;
+	};
+	
+	cv::Matx33d essential(View &a, View &b);
+	
+	std::vector<View> mViews;
+	float mTolerance;	// Pixels from the epipolar line
+	float mRatio;		// Best match must beat the second best by this much
+};
+
+#endif
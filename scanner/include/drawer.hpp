@@ -69,7 +69,7 @@ public:
 	void setup(GlobalConfig &config);
 	void resize(size_t w, size_t h);
 	void drawCamerasFlat(std::vector<boost::shared_ptr<LeedsCam> > &cams);
-	void drawMesh(VBOData &mesh, std::vector<boost::shared_ptr<LeedsCam> > &cams);
+	void drawMesh(VBOData &mesh, std::vector<boost::shared_ptr<LeedsCam> > &cams, std::vector<GLfloat> &gains);
 	void drawMeshPoints(VBOData &points, float r, float g, float b);
 	void drawResultFlat(size_t cami);
 	void drawCameraQuad();
@@ -77,7 +77,7 @@ public:
 	void drawNormals(VBOData &lines);
 	void drawReferenceQuad();
 	void drawZoomed();
-	void drawToolView(VBOData &mesh,std::vector<boost::shared_ptr<LeedsCam> > &cams);
+	void drawToolView(VBOData &mesh,std::vector<boost::shared_ptr<LeedsCam> > &cams, std::vector<GLfloat> &gains);
 	void drawGripper();
 	void rotateCamera(int dx, int dy, double dt);
 	void zoomCamera(float_t z);
@@ -88,6 +88,9 @@ public:
 protected:
 
 	void recursiveCreate (const struct aiScene *sc, const struct aiNode* nd);
+	void setProjection(Shader &shader, std::vector<boost::shared_ptr<LeedsCam> > &cams, std::vector<GLfloat> &gains);
+	
+	static const size_t sMaxProjected = 8;	// Must match the arrays in projective.vert
 	
 	struct SharedObj {
 		SharedObj(GlobalConfig &config) : mConfig(config) {};
@@ -102,6 +105,7 @@ protected:
 		Shader mShaderNormals;
 		Shader mShaderGripper;
 		Shader mShaderPicker;
+		Shader mShaderProjective;
 				
 		glm::mat4 mModelMatrix;
 		
@@ -0,0 +1,99 @@
+/**
+* @brief A single camera frame with a lazily built grey pyramid
+* @file frame.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 01/08/2012
+*
+*/
+
+#ifndef _FRAME_HPP_
+#define _FRAME_HPP_
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+
+/*
+ * Recycles image buffers between frames. A buffer is only handed out again once nothing
+ * else holds a reference to it
+ */
+
+class FramePool {
+public:
+	FramePool(size_t limit = 32) : mLimit(limit) {};
+	
+	cv::Mat acquire(cv::Size size, int type);
+	void release(cv::Mat &m);
+	
+protected:
+	size_t mLimit;
+	std::vector<cv::Mat> mFree;
+	boost::mutex mMutex;
+};
+
+typedef boost::shared_ptr<FramePool> SharedPool;
+
+
+/*
+ * Cheap measures of a frame, taken in one pass over the grey image
+ */
+
+typedef struct {
+	float sharpness;	// Mean squared gradient - drops quickly with motion blur
+	float saturation;	// Fraction of pixels at the top of the range
+	float mean;
+	float variance;
+} FrameQuality;
+
+typedef struct {
+	float minSharpness;
+	float maxSaturation;
+	float minMean;
+	float maxMean;
+} QualityLimits;
+
+bool acceptable(const FrameQuality &q, const QualityLimits &l);
+
+
+/*
+ * One frame from a camera. The RGB and rectified images are filled by the camera and the 
+ * grey levels (full, half and quarter) are made the first time anyone asks for them.
+ * Buffers go back to the pool when the last holder lets go of the frame
+ */
+
+class LeedsFrame {
+public:
+	LeedsFrame(SharedPool pool, cv::Size size, bool rectified);
+	~LeedsFrame();
+	
+	cv::Mat& getImage() { return mRGB; };
+	cv::Mat& getImageRectified() { return mRectified; };
+	bool isRectified() { return !mRectified.empty(); };
+	boost::posix_time::ptime getTime() { return mTime; };	// When it was taken from the camera
+	
+	cv::Mat& getGrey(size_t level = 0, bool rectified = false);
+	const FrameQuality& getQuality();
+	
+	static const size_t sLevels = 3;
+	
+protected:
+	
+	cv::Mat& _getGrey(size_t level, size_t source);
+	
+	SharedPool pPool;
+	boost::posix_time::ptime mTime;
+	cv::Mat mRGB;
+	cv::Mat mRectified;
+	cv::Mat mGrey[2][sLevels];	// Raw and rectified
+	FrameQuality mQuality;
+	bool mMeasured;
+	boost::mutex mMutex;
+};
+
+typedef boost::shared_ptr<LeedsFrame> SharedFrame;
+
+#endif
@@ -0,0 +1,81 @@
+/**
+* @brief Index based half edge mesh
+* @file halfedge.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 03/08/2012
+*
+*/
+
+#ifndef _HALFEDGE_HPP_
+#define _HALFEDGE_HPP_
+
+#include <vector>
+#include <stdint.h>
+
+#include <GL/glew.h>
+
+
+/*
+ * Half edge mesh held as flat arrays of 32 bit indices. The half edges of face f are 3f, 3f+1
+ * and 3f+2, so next, prev and face are arithmetic and only the origin and twin are stored.
+ * Twins are matched by sorting the directed edge keys rather than a map lookup per edge
+ */
+
+class HalfEdgeMesh {
+public:
+	static const uint32_t sNone = 0xffffffff;
+
+	void clear();
+	size_t build(const std::vector<GLfloat> &positions, const std::vector<uint32_t> &triangles);
+	void computeNormals();
+
+	size_t numVertices() const { return mX.size(); };
+	size_t numFaces() const { return mOrigin.size() / 3; };
+	size_t numHalfEdges() const { return mOrigin.size(); };
+
+	uint32_t next(uint32_t e) const { return e - e % 3 + (e + 1) % 3; };
+	uint32_t prev(uint32_t e) const { return e - e % 3 + (e + 2) % 3; };
+	uint32_t face(uint32_t e) const { return e / 3; };
+	uint32_t origin(uint32_t e) const { return mOrigin[e]; };
+	uint32_t twin(uint32_t e) const { return mTwin[e]; };				// sNone on a boundary
+	uint32_t outgoing(uint32_t v) const { return mVertexEdge[v]; };	// sNone if unused
+	uint32_t vertex(uint32_t f, uint32_t j) const { return mOrigin[f * 3 + j]; };
+
+	// Vertex positions
+	std::vector<GLfloat> mX, mY, mZ;
+
+	// Area weighted vertex normals from the one ring
+	std::vector<GLfloat> mVNX, mVNY, mVNZ;
+
+	// Per face normal, area and camera for texturing
+	std::vector<GLfloat> mNX, mNY, mNZ;
+	std::vector<GLfloat> mArea;
+	std::vector<GLuint> mTex;
+
+protected:
+
+	struct EdgeKey {
+		uint64_t key;	// origin << 32 | destination
+		uint32_t edge;
+		bool operator < (const EdgeKey &k) const { return key < k.key || (key == k.key && edge < k.edge); };
+	};
+
+	size_t _compact(std::vector<uint8_t> &bad);
+	void _sortKeys();
+	void _sortChunks(std::vector<size_t> *bounds, size_t c0, size_t c1);
+	void _mergeChunks(std::vector<size_t> *bounds, size_t width, size_t p0, size_t p1);
+
+	void _splitPositions(const std::vector<GLfloat> *positions, size_t v0, size_t v1);
+	void _makeKeys(size_t e0, size_t e1);
+	void _matchTwins(size_t e0, size_t e1);
+	void _vertexEdges(size_t k0, size_t k1);
+	void _faceNormals(size_t f0, size_t f1);
+	void _vertexNormals(size_t v0, size_t v1);
+
+	std::vector<uint32_t> mOrigin;
+	std::vector<uint32_t> mTwin;
+	std::vector<uint32_t> mVertexEdge;
+	std::vector<EdgeKey> mKeys;		// Sorted, kept around only while building
+};
+
+#endif
@@ -109,6 +109,9 @@ public:
 	// Toggleable states for QT and other UI hooks
 	void toggleShowCameras();
 	void toggleScanning();
+	void togglePhaseScanning();
+	void toggleStripeScanning();
+	void toggleDotScanning();
 	void toggleDetected();
 	void toggleDrawMesh();
 	void toggleTexturing();
@@ -118,7 +121,8 @@ public:
 	void generateMesh();
 	void calibrateCameras();
 	void calibrateWorld();
-	std::string getStatus() { if (pInfo) return pInfo->getStatus(); return "Leeds - Nonestate"; } 
+	void calibrateProjector();
+	std::string getStatus();
 	void save();
 	void load(std::string filename="./data/test.pcd");
 	void loadFromSTL(std::string filename) {mM.loadFromSTL(filename, mManager.getCams()); };
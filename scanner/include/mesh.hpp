@@ -26,6 +26,7 @@
 #include <pcl/features/normal_3d_omp.h>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <opencv2/opencv.hpp>
@@ -35,36 +36,12 @@
 
 #include "camera_manager.hpp"
 #include "config.hpp"
-
-
-/*
- * Winged edge classes for faster lookups
- * Data is encapsulated within these classes
- */
-
-class WE_Vertex;
-class WE_Face;
-
-class WE_Edge {
-public:
-	boost::shared_ptr<WE_Vertex> v0, v1;
-	boost::shared_ptr<WE_Face> face;
-	boost::shared_ptr<WE_Edge> prev, next, sym;
-};
-
-class WE_Vertex {
-public:
-	std::vector< boost::shared_ptr<WE_Edge> > edges;
-	GLfloat x,y,z;
-
-};
-
-class WE_Face {
-public:
-	boost::shared_ptr<WE_Edge> edge;
-	GLfloat nx,ny,nz;
-	GLuint t;
-};
+#include "halfedge.hpp"
+#include "visibility.hpp"
+#include "atlas.hpp"
+#include "cloud_index.hpp"
+#include "cloud_voxels.hpp"
+#include "cloud_outliers.hpp"
 
 
 /*
@@ -78,10 +55,17 @@ public:
 	LeedsMesh() {};
 	void setup(GlobalConfig &config);
 	void addPoint(double_t x, double_t y, double_t z);
-	void generate(std::vector<boost::shared_ptr<LeedsCam> >&cameras);
+	void addPoints(std::vector<cv::Point3f> &points);
+	void generate(std::vector<boost::shared_ptr<LeedsCam> >&cameras, std::string exportBase = "");
+	bool upload(std::vector<boost::shared_ptr<LeedsCam> >&cameras);
+	void cancel();
+	void stop();		// Cancel and wait until no job is left reading the cameras
+	bool isGenerating() { boost::lock_guard<boost::mutex> lock(mObj->mJobMutex); return mObj->mRunning; };
+	std::string getProgress();
 	void saveToFile(std::string filename);
 	void clearMesh();
 	void saveMeshToFile(std::string filename);
+	void saveTexturedMesh(std::string filename, std::vector<boost::shared_ptr<LeedsCam> >&cameras);
 	
 	void loadFromSTL(std::string filename, std::vector<boost::shared_ptr<LeedsCam> >&cameras);
 	void loadFile(std::string filename);
@@ -91,33 +75,97 @@ public:
 	VBOData& getPointsFilteredVBO() { return mObj->mPointsFilteredVBO; };
 	VBOData& getNormalsVBO() { return mObj->mNormalsVBO; };
 	VBOData& getComputedNormalsVBO() { return mObj->mComputedNormalsVBO; };
+	std::vector<GLfloat>& getGains() { return mObj->pFront->mGains; };
 	
 
 protected:
 
+	// Stages of a mesh job, in order
+	typedef enum {
+		MESH_IDLE,
+		MESH_REDUCE,
+		MESH_FILTER,
+		MESH_SMOOTH,
+		MESH_NORMALS,
+		MESH_POISSON,
+		MESH_HALFEDGE,
+		MESH_TEXTURE,
+		MESH_EXPORT,
+		MESH_DONE
+	}MeshStage;
+	
+	static const char *sStageNames[];
 	static size_t sBufferSize;
+	static size_t sVotePasses;
+	static float sVisibleTolerance;
+	static const size_t sMaxBlend = 8;	// Cameras a mesh is textured from - must match projective.vert and Drawer::sMaxProjected
+	static float sBlendCutoff;
+	static size_t sGainSamples;
 	
 	void generateMeshVBO(std::vector<boost::shared_ptr<LeedsCam> >&cameras);
-	void generateWinged(std::vector<boost::shared_ptr<LeedsCam> >&cameras, bool reverse);
-	void generateTexIDs(std::vector<boost::shared_ptr<LeedsCam> >&cameras);
+	struct MeshBuffer;
+
+	void generateHalfEdge(MeshBuffer &b, std::vector<boost::shared_ptr<LeedsCam> >&cameras, bool reverse = false);
+	void generateTexIDs(MeshBuffer &b, std::vector<boost::shared_ptr<LeedsCam> >&cameras);
+	void _bestCameras(HalfEdgeMesh *mesh, std::vector<GLfloat> *normals, std::vector<uint8_t> *visible, size_t f0, size_t f1);
+	void _voteCameras(HalfEdgeMesh *mesh, std::vector<GLuint> *from, std::vector<GLuint> *to, std::vector<uint8_t> *visible, size_t f0, size_t f1);
+	void generateBlend(MeshBuffer &b, std::vector<boost::shared_ptr<LeedsCam> >&cameras, std::vector<uint8_t> &visible);
+	void generateGains(MeshBuffer &buffer, std::vector<boost::shared_ptr<LeedsCam> >&cameras, std::vector<uint8_t> &seen);
+	void _seenVertices(HalfEdgeMesh *mesh, std::vector<uint8_t> *visible, std::vector<uint8_t> *seen, size_t c0, size_t c1);
+	void _blendWeights(MeshBuffer *b, std::vector<GLfloat> *centres, std::vector<uint8_t> *seen, size_t v0, size_t v1);
+	void _sampleCameras(HalfEdgeMesh *mesh, std::vector<boost::shared_ptr<LeedsCam> > *cameras, std::vector<uint32_t> *samples, std::vector<uint8_t> *seen, std::vector<GLfloat> *colours, std::vector<GLfloat> *mask, size_t c0, size_t c1);
 	void textureMap(std::vector<boost::shared_ptr<LeedsCam> >&cameras);
+	
+	void _generate(size_t job, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<boost::shared_ptr<LeedsCam> > cameras, std::string exportBase);
+	bool _build(size_t job, MeshBuffer &b, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<boost::shared_ptr<LeedsCam> > &cameras, std::string &exportBase);
+	bool _stage(size_t job, MeshStage stage);
+
+	/*
+	 * Everything a mesh job produces. Each job fills a buffer of its own on the pool and
+	 * the GL thread swaps it to the front once it is finished
+	 */
+
+	struct MeshBuffer {
+		MeshBuffer() : pCloudFiltered(new pcl::PointCloud<pcl::PointXYZ>) {};
+		
+		pcl::PointCloud<pcl::PointXYZ>::Ptr pCloudFiltered;
+		pcl::PolygonMesh mTriangles;
+		HalfEdgeMesh mHE;
+		std::vector<GLfloat> mBlend;		// sMaxBlend camera weights per vertex
+		std::vector<GLfloat> mGains;		// RGB gain per camera
+		std::vector<GLfloat> mNormalLines;	// Computed normals as line ends, for drawing
+	};
+	
+	typedef boost::shared_ptr<MeshBuffer> SharedBuffer;
+	
+	void _saveMesh(MeshBuffer &buffer, std::string filename);
+	void _saveTexturedMesh(MeshBuffer &buffer, std::string filename, std::vector<boost::shared_ptr<LeedsCam> >&cameras);
 
 	struct SharedObj {
 	
-		SharedObj(GlobalConfig &config) : mConfig(config) {};
+		SharedObj(GlobalConfig &config) : pFront(new MeshBuffer()), mUpdate(true), mJobId(0), mRunning(false), mStage(MESH_IDLE), mConfig(config) {};
 
 		pcl::PointCloud<pcl::PointXYZ>::Ptr pCloud;
-		pcl::PointCloud<pcl::PointXYZ>::Ptr pCloudFiltered;
 		pcl::PassThrough<pcl::PointXYZ> mPass;
-		pcl::PolygonMesh mTriangles;
 		pcl::PointCloud<pcl::Normal>::Ptr mNormals;
-		pcl::search::KdTree<pcl::PointXYZ>::Ptr mTree;
+		pcl::PointCloud<pcl::PointXYZ>::Ptr pJobCloud;		// Copy the last job meshed
+		pcl::PointCloud<pcl::PointXYZ>::Ptr pJobReduced;	// That copy after the voxel grid
+		pcl::PointCloud<pcl::PointXYZ>::Ptr pJobFiltered;	// And after outlier removal
+		CloudIndex::Ptr pJobIndex;							// Built over the filtered copy
 		pcl::PointCloud<pcl::PointNormal>::Ptr mCloud_with_normals;
 		
 		bool mUpdate;
 		bool mTextured;
 		
-		std::vector< boost::shared_ptr<WE_Face> > mWE;
+		SharedBuffer pFront;	// Drawn and saved - GL thread only
+		SharedBuffer pReady;	// Finished and waiting for upload
+		
+		TaskFuture mJob;
+		std::vector<TaskFuture> mLetGo;	// Cancelled jobs that may not have stopped yet
+		boost::mutex mJobMutex;	// Guards the job fields and the job cloud copies
+		size_t mJobId;			// The current job - any other is cancelled
+		bool mRunning;
+		MeshStage mStage;
 				
 		VBOData mMeshVBO;
 		VBOData mPointsVBO;
@@ -0,0 +1,50 @@
+/**
+* @brief Phase shifting decoder for fringe scans
+* @file phase.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 16/07/2012
+*
+*/
+
+#ifndef _PHASE_HPP_
+#define _PHASE_HPP_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "config.hpp"
+#include "utils.hpp"
+
+
+/*
+ * Decodes N-step sinusoidal fringes at several frequencies into a projector co-ordinate map.
+ * Frames are ordered as ProjectorWindow shows them - axis, then frequency, then step.
+ * Phase is unwrapped temporally, each frequency using the one before it as a guide.
+ */
+
+class PhaseDecoder {
+public:
+	PhaseDecoder(int steps, std::vector<int> &frequencies, cv::Size projector, float minModulation) : 
+		mSteps(steps), mFrequencies(frequencies), mProjector(projector), mMinModulation(minModulation) {};
+	
+	// Decode one camera. map is CV_32FC2 projector (u,v), mask is CV_8UC1 and modulation CV_32FC1
+	void decode(std::vector<cv::Mat> &frames, cv::Mat &map, cv::Mat &mask, cv::Mat &modulation);
+	
+	// Bin a decoded map into projector cells of pitch pixels. Result is CV_32FC3 - mean camera x, y and count
+	void accumulate(cv::Mat &map, cv::Mat &mask, int pitch, cv::Mat &cells);
+	
+	size_t numFrames() { return 2 * mFrequencies.size() * mSteps; };
+	
+protected:
+
+	void decodeBand(std::vector<cv::Mat> *frames, cv::Mat *map, cv::Mat *mask, cv::Mat *modulation, size_t r0, size_t r1);
+	void decodeAxis(std::vector<cv::Mat> &frames, size_t axis, cv::Range rows, cv::Mat &coord, cv::Mat &modulation);
+
+	int mSteps;
+	std::vector<int> mFrequencies;
+	cv::Size mProjector;
+	float mMinModulation;
+
+};
+
+#endif
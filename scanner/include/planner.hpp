@@ -0,0 +1,63 @@
+/**
+* @brief Coarse to fine planning of projector positions for dot scanning
+* @file planner.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 23/07/2012
+*
+*/
+
+#ifndef _PLANNER_HPP_
+#define _PLANNER_HPP_
+
+#include <queue>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+/*
+ * Starts with a sparse pass at the coarse pitch, then halves the pitch only around positions that
+ * hit something. Positions next to a jump in depth are refined before the rest at the same pitch
+ */
+
+class ScanPlanner {
+public:
+	ScanPlanner(cv::Size projector, int coarse, int fine, float jump);
+	
+	bool next(cv::Point &p);	// Next projector position, false once nothing is left to refine
+	void report(bool hit, cv::Point3f point = cv::Point3f());	// Result for the last position from next
+	
+	size_t numVisited() { return mVisitedCount; };
+	size_t numHits() { return mHitCount; };
+	size_t numCells() { return mVisited.rows * mVisited.cols; };
+	
+protected:
+	
+	struct Cell {
+		cv::Point p;	// In fine cells
+		int pitch;		// In fine cells
+		int priority;
+		size_t seq;		// Keeps the raster order at equal priority
+		
+		bool operator<(const Cell &c) const { 
+			if (priority != c.priority) return priority < c.priority; 
+			return seq > c.seq;
+		}
+	};
+	
+	void push(cv::Point p, int pitch, bool edge);
+	bool discontinuity(cv::Point p, int pitch, cv::Point3f &point);
+	
+	std::priority_queue<Cell> mQueue;
+	
+	cv::Mat mVisited;	// 0 untouched, 1 queued, 2 missed, 3 hit
+	cv::Mat mPoints;	// Triangulated point for each hit
+	
+	int mFine;
+	float mJump;
+	Cell mCurrent;
+	size_t mSeq;
+	size_t mVisitedCount;
+	size_t mHitCount;
+};
+
+#endif
@@ -14,9 +14,28 @@
 #include <QGridLayout>
 #include <QKeyEvent>
 #include <QPainter>
+#include <QImage>
 #include <QContextMenuEvent>
 #include <QDialog>
 #include <QFileDialog>
+
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+
+/*
+ * What the projector is currently throwing onto the scene
+ */
+
+typedef enum {
+	PROJECT_POINT = 0,	// Single dot rastered by advance
+	PROJECT_FRINGE,		// Sinusoidal fringes for phase shifting, stepped with setFringe
+	PROJECT_LINE,		// Single vertical line swept across by advanceLine
+	PROJECT_DOTS,		// Sparse grid of colour coded dots, shifted together by advanceDots
+	PROJECT_PLANNED		// Single dot placed by setPos from a scan planner
+}ProjectorMode;
+
  
 /*
  * Projector Window for dealing with signals for the projector
@@ -33,6 +52,27 @@ public:
 	void setPos(int x, int y);
 	void setFlash(bool b);
 	void advance();
+	QPoint getPoint() { boost::lock_guard<boost::mutex> lock(mPointMutex); return mPoint; };
+	boost::posix_time::ptime getPoint(QPoint &point);	// Also when the dot was put there
+	
+	void setMode(ProjectorMode m) { mMode = m; update(); };
+	ProjectorMode getMode() { return mMode; };
+	
+	// Fringe patterns are ordered by axis (x then y), then frequency, then phase step
+	void setFringes(int steps, std::vector<int> frequencies);
+	void setFringe(size_t idx);
+	size_t numFringes() { return 2 * mFrequencies.size() * mSteps; };
+	
+	// Line sweep - returns false once the line has passed the right hand edge
+	void setLine(int x) { mLine = x; update(); };
+	bool advanceLine();
+	int getLine() { return mLine; };
+	
+	// Dot grid - roughly count dots, each cell rastered by the dot size. False once every offset is covered
+	void setDots(int count);
+	bool advanceDots();
+	void getDots(std::vector<QPoint> &dots, std::vector<int> &codes);
+	static QColor dotColour(int code);
 	
 public slots:
 	void handleFullScreen();
@@ -43,10 +83,24 @@ protected slots:
 protected:
 	void paintEvent(QPaintEvent *event);
 	void keyPressEvent ( QKeyEvent * event );
+	void generateFringe();
 	
 	bool 			mFS; // is Fullscreen?
 	int				mSize;
 	QPoint			mPoint;
+	boost::posix_time::ptime mMoved;
+	boost::mutex	mPointMutex;	// The dot moves on the update thread and is read while drawing
+	
+	ProjectorMode	mMode;
+	int				mSteps;
+	std::vector<int> mFrequencies;
+	size_t			mFringe;
+	QImage			mFringeImage;
+	bool			mFringeDirty;
+	int				mLine;
+	int				mDotCols;
+	int				mDotRows;
+	QPoint			mDotOffset;
 
 };
 
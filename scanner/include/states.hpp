@@ -25,6 +25,11 @@
 #include "drawer.hpp"
 #include "mesh.hpp"
 #include "projector_window.hpp"
+#include "phase.hpp"
+#include "stripe.hpp"
+#include "calibrator.hpp"
+#include "correspondence.hpp"
+#include "planner.hpp"
 
 
 /*
@@ -33,7 +38,7 @@
  
 class StateInfo{
 public:
-	StateInfo(CameraManager &p0, Drawer &p1, LeedsMesh &p2, ProjectorWindow &p3) : c(p0), d(p1), m(p2), p(p3) { status = "Leeds - State Enabled"; };
+	StateInfo(CameraManager &p0, Drawer &p1, LeedsMesh &p2, ProjectorWindow &p3, GlobalConfig &p4) : c(p0), d(p1), m(p2), p(p3), g(p4) { status = "Leeds - State Enabled"; };
 	
 	std::string getStatus() { boost::lock_guard<boost::mutex> lock(mutex); std::string r = status; return r;};
 	void updateStatus(std::string r) {   boost::lock_guard<boost::mutex> lock(mutex);  status = r; };
@@ -42,6 +47,7 @@ public:
 	Drawer &d;
 	LeedsMesh &m;
 	ProjectorWindow &p;
+	GlobalConfig &g;
 	
 	int mx,my,dx,dy;	// Mouse positions
 	bool ml, mr, mm;	// button down
@@ -157,6 +163,52 @@ public:
 
 
 
+/*
+ * Leeds state for projector calibration. Flashes white to find the board in a camera, then throws
+ * the fringe sequence so each corner can be read off in projector co-ordinates
+ */
+ 
+class StateCalibrateProjector : public LeedsState {
+public:
+
+	virtual LeedsState* do_clone() const { return new StateCalibrateProjector( *this ); }
+
+	StateCalibrateProjector(SharedInfo info) : LeedsState(info) { mID = "StateCalibrateProjector"; mW = false; mObj.reset(new SharedObj(info->g)); };
+	void update();
+	void draw();
+	
+protected:
+	bool findBoard();
+	void addView();
+	
+	typedef enum {
+		PROJ_CALIB_BOARD = 0,	// Flashing white, looking for the board
+		PROJ_CALIB_FRINGE,		// Capturing the fringes from the camera that saw it
+		PROJ_CALIB_DONE
+	}ProjectorCalibStage;
+	
+	struct SharedObj {
+		SharedObj(GlobalConfig &g) : mSize(g.projectorSize), mCalibrator(mResult, mSize, g.boardSize) { mStage = PROJ_CALIB_BOARD; mT = 0; mFrame = 0; mCam = 0; mStarted = false; };
+		
+		CameraParameters mResult;
+		cv::Size mSize;		// Of the projector window, which the fringes are decoded in
+		CalibratorProjector mCalibrator;
+		
+		ProjectorCalibStage mStage;
+		double mT;
+		size_t mFrame;
+		size_t mCam;
+		bool mStarted;
+		
+		std::vector<cv::Point2f> mCorners;
+		std::vector<cv::Mat> mFrames;
+		std::vector<boost::shared_ptr<ChessboardDetector> > mDetectors;	// One per camera
+	};
+	
+	boost::shared_ptr<SharedObj> mObj;
+};
+
+
 /*
  * ListState provides extra functions to the state in order to remove itself from a list
  */
@@ -260,11 +312,140 @@ public:
 	void update();
 	void draw();
 	
+protected:
+	void detectPaired(std::vector<cv::Point3f> *results, std::vector<uint8_t> *found, cv::Point2f dot, boost::posix_time::ptime after, size_t c0, size_t c1);
+	
+public:
 	glm::mat4 mViewMatrix;
 	float_t mHoriz, mVert;
 	
 };
 
+/*
+ * State Planned Scanning - the single dot scan, but positions come from a coarse to fine planner
+ * so empty parts of the projector are only visited at the coarse pitch
+ */
+ 
+class StatePlannedScan : public LeedsState {
+public:
+	StatePlannedScan(SharedInfo info) : LeedsState(info) { mID = "StatePlannedScan"; mW = false; mObj.reset(new SharedObj()); }
+	virtual StatePlannedScan* do_clone() const { return new StatePlannedScan( *this ); };
+	void update();
+	void draw();
+	
+protected:
+	void detect(std::vector<cv::Point2f> *points, std::vector<uint8_t> *found, size_t c0, size_t c1);
+	
+	struct SharedObj {
+		SharedObj() { mT = 0; mStarted = false; mDone = false; };
+		
+		boost::shared_ptr<ScanPlanner> pPlanner;
+		cv::Point mPos;
+		double mT;
+		bool mStarted;
+		bool mDone;
+		
+		std::vector<cv::Point3f> mPoints;
+		boost::mutex mMutex;
+	};
+	
+	boost::shared_ptr<SharedObj> mObj;
+	
+};
+
+/*
+ * State Phase Scanning - steps the projector through the fringe sequence, grabbing a frame
+ * from every camera each time, then decodes and triangulates every projector cell
+ */
+ 
+class StatePhaseScan : public LeedsState {
+public:
+	StatePhaseScan(SharedInfo info) : LeedsState(info) { mID = "StatePhaseScan"; mW = false; mObj.reset(new SharedObj()); }
+	virtual StatePhaseScan* do_clone() const { return new StatePhaseScan( *this ); };
+	void update();
+	void draw();
+	
+protected:
+	void solve();
+	void solveRows(std::vector<cv::Mat> *cells, std::vector< std::vector<cv::Point3f> > *rows, size_t y0, size_t y1);
+	
+	struct SharedObj {
+		SharedObj() { mFrame = 0; mT = 0; mStarted = false; mDone = false; };
+		
+		size_t mFrame;
+		double mT;
+		bool mStarted;
+		bool mDone;
+		
+		std::vector< std::vector<cv::Mat> > mFrames;	// Grey frames per camera, per fringe
+		std::vector<cv::Point3f> mPoints;				// Solved points waiting for the GL thread
+		boost::mutex mMutex;
+	};
+	
+	boost::shared_ptr<SharedObj> mObj;
+	
+};
+
+/*
+ * State Stripe Scanning - sweeps a single projector line, finds it on every camera row
+ * and intersects each camera ray with the line's plane of light. Needs a calibrated projector
+ */
+ 
+class StateStripeScan : public LeedsState {
+public:
+	StateStripeScan(SharedInfo info) : LeedsState(info) { mID = "StateStripeScan"; mW = false; mObj.reset(new SharedObj()); }
+	virtual StateStripeScan* do_clone() const { return new StateStripeScan( *this ); };
+	void update();
+	void draw();
+	
+protected:
+	void detect(std::vector< std::vector<cv::Point3f> > *results, cv::Vec4d plane, size_t c0, size_t c1);
+	
+	struct SharedObj {
+		SharedObj() { mT = 0; mStarted = false; mDone = false; };
+		
+		double mT;
+		bool mStarted;
+		bool mDone;
+		
+		std::vector<cv::Point3f> mPoints;
+		boost::mutex mMutex;
+	};
+	
+	boost::shared_ptr<SharedObj> mObj;
+	
+};
+
+/*
+ * State Multiple Dot Scanning - projects a grid of colour coded dots at once, finds them all in
+ * every camera and groups them by epipolar geometry before triangulating each group
+ */
+ 
+class StateDotScan : public LeedsState {
+public:
+	StateDotScan(SharedInfo info) : LeedsState(info) { mID = "StateDotScan"; mW = false; mObj.reset(new SharedObj()); }
+	virtual StateDotScan* do_clone() const { return new StateDotScan( *this ); };
+	void update();
+	void draw();
+	
+protected:
+	void detect(std::vector< std::vector<Dot> > *dots, size_t c0, size_t c1);
+	
+	struct SharedObj {
+		SharedObj() { mT = 0; mStarted = false; mDone = false; };
+		
+		double mT;
+		bool mStarted;
+		bool mDone;
+		
+		std::vector<cv::Point3f> mPoints;
+		boost::mutex mMutex;
+	};
+	
+	boost::shared_ptr<SharedObj> mObj;
+	
+};
+
 /*
  * State Texturing
  */
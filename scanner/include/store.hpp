@@ -0,0 +1,84 @@
+/**
+* @brief Binary calibration bundle for all cameras with their derived tables
+* @file store.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 30/07/2012
+*
+*/
+
+#ifndef _STORE_HPP_
+#define _STORE_HPP_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+
+#include "config.hpp"
+
+
+/*
+ * Tables derived from a camera's parameters - remap tables for undistortion and the
+ * normalised, undistorted ray for every pixel. Hash says which intrinsics built them
+ */
+
+class CalibrationTables {
+public:
+	CalibrationTables() { hash = 0; };
+	
+	void build(CameraParameters &p, cv::Size size);
+	bool valid(CameraParameters &p);
+	void normalise(const std::vector<cv::Point2f> &pixels, std::vector<cv::Point2f> &normalised, CameraParameters &p);
+	
+	uint64_t hash;
+	cv::Mat mapA;	// CV_16SC2
+	cv::Mat mapB;	// CV_16UC1
+	cv::Mat rays;	// CV_32FC2
+};
+
+uint64_t hashParameters(CameraParameters &p, bool extrinsics = true);
+
+
+/*
+ * The file is a header, then per camera a small record of M, D, R and T followed by its tables
+ * Loading maps the file so the tables are used in place without being recomputed
+ */
+
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint64_t timestamp;
+	uint64_t hash;			// Over every camera's parameter hash
+	uint32_t cameras;
+	int32_t width;
+	int32_t height;
+	uint32_t reserved;
+}CalibrationHeader;
+
+
+class CalibrationStore {
+public:
+	CalibrationStore() { pData = NULL; mSize = 0; };
+	~CalibrationStore();
+	
+	bool load(std::string filename, cv::Size size);
+	static bool save(std::string filename, std::vector<CameraParameters*> &params, std::vector<CalibrationTables*> &tables, cv::Size size);
+	
+	size_t numCameras() { return mParams.size(); };
+	CameraParameters& getParams(size_t i) { return mParams[i]; };
+	CalibrationTables& getTables(size_t i) { return mTables[i]; };
+	uint64_t getTimestamp() { return mHeader.timestamp; };
+	
+protected:
+	
+	void release();
+	
+	void *pData;
+	size_t mSize;
+	
+	CalibrationHeader mHeader;
+	std::vector<CameraParameters> mParams;
+	std::vector<CalibrationTables> mTables;	// Mat headers straight into the mapping
+};
+
+#endif
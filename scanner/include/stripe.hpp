@@ -0,0 +1,43 @@
+/**
+* @brief Line stripe detection for laser style scanning
+* @file stripe.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 18/07/2012
+*
+*/
+
+#ifndef _STRIPE_HPP_
+#define _STRIPE_HPP_
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "config.hpp"
+#include "utils.hpp"
+
+
+/*
+ * Finds the brightest point of a projected line on every row (or column) of a grey image
+ * and refines it to subpixel either by centre of mass or a three point gaussian fit
+ */
+
+class StripeDetector {
+public:
+	StripeDetector(uint8_t threshold, int window, bool gaussian, bool columns = false) : 
+		mThreshold(threshold), mWindow(window), mGaussian(gaussian), mColumns(columns) {};
+	
+	void detect(cv::Mat &grey, std::vector<cv::Point2f> &peaks);
+	
+protected:
+
+	void detectBand(cv::Mat *grey, cv::Mat *maxes, std::vector<float> *found, size_t r0, size_t r1);
+	float refine(const uint8_t *row, int cols, int first, int last);
+	
+	uint8_t mThreshold;
+	int mWindow;
+	bool mGaussian;
+	bool mColumns;
+
+};
+
+#endif
@@ -0,0 +1,119 @@
+/**
+* @brief One pool of worker threads for the whole program
+* @file thread_pool.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 13/08/2012
+*
+*/
+
+#ifndef _THREAD_POOL_HPP_
+#define _THREAD_POOL_HPP_
+
+#include <deque>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+
+/*
+ * A task handed to the pool. Waiting on one that no worker has started yet runs it on the
+ * waiting thread, so a task can wait on another without holding up a worker
+ */
+
+class PoolTask {
+public:
+	PoolTask(boost::function<void ()> fn) : mFn(fn), mState(TASK_QUEUED) {};
+
+	bool ready();
+	void wait();	// Throws whatever the task threw
+
+protected:
+	friend class ThreadPool;
+
+	typedef enum {
+		TASK_QUEUED,
+		TASK_RUNNING,
+		TASK_DONE
+	}TaskState;
+
+	void _run();
+
+	boost::function<void ()> mFn;
+	TaskState mState;
+	boost::exception_ptr mError;	// What the task threw, thrown again by wait
+	boost::mutex mMutex;
+	boost::condition_variable mDone;
+};
+
+typedef boost::shared_ptr<PoolTask> TaskFuture;
+
+
+/*
+ * Work stealing pool. Each worker has its own deque - it takes its newest task from the back
+ * and, when that is empty, steals the oldest from the front of another's. Tasks submitted
+ * from a worker go on its own deque, others are dealt round the workers in turn.
+ *
+ * Long jobs like calibration and meshing run as tasks alongside the short ones parallelFor
+ * makes, so the worker count is the whole program's use of the cores
+ */
+
+class ThreadPool {
+public:
+	static ThreadPool& get();
+
+	void setup(size_t workers, bool affinity);	// 0 workers for one per core
+	size_t size() { return mSize; };
+	size_t idle();	// Workers not running a task right now
+
+	TaskFuture submit(boost::function<void ()> fn);
+	void parallelFor(size_t begin, size_t end, size_t grain, boost::function<void (size_t, size_t)> fn);
+
+	~ThreadPool();
+
+protected:
+	ThreadPool();
+
+	struct Worker {
+		boost::mutex mMutex;
+		std::deque<TaskFuture> mTasks;
+	};
+
+	// One parallelFor. The caller and any workers that pick up a helper task all take
+	// chunks until none are left, so it never waits on a helper that has not started
+	struct Loop {
+		boost::function<void (size_t, size_t)> mFn;
+		size_t mNext, mEnd, mChunk;
+		size_t mChunks, mDone;
+		boost::exception_ptr mError;	// The first chunk to throw
+		boost::mutex mMutex;
+		boost::condition_variable mFinished;
+	};
+
+	static void _runChunks(boost::shared_ptr<Loop> loop);
+
+	void _start();
+	void _stop();
+	void _work(size_t id);
+	void _pin(size_t id);
+	void _push(TaskFuture task);
+	bool _take(size_t id, TaskFuture &task);
+
+	boost::ptr_vector<Worker> mWorkers;
+	boost::ptr_vector<boost::thread> mThreads;
+	size_t mSize;
+	bool mAffinity;
+	bool mStarted;
+
+	boost::mutex mMutex;		// Guards the counts and start up
+	boost::condition_variable mWake;
+	size_t mQueued;
+	size_t mBusy;
+	size_t mNextWorker;
+	bool mStop;
+
+	static boost::thread_specific_ptr<size_t> sWorkerId;
+};
+
+#endif
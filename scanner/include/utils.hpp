@@ -12,8 +12,12 @@
 
 #include <opencv2/opencv.hpp>
 #include <stdlib.h>
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
 
 #include "config.hpp"
+#include "thread_pool.hpp"
 
 template<class T> inline std::string toStringS9(const T& t) {
 	std::ostringstream stream;
@@ -42,12 +46,18 @@ std::string getRenderbufferParameters(GLuint id);
  * OpenCV related functions for file saving and loading
  */
 
-bool findChessboard(cv::Mat &cam0, std::vector<cv::Point2f> &corners, cv::Mat &board, cv::Size &size );
-
 bool loadCameraParameters(std::string filename, CameraParameters &ip);
 
 bool saveCameraParameters(std::string filename, CameraParameters &ip);
 
 
+/*
+ * Threading helpers - split a range into chunks of at least grain on the shared pool and
+ * block until all are done
+ */
+
+void parallelFor(size_t begin, size_t end, size_t grain, boost::function<void (size_t, size_t)> fn);
+
+
 
 #endif
@@ -28,6 +28,7 @@
 #define VBO_NORM 0x08
 #define VBO_TEXC 0x10
 #define VBO_TEXI 0x20
+#define VBO_BLND 0x40	// Interleaved only
  
 class VBOData {
 public:
@@ -36,6 +37,7 @@ public:
 	~VBOData();
 	
 	void compile(size_t buffers);
+	void compileInterleaved(size_t buffers);
 	
 	void bind();
 	void unbind();
@@ -49,6 +51,7 @@ public:
 	
 	size_t mUsed;
 	size_t mNumBufs;
+	size_t mNumAttribs;
 	size_t mVID;
 	size_t mIID;
 	size_t mCID;
@@ -66,6 +69,7 @@ public:
 	std::vector<GLfloat> mNormals;		// normals as 3 floats
 	std::vector<GLfloat> mColours;		// colours as 3 or 4 floats
 	std::vector<GLuint> vTexIDs;		// texids as indicies to textures per vertex - samplers basically
+	std::vector<GLfloat> mBlend;		// camera blend weights, 8 per vertex, as two vec4s
 	
 }; 
 
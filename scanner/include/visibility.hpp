@@ -0,0 +1,47 @@
+/**
+* @brief Per camera depth maps for deciding which cameras can see which faces
+* @file visibility.hpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 06/08/2012
+*
+*/
+
+#ifndef _VISIBILITY_HPP_
+#define _VISIBILITY_HPP_
+
+#include <vector>
+#include <stdint.h>
+#include <opencv2/opencv.hpp>
+
+#include "halfedge.hpp"
+#include "config.hpp"
+
+
+/*
+ * Rasterises the mesh from one camera into a depth map on the CPU, so it works with no
+ * GL context. Rows are split between threads and each thread only writes its own rows.
+ * A face is visible when the depth at its centre is not behind the nearest surface
+ */
+
+class DepthMap {
+public:
+	DepthMap(cv::Size size) : mSize(size), pMesh(NULL) {};
+	
+	bool render(HalfEdgeMesh &mesh, CameraParameters &p);
+	void visible(uint8_t *out, float tolerance);
+	
+	cv::Mat& getDepth() { return mDepth; };
+	
+protected:
+	
+	void _rasterise(size_t r0, size_t r1);
+	void _test(uint8_t *out, float tolerance, size_t f0, size_t f1);
+	
+	cv::Size mSize;
+	cv::Mat mDepth;					// Inverse depth, 0 where nothing was drawn
+	std::vector<cv::Point2f> mUV;	// Every vertex in image co-ordinates
+	std::vector<float> mZ;			// and its depth along the camera axis
+	HalfEdgeMesh *pMesh;
+};
+
+#endif
@@ -0,0 +1,425 @@
+/**
+* @brief Bakes the camera textures for a mesh into one atlas for export
+* @file atlas.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 08/08/2012
+*
+*/
+
+#include "atlas.hpp"
+#include "utils.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+using namespace cv;
+
+
+/*
+ * Orders charts tallest first for the shelf packer
+ */
+
+struct TallerChart {
+	TallerChart(vector<Rect> &sizes) : mSizes(sizes) {};
+	bool operator () (size_t a, size_t b) const { return mSizes[a].height > mSizes[b].height; };
+	vector<Rect> &mSizes;
+};
+
+
+/*
+ * Bake the atlas for the mesh using the camera chosen for each face
+ */
+
+bool AtlasBaker::bake(HalfEdgeMesh &mesh, std::vector<boost::shared_ptr<LeedsCam> > &cameras) {
+	pMesh = &mesh;
+	if (mesh.numFaces() == 0 || cameras.size() == 0)
+		return false;
+
+	size_t nc = cameras.size();
+	mProjections.resize(nc);
+	mImages.resize(nc);
+
+	for (size_t c = 0; c < nc; c++){
+		CameraParameters &p = cameras[c]->getParams();
+		Projection &pr = mProjections[c];
+		pr.valid = !p.R.empty() && !p.T.empty();
+
+		if (pr.valid) {
+			Mat r, t, m, d = Mat::zeros(5, 1, CV_64F);
+			Rodrigues(p.R, r);
+			r.convertTo(r, CV_64F);
+			p.T.convertTo(t, CV_64F);
+			p.M.convertTo(m, CV_64F);
+			if (!p.D.empty()) p.D.reshape(1, p.D.total()).convertTo(d, CV_64F);
+
+			for (int j = 0; j < 9; j++) pr.R[j] = r.at<double>(j / 3, j % 3);
+			for (int j = 0; j < 3; j++) pr.T[j] = t.at<double>(j);
+			pr.K[0] = m.at<double>(0,0); pr.K[1] = m.at<double>(1,1);
+			pr.K[2] = m.at<double>(0,2); pr.K[3] = m.at<double>(1,2);
+			for (int j = 0; j < 5; j++) pr.D[j] = j < d.rows ? d.at<double>(j) : 0.0;
+		}
+
+		SharedFrame frame = cameras[c]->getFrame();
+		mImages[c] = frame ? frame->getImage() : cameras[c]->getImage();
+	}
+
+	_findCharts();
+
+	// Lay each chart out as its camera sees it, kept to around the image
+	mUV.resize(mesh.numFaces() * 3);
+	for (size_t i = 0; i < mCharts.size(); i++){
+		Chart &ch = mCharts[i];
+		Projection &pr = mProjections[ch.camera];
+		Size size = mImages[ch.camera].empty() ? Size(1,1) : mImages[ch.camera].size();
+		Rect_<float> bounds(-mPadding, -mPadding, size.width + 2 * mPadding, size.height + 2 * mPadding);
+
+		float x0 = 1e30f, y0 = 1e30f, x1 = -1e30f, y1 = -1e30f;
+		for (size_t k = 0; k < ch.faces.size(); k++){
+			uint32_t f = ch.faces[k];
+			for (size_t j = 0; j < 3; j++){
+				uint32_t v = mesh.vertex(f, j);
+				Point2f uv = pr.valid ? _project(pr, mesh.mX[v], mesh.mY[v], mesh.mZ[v]) : Point2f(0,0);
+				uv.x = min(max(uv.x, bounds.x), bounds.x + bounds.width);
+				uv.y = min(max(uv.y, bounds.y), bounds.y + bounds.height);
+				mUV[f * 3 + j] = uv;
+				x0 = min(x0, uv.x); y0 = min(y0, uv.y);
+				x1 = max(x1, uv.x); y1 = max(y1, uv.y);
+			}
+		}
+
+		int l = static_cast<int>(floorf(x0)) - mPadding;
+		int t = static_cast<int>(floorf(y0)) - mPadding;
+		int r = static_cast<int>(ceilf(x1)) + mPadding;
+		int b = static_cast<int>(ceilf(y1)) + mPadding;
+		ch.source = Rect(l, t, r - l + 1, b - t + 1);
+	}
+
+	_pack();
+
+	// Move the corners from camera to atlas co-ordinates
+	for (size_t i = 0; i < mCharts.size(); i++){
+		Chart &ch = mCharts[i];
+		Point2f shift(ch.offset.x - ch.source.x, ch.offset.y - ch.source.y);
+		for (size_t k = 0; k < ch.faces.size(); k++){
+			for (size_t j = 0; j < 3; j++)
+				mUV[ch.faces[k] * 3 + j] += shift;
+		}
+	}
+
+	parallelFor(0, mCharts.size(), 1, boost::bind(&AtlasBaker::_bakeCharts, this, _1, _2));
+
+	cerr << "Leeds - Baked " << mCharts.size() << " charts into a " << mAtlas.cols << "x" << mAtlas.rows << " atlas" << endl;
+	return true;
+}
+
+/*
+ * Flood out from each face across twins that share its camera
+ */
+
+void AtlasBaker::_findCharts() {
+	HalfEdgeMesh &mesh = *pMesh;
+	size_t nf = mesh.numFaces();
+
+	mCharts.clear();
+	mChartOf.assign(nf, HalfEdgeMesh::sNone);
+	vector<uint32_t> stack;
+
+	for (size_t f = 0; f < nf; f++){
+		if (mChartOf[f] != HalfEdgeMesh::sNone)
+			continue;
+
+		uint32_t id = mCharts.size();
+		mCharts.push_back(Chart());
+		Chart &ch = mCharts.back();
+		ch.camera = mesh.mTex[f];
+
+		mChartOf[f] = id;
+		stack.push_back(f);
+
+		while (!stack.empty()) {
+			uint32_t g = stack.back();
+			stack.pop_back();
+			ch.faces.push_back(g);
+
+			for (uint32_t j = 0; j < 3; j++){
+				uint32_t t = mesh.twin(g * 3 + j);
+				if (t == HalfEdgeMesh::sNone)
+					continue;
+				uint32_t h = mesh.face(t);
+				if (mChartOf[h] == HalfEdgeMesh::sNone && mesh.mTex[h] == ch.camera) {
+					mChartOf[h] = id;
+					stack.push_back(h);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Shelf packing, tallest first, into a power of two width that fits the widest chart
+ */
+
+void AtlasBaker::_pack() {
+	vector<Rect> sizes(mCharts.size());
+	vector<size_t> order(mCharts.size());
+	double area = 0;
+	int widest = 1;
+
+	for (size_t i = 0; i < mCharts.size(); i++){
+		sizes[i] = mCharts[i].source;
+		order[i] = i;
+		area += static_cast<double>(sizes[i].area());
+		widest = max(widest, sizes[i].width);
+	}
+
+	int width = 1;
+	while (width < widest || static_cast<double>(width) * width < area * 1.15)
+		width *= 2;
+
+	sort(order.begin(), order.end(), TallerChart(sizes));
+
+	int x = 0, y = 0, shelf = 0;
+	for (size_t i = 0; i < order.size(); i++){
+		Chart &ch = mCharts[order[i]];
+		if (x + ch.source.width > width) {
+			y += shelf;
+			x = 0;
+			shelf = 0;
+		}
+		ch.offset = Point(x, y);
+		x += ch.source.width;
+		shelf = max(shelf, ch.source.height);
+	}
+
+	mAtlas = Mat(max(1, y + shelf), width, CV_8UC3, Scalar(128,128,128));
+}
+
+/*
+ * Fill the texels of a range of charts. Charts never overlap in the atlas so each thread
+ * has its own pixels
+ */
+
+void AtlasBaker::_bakeCharts(size_t c0, size_t c1) {
+	HalfEdgeMesh &mesh = *pMesh;
+
+	for (size_t i = c0; i < c1; i++){
+		Chart &ch = mCharts[i];
+		Rect area(ch.offset, ch.source.size());
+		Mat mask = Mat::zeros(area.size(), CV_8U);
+		Point2f toSource(ch.source.x - ch.offset.x, ch.source.y - ch.offset.y);
+		Mat &image = mImages[ch.camera];
+		Vec3f gain = _gain(ch.camera);
+
+		for (size_t k = 0; k < ch.faces.size(); k++){
+			uint32_t f = ch.faces[k];
+			const Point2f *uv = &mUV[f * 3];
+
+			float det = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[1].y - uv[0].y) * (uv[2].x - uv[0].x);
+			if (fabsf(det) < 1e-8f)
+				continue;
+			float inv = 1.0f / det;
+
+			int x0 = max(area.x, static_cast<int>(floorf(min(uv[0].x, min(uv[1].x, uv[2].x)))));
+			int x1 = min(area.x + area.width - 1, static_cast<int>(ceilf(max(uv[0].x, max(uv[1].x, uv[2].x)))));
+			int y0 = max(area.y, static_cast<int>(floorf(min(uv[0].y, min(uv[1].y, uv[2].y)))));
+			int y1 = min(area.y + area.height - 1, static_cast<int>(ceilf(max(uv[0].y, max(uv[1].y, uv[2].y)))));
+
+			// Neighbouring charts from other cameras along each edge, for the seam blend
+			GLuint other[3];
+			for (uint32_t j = 0; j < 3; j++){
+				uint32_t t = mesh.twin(f * 3 + j);
+				other[j] = t == HalfEdgeMesh::sNone ? HalfEdgeMesh::sNone : mesh.mTex[mesh.face(t)];
+				if (other[j] == ch.camera || (other[j] != HalfEdgeMesh::sNone && !mProjections[other[j]].valid))
+					other[j] = HalfEdgeMesh::sNone;
+			}
+
+			uint32_t va = mesh.vertex(f, 0), vb = mesh.vertex(f, 1), vc = mesh.vertex(f, 2);
+
+			for (int y = y0; y <= y1; y++){
+				for (int x = x0; x <= x1; x++){
+					Point2f p(x + 0.5f, y + 0.5f);
+					float w0 = ((uv[2].x - uv[1].x) * (p.y - uv[1].y) - (uv[2].y - uv[1].y) * (p.x - uv[1].x)) * inv;
+					float w1 = ((uv[0].x - uv[2].x) * (p.y - uv[2].y) - (uv[0].y - uv[2].y) * (p.x - uv[2].x)) * inv;
+					float w2 = 1.0f - w0 - w1;
+					if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f)
+						continue;
+
+					Vec3f colour = _sample(image, p + toSource).mul(gain);
+
+					for (uint32_t j = 0; j < 3; j++){
+						if (other[j] == HalfEdgeMesh::sNone)
+							continue;
+
+						// Distance to the shared edge, corner j to corner j + 1
+						Point2f a = uv[j], e = uv[(j + 1) % 3] - uv[j];
+						float len = sqrtf(e.dot(e));
+						if (len < 1e-6f)
+							continue;
+						float d = fabsf(e.x * (p.y - a.y) - e.y * (p.x - a.x)) / len;
+						if (d >= mSeam)
+							continue;
+
+						float px = w0 * mesh.mX[va] + w1 * mesh.mX[vb] + w2 * mesh.mX[vc];
+						float py = w0 * mesh.mY[va] + w1 * mesh.mY[vb] + w2 * mesh.mY[vc];
+						float pz = w0 * mesh.mZ[va] + w1 * mesh.mZ[vb] + w2 * mesh.mZ[vc];
+
+						float w = 0.5f * (1.0f - d / mSeam);
+						Vec3f theirs = _sample(mImages[other[j]], _project(mProjections[other[j]], px, py, pz)).mul(_gain(other[j]));
+						colour = colour * (1.0f - w) + theirs * w;
+					}
+
+					mAtlas.at<Vec3b>(y, x) = Vec3b(saturate_cast<uchar>(colour[0]), saturate_cast<uchar>(colour[1]), saturate_cast<uchar>(colour[2]));
+					mask.at<uchar>(y - area.y, x - area.x) = 255;
+				}
+			}
+		}
+
+		_dilate(ch, mask);
+	}
+}
+
+/*
+ * Grow the chart into its padding so filtering at the edge never picks up the background
+ */
+
+void AtlasBaker::_dilate(Chart &chart, cv::Mat &mask) {
+	Mat tile = mAtlas(Rect(chart.offset, chart.source.size()));
+
+	for (int pass = 0; pass < mPadding + 1; pass++){
+		Mat before = mask.clone();
+
+		for (int y = 0; y < tile.rows; y++){
+			for (int x = 0; x < tile.cols; x++){
+				if (before.at<uchar>(y, x))
+					continue;
+
+				Vec3f sum(0,0,0);
+				int n = 0;
+				if (x > 0 && before.at<uchar>(y, x - 1)) { sum += Vec3f(tile.at<Vec3b>(y, x - 1)); n++; }
+				if (x < tile.cols - 1 && before.at<uchar>(y, x + 1)) { sum += Vec3f(tile.at<Vec3b>(y, x + 1)); n++; }
+				if (y > 0 && before.at<uchar>(y - 1, x)) { sum += Vec3f(tile.at<Vec3b>(y - 1, x)); n++; }
+				if (y < tile.rows - 1 && before.at<uchar>(y + 1, x)) { sum += Vec3f(tile.at<Vec3b>(y + 1, x)); n++; }
+
+				if (n > 0) {
+					sum *= 1.0f / n;
+					tile.at<Vec3b>(y, x) = Vec3b(saturate_cast<uchar>(sum[0]), saturate_cast<uchar>(sum[1]), saturate_cast<uchar>(sum[2]));
+					mask.at<uchar>(y, x) = 255;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Same pinhole and distortion model as projectPoints, for one point
+ */
+
+cv::Point2f AtlasBaker::_project(const Projection &p, float x, float y, float z) {
+	double cx = p.R[0] * x + p.R[1] * y + p.R[2] * z + p.T[0];
+	double cy = p.R[3] * x + p.R[4] * y + p.R[5] * z + p.T[1];
+	double cz = p.R[6] * x + p.R[7] * y + p.R[8] * z + p.T[2];
+	if (cz <= 0.0)
+		return Point2f(-1e6f, -1e6f);
+
+	double a = cx / cz, b = cy / cz;
+	double r2 = a * a + b * b;
+	double radial = 1.0 + r2 * (p.D[0] + r2 * (p.D[1] + r2 * p.D[4]));
+	double xd = a * radial + 2.0 * p.D[2] * a * b + p.D[3] * (r2 + 2.0 * a * a);
+	double yd = b * radial + p.D[2] * (r2 + 2.0 * b * b) + 2.0 * p.D[3] * a * b;
+
+	return Point2f(p.K[0] * xd + p.K[2], p.K[1] * yd + p.K[3]);
+}
+
+/*
+ * Bilinear sample, clamped at the borders. Grey if there is no image. The projection is
+ * OpenCV's, with pixel centres on whole coordinates, so there is no half pixel shift
+ */
+
+cv::Vec3f AtlasBaker::_sample(const cv::Mat &image, cv::Point2f p) {
+	if (image.empty())
+		return Vec3f(128,128,128);
+
+	float x = min(max(p.x, 0.0f), static_cast<float>(image.cols - 1));
+	float y = min(max(p.y, 0.0f), static_cast<float>(image.rows - 1));
+	int x0 = static_cast<int>(x), y0 = static_cast<int>(y);
+	int x1 = min(x0 + 1, image.cols - 1), y1 = min(y0 + 1, image.rows - 1);
+	float fx = x - x0, fy = y - y0;
+
+	Vec3f a = Vec3f(image.at<Vec3b>(y0, x0)) * (1.0f - fx) + Vec3f(image.at<Vec3b>(y0, x1)) * fx;
+	Vec3f b = Vec3f(image.at<Vec3b>(y1, x0)) * (1.0f - fx) + Vec3f(image.at<Vec3b>(y1, x1)) * fx;
+	return a * (1.0f - fy) + b * fy;
+}
+
+/*
+ * Gain for a camera, one if none were given
+ */
+
+cv::Vec3f AtlasBaker::_gain(GLuint camera) {
+	if (camera * 3 + 2 >= mGains.size())
+		return Vec3f(1,1,1);
+	return Vec3f(mGains[camera * 3], mGains[camera * 3 + 1], mGains[camera * 3 + 2]);
+}
+
+/*
+ * Write the OBJ with its material and atlas image alongside
+ */
+
+bool AtlasBaker::save(std::string filename) {
+	if (pMesh == NULL || mAtlas.empty())
+		return false;
+
+	HalfEdgeMesh &mesh = *pMesh;
+
+	size_t dot = filename.find_last_of('.');
+	size_t slash = filename.find_last_of('/');
+	string base = (dot == string::npos || (slash != string::npos && dot < slash)) ? filename : filename.substr(0, dot);
+	string name = slash == string::npos ? base : base.substr(slash + 1);
+
+	// Camera images are RGB, imwrite wants BGR
+	Mat bgr;
+	cvtColor(mAtlas, bgr, CV_RGB2BGR);
+	if (!imwrite(base + ".png", bgr)) {
+		cerr << "Leeds - Could not write atlas " << base << ".png" << endl;
+		return false;
+	}
+
+	ofstream mtl((base + ".mtl").c_str());
+	mtl << "newmtl atlas" << endl;
+	mtl << "Ka 1.0 1.0 1.0" << endl;
+	mtl << "Kd 1.0 1.0 1.0" << endl;
+	mtl << "map_Kd " << name << ".png" << endl;
+	mtl.close();
+
+	ofstream obj(filename.c_str());
+	if (!obj.is_open()) {
+		cerr << "Leeds - Could not write " << filename << endl;
+		return false;
+	}
+
+	obj << "mtllib " << name << ".mtl" << endl;
+	obj << "usemtl atlas" << endl;
+
+	for (size_t v = 0; v < mesh.numVertices(); v++)
+		obj << "v " << mesh.mX[v] << " " << mesh.mY[v] << " " << mesh.mZ[v] << endl;
+	for (size_t v = 0; v < mesh.numVertices(); v++)
+		obj << "vn " << mesh.mVNX[v] << " " << mesh.mVNY[v] << " " << mesh.mVNZ[v] << endl;
+
+	float w = static_cast<float>(mAtlas.cols), h = static_cast<float>(mAtlas.rows);
+	for (size_t i = 0; i < mUV.size(); i++)
+		obj << "vt " << mUV[i].x / w << " " << 1.0f - mUV[i].y / h << endl;
+
+	for (size_t f = 0; f < mesh.numFaces(); f++){
+		obj << "f";
+		for (size_t j = 0; j < 3; j++){
+			size_t v = mesh.vertex(f, j) + 1;
+			obj << " " << v << "/" << f * 3 + j + 1 << "/" << v;
+		}
+		obj << endl;
+	}
+	obj.close();
+
+	cerr << "Leeds - Saved textured mesh to " << filename << endl;
+	return true;
+}
@@ -0,0 +1,384 @@
+/**
+* @brief Bundle adjustment of the camera extrinsics over several board poses
+* @file bundle.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 27/07/2012
+*
+*/
+
+#include "bundle.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+/*
+ * Cameras start from their current calibration
+ */
+
+void BundleAdjuster::addCamera(CameraParameters &p) {
+	mCameras.push_back(&p);
+	mCounts.push_back(0);
+}
+
+/*
+ * A new board pose - worked out from the first camera that saw it when solving
+ */
+
+size_t BundleAdjuster::addPose() {
+	mPoses.push_back(Mat::zeros(6, 1, CV_64F));
+	mByPose.push_back(vector<size_t>());
+	return mPoses.size() - 1;
+}
+
+void BundleAdjuster::addObservation(size_t camera, size_t pose, std::vector<cv::Point2f> &corners) {
+	Observation o;
+	o.camera = camera;
+	o.pose = pose;
+	o.corners = corners;
+	mByPose[pose].push_back(mObs.size());
+	mObs.push_back(o);
+	mCounts[camera] += corners.size();
+}
+
+/*
+ * Build the parameter blocks. Non world poses come from solvePnP in one camera moved into the world
+ */
+
+void BundleAdjuster::initialise() {
+	mBoard.clear();
+	for(int j=0;j< mBoardSize.height * mBoardSize.width; j++)
+		mBoard.push_back(Point3f(j/mBoardSize.width, j%mBoardSize.width, 0.0f));
+	
+	mCams.clear();
+	mBlock.clear();
+	mOffset.clear();
+	mCamParams = 0;
+	for (size_t c = 0; c < mCameras.size(); c++){
+		CameraParameters &p = *mCameras[c];
+		mBlock.push_back(mIntrinsics ? 10 + p.D.total() : 6);
+		mOffset.push_back(mCamParams);
+		mCamParams += mBlock[c];
+		
+		Mat b = Mat::zeros(mBlock[c], 1, CV_64F);
+		
+		Mat r, t;
+		p.R.convertTo(r, CV_64F);
+		p.T.convertTo(t, CV_64F);
+		r.reshape(1,3).copyTo(b.rowRange(0,3));
+		t.reshape(1,3).copyTo(b.rowRange(3,6));
+		
+		if (mIntrinsics) {
+			b.at<double>(6) = p.M.at<double>(0,0);
+			b.at<double>(7) = p.M.at<double>(1,1);
+			b.at<double>(8) = p.M.at<double>(0,2);
+			b.at<double>(9) = p.M.at<double>(1,2);
+			Mat d;
+			p.D.convertTo(d, CV_64F);
+			if (!d.empty())
+				d.reshape(1, d.total()).copyTo(b.rowRange(10, mBlock[c]));
+		}
+		mCams.push_back(b);
+	}
+	
+	for (size_t b = 1; b < mPoses.size(); b++){
+		if (mByPose[b].empty())
+			continue;
+		
+		Observation &o = mObs[mByPose[b][0]];
+		CameraParameters &p = *mCameras[o.camera];
+		
+		Mat rp, tp, Rp, Rc;
+		solvePnP(mBoard, o.corners, p.M, p.D, rp, tp, false, CV_ITERATIVE);
+		Rodrigues(rp, Rp);
+		Rodrigues(mCams[o.camera].rowRange(0,3), Rc);
+		
+		Mat R = Rc.t() * Rp;
+		Mat t = Rc.t() * (tp - mCams[o.camera].rowRange(3,6));
+		
+		Mat r;
+		Rodrigues(R, r);
+		r.copyTo(mPoses[b].rowRange(0,3));
+		t.copyTo(mPoses[b].rowRange(3,6));
+	}
+}
+
+/*
+ * Unpack a camera block into the forms projectPoints wants
+ */
+
+void BundleAdjuster::pack(size_t c, cv::Mat &r, cv::Mat &t, cv::Mat &M, cv::Mat &D, const cv::Mat &params) {
+	r = params.rowRange(0,3);
+	t = params.rowRange(3,6);
+	
+	CameraParameters &p = *mCameras[c];
+	p.M.convertTo(M, CV_64F);
+	p.D.convertTo(D, CV_64F);
+	
+	if (mIntrinsics) {
+		M.at<double>(0,0) = params.at<double>(6);
+		M.at<double>(1,1) = params.at<double>(7);
+		M.at<double>(0,2) = params.at<double>(8);
+		M.at<double>(1,2) = params.at<double>(9);
+		if (!D.empty())
+			D = params.rowRange(10, mBlock[c]).clone().reshape(1, D.rows);
+	}
+}
+
+/*
+ * Observed minus projected for one camera / pose pair. The board pose is applied first and then
+ * the camera, so composeRT gives the chain rule back to both blocks
+ */
+
+cv::Mat BundleAdjuster::residual(const Observation &o, const cv::Mat &cam, const cv::Mat &pose, cv::Mat *Jc, cv::Mat *Jb) {
+	Mat rc, tc, M, D;
+	pack(o.camera, rc, tc, M, D, cam);
+	
+	Mat rb = pose.rowRange(0,3);
+	Mat tb = pose.rowRange(3,6);
+	
+	Mat r, t, dr3dr1, dr3dt1, dr3dr2, dr3dt2, dt3dr1, dt3dt1, dt3dr2, dt3dt2;
+	composeRT(rb, tb, rc, tc, r, t, dr3dr1, dr3dt1, dr3dr2, dr3dt2, dt3dr1, dt3dt1, dt3dr2, dt3dt2);
+	
+	vector<Point2f> projected;
+	Mat J;
+	if (Jc)
+		projectPoints(mBoard, r, t, M, D, projected, J);
+	else
+		projectPoints(mBoard, r, t, M, D, projected);
+	
+	Mat e (2 * projected.size(), 1, CV_64F);
+	for (size_t i = 0; i < projected.size(); i++){
+		e.at<double>(2 * i) = o.corners[i].x - projected[i].x;
+		e.at<double>(2 * i + 1) = o.corners[i].y - projected[i].y;
+	}
+	
+	if (!Jc)
+		return e;
+	
+	// d(r3,t3) / d(r,t) of each block
+	Mat Ab (6, 6, CV_64F), Ac (6, 6, CV_64F);
+	dr3dr1.copyTo(Ab(Rect(0,0,3,3)));
+	dr3dt1.copyTo(Ab(Rect(3,0,3,3)));
+	dt3dr1.copyTo(Ab(Rect(0,3,3,3)));
+	dt3dt1.copyTo(Ab(Rect(3,3,3,3)));
+	
+	dr3dr2.copyTo(Ac(Rect(0,0,3,3)));
+	dr3dt2.copyTo(Ac(Rect(3,0,3,3)));
+	dt3dr2.copyTo(Ac(Rect(0,3,3,3)));
+	dt3dt2.copyTo(Ac(Rect(3,3,3,3)));
+	
+	Mat Jrt = J.colRange(0,6);
+	
+	*Jb = Jrt * Ab;
+	
+	size_t P = mBlock[o.camera];
+	*Jc = Mat(J.rows, P, CV_64F);
+	Mat jc = Jrt * Ac;
+	jc.copyTo(Jc->colRange(0,6));
+	if (mIntrinsics)
+		J.colRange(6, P).copyTo(Jc->colRange(6, P));
+	
+	return e;
+}
+
+/*
+ * Accumulate the normal equations for a range of poses. Each pose owns its V and W blocks,
+ * the camera blocks are summed locally and merged once at the end
+ */
+
+void BundleAdjuster::linearise(Normals *n, size_t p0, size_t p1) {
+	size_t C = mCams.size();
+	size_t B = mPoses.size();
+	
+	vector<Mat> U, gU;
+	for (size_t c = 0; c < C; c++){
+		U.push_back(Mat::zeros(mBlock[c], mBlock[c], CV_64F));
+		gU.push_back(Mat::zeros(mBlock[c], 1, CV_64F));
+	}
+	
+	for (size_t b = p0; b < p1; b++){
+		for (size_t k = 0; k < mByPose[b].size(); k++){
+			Observation &o = mObs[mByPose[b][k]];
+			Mat Jc, Jb;
+			Mat e = residual(o, mCams[o.camera], mPoses[b], &Jc, &Jb);
+			
+			U[o.camera] += Jc.t() * Jc;
+			gU[o.camera] += Jc.t() * e;
+			
+			if (b == 0)
+				continue;
+			
+			n->V[b] += Jb.t() * Jb;
+			n->gV[b] += Jb.t() * e;
+			n->W[o.camera * B + b] += Jc.t() * Jb;
+		}
+	}
+	
+	boost::lock_guard<boost::mutex> lock(n->mMutex);
+	for (size_t c = 0; c < C; c++){
+		n->U[c] += U[c];
+		n->gU[c] += gU[c];
+	}
+}
+
+/*
+ * Sum of squared residuals per camera for a range of observations
+ */
+
+void BundleAdjuster::cost(std::vector<cv::Mat> *cams, std::vector<cv::Mat> *poses, std::vector<double> *sums, size_t o0, size_t o1) {
+	for (size_t i = o0; i < o1; i++){
+		Observation &o = mObs[i];
+		Mat e = residual(o, (*cams)[o.camera], (*poses)[o.pose], 0, 0);
+		(*sums)[i] = e.dot(e);
+	}
+}
+
+double BundleAdjuster::totalCost(std::vector<cv::Mat> &cams, std::vector<cv::Mat> &poses, std::vector<double> &perCamera) {
+	vector<double> sums(mObs.size(), 0);
+	parallelFor(0, mObs.size(), 4, boost::bind(&BundleAdjuster::cost, this, &cams, &poses, &sums, _1, _2));
+	
+	perCamera.assign(mCams.size(), 0);
+	double total = 0;
+	for (size_t i = 0; i < mObs.size(); i++){
+		perCamera[mObs[i].camera] += sums[i];
+		total += sums[i];
+	}
+	return total;
+}
+
+/*
+ * Levenberg-Marquardt with the poses eliminated:
+ * (U - W V^-1 W^T) dc = gU - W V^-1 gV, then dv = V^-1 (gV - W^T dc)
+ */
+
+double BundleAdjuster::solve(int iterations) {
+	if (mCameras.empty() || mPoses.empty())
+		return -1.0;
+	
+	initialise();
+	
+	size_t C = mCams.size();
+	size_t B = mPoses.size();
+	size_t P = mCamParams;
+	
+	vector<double> perCamera;
+	double current = totalCost(mCams, mPoses, perCamera);
+	double lambda = 1e-3;
+	
+	for (int it = 0; it < iterations; it++){
+		Normals n;
+		for (size_t c = 0; c < C; c++){
+			n.U.push_back(Mat::zeros(mBlock[c], mBlock[c], CV_64F));
+			n.gU.push_back(Mat::zeros(mBlock[c], 1, CV_64F));
+		}
+		for (size_t b = 0; b < B; b++){
+			n.V.push_back(Mat::zeros(6, 6, CV_64F));
+			n.gV.push_back(Mat::zeros(6, 1, CV_64F));
+		}
+		for (size_t i = 0; i < C * B; i++)
+			n.W.push_back(Mat::zeros(mBlock[i / B], 6, CV_64F));
+		
+		parallelFor(0, B, 1, boost::bind(&BundleAdjuster::linearise, this, &n, _1, _2));
+		
+		bool improved = false;
+		
+		while (!improved && lambda < 1e10) {
+			Mat S = Mat::zeros(P, P, CV_64F);
+			Mat rhs (P, 1, CV_64F);
+			
+			for (size_t c = 0; c < C; c++){
+				Mat u = n.U[c].clone();
+				for (size_t d = 0; d < mBlock[c]; d++)
+					u.at<double>(d,d) *= 1.0 + lambda;
+				u.copyTo(S(Rect(mOffset[c], mOffset[c], mBlock[c], mBlock[c])));
+				n.gU[c].copyTo(rhs.rowRange(mOffset[c], mOffset[c] + mBlock[c]));
+			}
+			
+			vector<Mat> Vinv(B);
+			for (size_t b = 1; b < B; b++){
+				Mat v = n.V[b].clone();
+				for (size_t d = 0; d < 6; d++)
+					v.at<double>(d,d) = v.at<double>(d,d) * (1.0 + lambda) + 1e-12;
+				Vinv[b] = v.inv(DECOMP_CHOLESKY);
+				
+				for (size_t c1 = 0; c1 < C; c1++){
+					Mat &W1 = n.W[c1 * B + b];
+					if (countNonZero(W1) == 0)
+						continue;
+					Mat Y = W1 * Vinv[b];
+					rhs.rowRange(mOffset[c1], mOffset[c1] + mBlock[c1]) -= Y * n.gV[b];
+					
+					for (size_t c2 = 0; c2 < C; c2++){
+						Mat &W2 = n.W[c2 * B + b];
+						if (countNonZero(W2) == 0)
+							continue;
+						Mat s = S(Rect(mOffset[c2], mOffset[c1], mBlock[c2], mBlock[c1]));
+						s -= Y * W2.t();
+					}
+				}
+			}
+			
+			Mat dc;
+			if (!cv::solve(S, rhs, dc, DECOMP_CHOLESKY))
+				cv::solve(S, rhs, dc, DECOMP_SVD);
+			
+			vector<Mat> cams(C), poses(B);
+			for (size_t c = 0; c < C; c++)
+				cams[c] = mCams[c] + dc.rowRange(mOffset[c], mOffset[c] + mBlock[c]);
+			
+			poses[0] = mPoses[0].clone();
+			for (size_t b = 1; b < B; b++){
+				Mat g = n.gV[b].clone();
+				for (size_t c = 0; c < C; c++)
+					g -= n.W[c * B + b].t() * dc.rowRange(mOffset[c], mOffset[c] + mBlock[c]);
+				poses[b] = mPoses[b] + Vinv[b] * g;
+			}
+			
+			vector<double> candidate;
+			double next = totalCost(cams, poses, candidate);
+			
+			if (next < current) {
+				improved = true;
+				lambda = std::max(lambda / 10.0, 1e-12);
+				
+				double change = (current - next) / current;
+				mCams.swap(cams);
+				mPoses.swap(poses);
+				perCamera.swap(candidate);
+				current = next;
+				
+				if (change < 1e-9)
+					it = iterations;
+			}
+			else
+				lambda *= 10.0;
+		}
+		
+		if (!improved)
+			break;
+	}
+	
+	// Write back and report
+	mErrors.assign(C, 0);
+	size_t total = 0;
+	for (size_t c = 0; c < C; c++){
+		Mat r, t, M, D;
+		pack(c, r, t, M, D, mCams[c]);
+		CameraParameters &p = *mCameras[c];
+		r.copyTo(p.R);
+		t.copyTo(p.T);
+		if (mIntrinsics) {
+			M.copyTo(p.M);
+			D.copyTo(p.D);
+		}
+		
+		if (mCounts[c] > 0)
+			mErrors[c] = sqrt(perCamera[c] / mCounts[c]);
+		total += mCounts[c];
+		
+		cerr << "Leeds - bundle adjusted camera " << c << " RMS " << mErrors[c] << endl;
+	}
+	
+	return total > 0 ? sqrt(current / total) : 0.0;
+}
@@ -18,25 +18,40 @@ using namespace cv;
 
 bool CalibratorCamera::addImage(cv::Mat &cam, cv::Mat &board) {
 	vector<Point2f> corners;
-	if (findChessboard(cam,corners,board, mBoardSize)){
-		objectPoints.push_back( std::vector<cv::Point3f>() );
-		
-		for(int j=0;j< mBoardSize.height *  mBoardSize.width; j++)
-			objectPoints.back().push_back(Point3f(j/mBoardSize.width, j%mBoardSize.width, 0.0f));
-	
-		imagePoints.push_back(corners);
-		
+	if (mDetector.detect(cam,corners,board)){
+		addCorners(corners);
 		return true;
 	}
 	return false;
 }
 
 /*
- * Callable Function - launched from a thread and performs actual calibration
+ * Add the raw image of a camera frame, sharing its grey pyramid
+ */
+
+bool CalibratorCamera::addImage(LeedsFrame &frame, cv::Mat &board) {
+	vector<Point2f> corners;
+	if (mDetector.detect(frame,false,corners,board)){
+		addCorners(corners);
+		return true;
+	}
+	return false;
+}
+
+void CalibratorCamera::addCorners(std::vector<cv::Point2f> &corners) {
+	objectPoints.push_back( std::vector<cv::Point3f>() );
+	
+	for(int j=0;j< mBoardSize.height *  mBoardSize.width; j++)
+		objectPoints.back().push_back(Point3f(j/mBoardSize.width, j%mBoardSize.width, 0.0f));
+
+	imagePoints.push_back(corners);
+}
+
+/*
+ * Callable Function - run as a task on the pool and performs actual calibration
  */
 
-double CalibratorCamera::operator()(uint8_t threadCount) {
-	threadCount++;
+double CalibratorCamera::operator()() {
 	mP.M.ptr<float>(0)[0] = (float)mImageSize.width / (float)mImageSize.height;
 	mP.M.ptr<float>(1)[1] = (float)mImageSize.height / (float)mImageSize.width;
 	
@@ -46,16 +61,14 @@ double CalibratorCamera::operator()(uint8_t threadCount) {
 	cerr << "Leeds - calibrated camera with error " << error << endl;
 
 	mP.mCalibrated = true;
-	threadCount--;
 	return error;
 }
 
 /*
- * Callable Function - launched from a thread performing world calibration on all cameras
+ * Callable Function - run as a task on the pool performing world calibration on all cameras
  */
  
- double CalibratorWorld::operator()(uint8_t threadCount) {
-	threadCount++;
+ double CalibratorWorld::operator()() {
 	vector<Point3f> tOPoints;
 		
 	for(int j=0;j< mBoardSize.height * mBoardSize.width; j++)
@@ -68,7 +81,107 @@ double CalibratorCamera::operator()(uint8_t threadCount) {
 	///\todo - generate reprojection error
 	
 	cerr << "Leeds - calibrated world" << endl;
-	threadCount--;
+	return 0.0;
+}
+
+/*
+ * Add a view for the projector. The corners are mapped into the projector through a
+ * local homography fitted to the decoded pixels around each corner
+ */
+
+bool CalibratorProjector::addView(std::vector<cv::Point2f> &corners, cv::Mat &map, cv::Mat &mask, CameraParameters &camera) {
+	vector<Point2f> projected;
+	
+	for (size_t i = 0; i < corners.size(); i++){
+		Point2f p;
+		if (!toProjector(corners[i], map, mask, p))
+			return false;
+		projected.push_back(p);
+	}
+	
+	objectPoints.push_back( std::vector<cv::Point3f>() );
+	for(int j=0;j< mBoardSize.height *  mBoardSize.width; j++)
+		objectPoints.back().push_back(Point3f(j/mBoardSize.width, j%mBoardSize.width, 0.0f));
+	
+	imagePoints.push_back(projected);
+	mCameraPoints.push_back(corners);
+	mCameras.push_back(camera);
+	return true;
+}
+
+/*
+ * Corners sit on black/white edges where the fringes are weak, so fit around them instead
+ */
+
+bool CalibratorProjector::toProjector(cv::Point2f corner, cv::Mat &map, cv::Mat &mask, cv::Point2f &result) {
+	static const int w = 10;
+	
+	vector<Point2f> src, dst;
+	int cx = cvRound(corner.x);
+	int cy = cvRound(corner.y);
+	
+	for (int y = cy - w; y <= cy + w; y++){
+		for (int x = cx - w; x <= cx + w; x++){
+			if (x < 0 || y < 0 || x >= map.cols || y >= map.rows)
+				continue;
+			if (!mask.at<uint8_t>(y,x))
+				continue;
+			src.push_back(Point2f(x,y));
+			Vec2f m = map.at<Vec2f>(y,x);
+			dst.push_back(Point2f(m[0],m[1]));
+		}
+	}
+	
+	if (src.size() < static_cast<size_t>(w * w))
+		return false;
+	
+	Mat H = findHomography(src, dst, 0);
+	if (H.empty())
+		return false;
+	
+	vector<Point2f> in, out;
+	in.push_back(corner);
+	perspectiveTransform(in, out, H);
+	result = out[0];
+	return true;
+}
+
+/*
+ * Solve the projector intrinsics from all views, then move it into the world of the cameras
+ * using the first view: world -> camera -> board -> projector
+ */
+
+double CalibratorProjector::operator()() {
+	if (imagePoints.size() < 3) {
+		cerr << "Leeds - Not enough views to calibrate the projector" << endl;
+		return -1.0;
+	}
+	
+	double error = calibrateCamera(objectPoints, imagePoints, mImageSize, mP.M, mP.D, mP.Rs, mP.Ts, 0);
+	
+	cerr << "Leeds - calibrated projector with error " << error << endl;
+	
+	// Board pose in the camera for the first view
+	Mat rb, tb;
+	CameraParameters &cam = mCameras[0];
+	solvePnP(objectPoints[0], mCameraPoints[0], cam.M, cam.D, rb, tb, false, CV_ITERATIVE);
+	
+	Mat Rb, Rc, Rp;
+	Rodrigues(rb, Rb);
+	Rodrigues(cam.R, Rc);
+	Rodrigues(mP.Rs[0], Rp);
+	
+	Mat Rpb = Rp * Rb.t();
+	Mat R = Rpb * Rc;
+	Mat T = Rpb * (cam.T - tb) + mP.Ts[0];
+	
+	Rodrigues(R, mP.R);
+	mP.T = T;
+	mP.mCalibrated = true;
+	
+	cerr << "Leeds - projector world transform " << mP.R << " " << mP.T << endl;
+	
+	return error;
 }
 
 /*
@@ -16,11 +16,12 @@ using namespace boost::assign;
  * Constructor for the LeedsCam - initialise transforms and similar
  */
 
-LeedsCam::LeedsCam(UVCVideo &cam, Size size) : mCam(cam) {
+LeedsCam::LeedsCam(UVCVideo &cam, Size size, std::string filename) : mCam(cam), mFilename(filename) {
 	
 	// Initialise Matrices
 	mImage = Mat(size, CV_8UC3);
 	mImageRectified = Mat(size, CV_8UC3);
+	pPool.reset(new FramePool());
 	mResult = Mat(size,CV_8UC3);
 	
 	// Initialise texture - using GL_TEXTURE_RECTANGLE
@@ -60,36 +61,57 @@ LeedsCam::LeedsCam(UVCVideo &cam, Size size) : mCam(cam) {
 
 /*
  * Camera update - checks the buffer and performs rectification if possible
+ * The remap tables are only rebuilt when the intrinsics change
  */
 
 void LeedsCam::update() {
-	// Update from the UVCVideo
-	mImage = cv::Mat (mImage.size(), CV_8UC3, mCam.getBuffer());
+	bool rectified = isRectified();
+	
+	// Update from the UVCVideo into a new frame so consumers holding the last one are undisturbed
+	SharedFrame frame (new LeedsFrame(pPool, mImage.size(), rectified));
+	cv::Mat (mImage.size(), CV_8UC3, mCam.getBuffer()).copyTo(frame->getImage());
 		
-	if (isRectified())
-		undistort(mImage, mImageRectified, mP.M, mP.D);
+	if (rectified){
+		if (!mTables.valid(mP)){
+			cerr << "Leeds - Building undistortion tables for " << mFilename << endl;
+			mTables.build(mP, mImage.size());
+		}
+		remap(frame->getImage(), frame->getImageRectified(), mTables.mapA, mTables.mapB, INTER_LINEAR);
+	}
+	
+	boost::lock_guard<boost::mutex> lock(mFrameMutex);
+	pFrame = frame;
+	mImage = frame->getImage();
+	if (rectified)
+		mImageRectified = frame->getImageRectified();
 }
 
 /*
- * Camera update for GL Textures only. Swaps out when not needed
+ * Camera update for GL Textures only. Swaps out when not needed. The raw texture is the 
+ * one the mesh is painted with, so it only takes the frame that passed the quality gate
  */
  
- void LeedsCam::updateTexture() {
+ void LeedsCam::updateTexture(SharedFrame frame, bool capture) {
 
-	
+	if (!frame)
+		return;
 	
 	// Update OpenGL texture - hopefully fast enough
-	if (isRectified()){
-		
+	if (frame->isRectified()){
+		cv::Mat &rectified = frame->getImageRectified();
 		bindRectified();
-		glTexSubImage2D(GL_TEXTURE_RECTANGLE,0,0,0,mImageRectified.size().width, 
-			mImageRectified.size().height, GL_RGB, GL_UNSIGNED_BYTE, (unsigned char *) IplImage(mImageRectified).imageData );
+		glTexSubImage2D(GL_TEXTURE_RECTANGLE,0,0,0,rectified.size().width, 
+			rectified.size().height, GL_RGB, GL_UNSIGNED_BYTE, rectified.data );
 		unbind();
 	}
 
+	if (!capture)
+		return;
+	
+	cv::Mat &image = frame->getImage();
 	bind();
-	glTexSubImage2D(GL_TEXTURE_RECTANGLE,0,0,0,mImage.size().width, 
-	mImage.size().height, GL_RGB, GL_UNSIGNED_BYTE, mCam.getBuffer() );		
+	glTexSubImage2D(GL_TEXTURE_RECTANGLE,0,0,0,image.size().width, 
+	image.size().height, GL_RGB, GL_UNSIGNED_BYTE, image.data );		
 	unbind();
 
 }
@@ -167,8 +189,6 @@ void LeedsCam::computeNormal() {
 }
 
 
-uint8_t CameraManager::sThreads = 0;
-
 /*
  * Camera Manager Setup Function - Shared object
  */
@@ -195,10 +215,15 @@ uint8_t CameraManager::sThreads = 0;
  */
 
 void CameraManager::update() {
-	for (vector< boost::shared_ptr<LeedsCam> >::iterator it = mObj->mCams.begin(); it != mObj->mCams.end(); it++){
-		boost::shared_ptr<LeedsCam> l = *it;
-		l->update();
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mFrameMutex);
+		for (vector< boost::shared_ptr<LeedsCam> >::iterator it = mObj->mCams.begin(); it != mObj->mCams.end(); it++){
+			boost::shared_ptr<LeedsCam> l = *it;
+			l->update();
+		}
+		mObj->mFrameCount++;
 	}
+	mObj->mFrameCond.notify_all();
 	
 	// update result texture - this is done here because we should have all OpenGL calls on the same thread
 	bind();
@@ -214,7 +239,8 @@ void CameraManager::update() {
 void CameraManager::updateTextures() {
 	for (vector< boost::shared_ptr<LeedsCam> >::iterator it = mObj->mCams.begin(); it != mObj->mCams.end(); it++){
 		boost::shared_ptr<LeedsCam> l = *it;
-		l->updateTexture();
+		SharedFrame frame = l->getFrame();
+		l->updateTexture(frame, frame && _goodFrame(*frame));
 		l->updateResultTexture();
 	}
 }
@@ -242,12 +268,19 @@ boost::shared_ptr<LeedsCam> CameraManager::addCamera(std::string dev, std::strin
 	mObj->mDevs.push_back(pc);
 	pc->startCapture(dev,mObj->mConfig.camSize.width,mObj->mConfig.camSize.height,mObj->mConfig.fps);
 	 
-	boost::shared_ptr<LeedsCam> pv (new LeedsCam(*pc,mObj->mConfig.camSize));
+	boost::shared_ptr<LeedsCam> pv (new LeedsCam(*pc,mObj->mConfig.camSize,filename));
 	mObj->mCams.push_back(pv);
+	
+	size_t idx = mObj->mCams.size() - 1;
 	 
-	// Attempt to load parameters
+	// Attempt to load parameters - from the bundle if there is one, with its tables
 	
-	if (loadCameraParameters(filename, pv->getParams()) )
+	if (mObj->pStore && idx < mObj->pStore->numCameras() && mObj->pStore->getParams(idx).mCalibrated) {
+		pv->setParams(mObj->pStore->getParams(idx));
+		pv->setTables(mObj->pStore->getTables(idx));
+		pv->computeNormal();
+	}
+	else if (loadCameraParameters(filename, pv->getParams()) )
 		pv->computeNormal();
 	
 	 
@@ -255,46 +288,130 @@ boost::shared_ptr<LeedsCam> CameraManager::addCamera(std::string dev, std::strin
 }
  
 /*
- * Calibrate all the cameras - launch the thread. Takes a callback to signal finishing
+ * Calibrate all the cameras - a job on the pool. isThreading is true until it finishes
  */
   
 void CameraManager::calibrateCameras() {
-	sThreads++; // shows we are still working
-	mObj->pWorkerThread =  new boost::thread(&CameraManager::_calibrateCameras, this);
+	mObj->mJob = ThreadPool::get().submit(boost::bind(&CameraManager::_calibrateCameras, this));
 }
  
 /*
- * Calibrate all the cameras, fixing their errors - Threaded actual method
+ * Wait for the next frame from the cameras. Times out so a shutdown is never missed
+ */
+
+uint64_t CameraManager::waitForFrame(uint64_t last) {
+	boost::unique_lock<boost::mutex> lock(mObj->mFrameMutex);
+	while (mObj->mFrameCount == last && !mObj->mStop){
+		if (!mObj->mFrameCond.timed_wait(lock, boost::posix_time::seconds(1)))
+			break;
+	}
+	return mObj->mFrameCount;
+}
+
+/*
+ * Calibrate all the cameras, fixing their errors - the job itself
+ * Every camera collects boards at once. Each new frame the cameras still short of boards 
+ * search in parallel and any camera with enough boards is solved as its own task straight away
  */
   
 void CameraManager::_calibrateCameras() {
-	for (vector< boost::shared_ptr<LeedsCam> >::iterator it = mObj->mCams.begin(); it != mObj->mCams.end(); it++){
-		boost::shared_ptr<LeedsCam> l = *it;
+	using namespace boost::posix_time;
+	
+	size_t n = mObj->mCams.size();
+	
+	vector<boost::shared_ptr<CalibratorCamera> > calibrators;
+	for (size_t i = 0; i < n; i++)
+		calibrators.push_back(boost::shared_ptr<CalibratorCamera>(
+			new CalibratorCamera(mObj->mCams[i]->getParams(), mObj->mConfig.camSize, mObj->mConfig.boardSize)));
+	
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mProgressMutex);
+		mObj->mProgress.assign(n, 0);
+	}
+	
+	vector<SharedFrame> frames(n);
+	vector<Mat> boards(n);
+	vector<uint8_t> wanted(n), found(n);
+	vector<int> counts(n, 0);
+	vector<ptime> last(n, ptime(min_date_time));
+	time_duration interval = milliseconds(static_cast<long>(mObj->mConfig.interval * 1000.0f));
+	
+	vector<TaskFuture> solvers;
+	size_t remaining = n;
+	uint64_t frame = 0;
+	
+	while (remaining > 0 && !mObj->mStop) {
+		frame = waitForFrame(frame);
+		ptime now = microsec_clock::universal_time();
 		
-		double lastCall;	
-		clock_t init, final;
-		init=clock();
-		int numImages = 0;
+		// Hold on to the frames we want - no copies, the frames stay put while the cameras move on
+		bool any = false;
+		for (size_t i = 0; i < n; i++){
+			wanted[i] = counts[i] < mObj->mConfig.maxImages && now - last[i] >= interval;
+			found[i] = 0;
+			frames[i] = wanted[i] ? mObj->mCams[i]->getFrame() : SharedFrame();
+			if (wanted[i] && !frames[i])
+				wanted[i] = 0;
+			any = any || wanted[i];
+		}
 		
-		CalibratorCamera c(l->getParams(), mObj->mConfig.camSize, mObj->mConfig.boardSize);
+		if (!any)
+			continue;
 		
-		Mat cammat = l->getImage();
+		parallelFor(0, n, 1, boost::bind(&CameraManager::_findBoards, this, &calibrators, &frames, &boards, &wanted, &found, _1, _2));
 		
-		while (numImages < mObj->mConfig.maxImages){
-			lastCall = ((clock()- init) / (double)CLOCKS_PER_SEC);
+		for (size_t i = 0; i < n; i++){
+			if (!found[i])
+				continue;
+			
+			last[i] = now;
+			counts[i]++;
+			
+			{
+				boost::lock_guard<boost::mutex> lock(mObj->mProgressMutex);
+				mObj->mProgress[i] = counts[i];
+			}
+			
+			{
+				boost::lock_guard<boost::mutex> lock(mObj->mFrameMutex);
+				boards[i].copyTo(mObj->mResult);
+			}
 			
-			if ( lastCall > mObj->mConfig.interval) {
-				if (c.addImage( cammat , mObj->mResult))
-					numImages++;
-					
-				lastCall = 0.0;
-				init = clock();
+			if (counts[i] == mObj->mConfig.maxImages) {
+				solvers.push_back(ThreadPool::get().submit(boost::bind(&CalibratorCamera::operator(), calibrators[i])));
+				remaining--;
 			}
 		}
-		
-		boost::thread(c, sThreads);
 	}
-	sThreads--;
+	
+	for (size_t i = 0; i < solvers.size(); i++)
+		solvers[i]->wait();
+}
+
+/*
+ * Search a range of cameras for the board. Each camera has its own calibrator so no locking
+ */
+
+void CameraManager::_findBoards(std::vector<boost::shared_ptr<CalibratorCamera> > *calibrators, std::vector<SharedFrame> *frames, 
+	std::vector<cv::Mat> *boards, std::vector<uint8_t> *wanted, std::vector<uint8_t> *found, size_t c0, size_t c1) {
+	
+	for (size_t i = c0; i < c1; i++){
+		if ((*wanted)[i] && _goodFrame(*(*frames)[i]))
+			(*found)[i] = (*calibrators)[i]->addImage(*(*frames)[i], (*boards)[i]);
+	}
+}
+
+/*
+ * Cheap check before any board search - is this frame sharp and well exposed?
+ */
+
+bool CameraManager::_goodFrame(LeedsFrame &frame) {
+	QualityLimits limits;
+	limits.minSharpness = mObj->mConfig.qualitySharpness;
+	limits.maxSaturation = mObj->mConfig.qualitySaturation;
+	limits.minMean = mObj->mConfig.qualityDark;
+	limits.maxMean = mObj->mConfig.qualityBright;
+	return acceptable(frame.getQuality(), limits);
 }
 		
  
@@ -303,60 +420,174 @@ void CameraManager::_calibrateCameras() {
  */
   
 void CameraManager::calibrateWorld() {
-	sThreads++; // shows we are still working
-	mObj->pWorkerThread =  new boost::thread(&CameraManager::_calibrateWorld, this);
+	mObj->mJob = ThreadPool::get().submit(boost::bind(&CameraManager::_calibrateWorld, this));
 }
   
+/*
+ * World calibration keeps each camera's last board and only searches the cameras still pending
+ * Once every camera has the world board, further poses seen by two or more cameras can be
+ * gathered and everything refined together with the bundle adjuster
+ */
+
 void CameraManager::_calibrateWorld() {
+	using namespace boost::posix_time;
+	
+	size_t n = mObj->mCams.size();
 	
-	bool go = true;
+	vector< vector<Point2f> > kept;
+	vector<uint8_t> ready;
+	
+	if (_waitForBoards(kept, ready, n) < n)
+		return;
 	
 	vector<boost::shared_ptr<CalibratorWorld> > calibrators;
+	for (size_t i = 0; i < n; i++){
+		boost::shared_ptr<CalibratorWorld> p(new CalibratorWorld(mObj->mCams[i]->getParams(), mObj->mConfig.camSize, mObj->mConfig.boardSize));
+		p->setCorners(kept[i]);
+		calibrators.push_back(p);
+	}
+	
+	parallelFor(0, n, 1, boost::bind(&CameraManager::_solveWorld, this, &calibrators, _1, _2));
 	
-	while (go){
+	if (mObj->mConfig.worldPoses > 1) {
+		BundleAdjuster adjuster(mObj->mConfig.boardSize, mObj->mConfig.worldIntrinsics);
+		for (size_t i = 0; i < n; i++)
+			adjuster.addCamera(mObj->mCams[i]->getParams());
 		
-		calibrators.clear();
-				
+		size_t pose = adjuster.addPose();
+		for (size_t i = 0; i < n; i++)
+			adjuster.addObservation(i, pose, kept[i]);
 		
-		go = false;
-		int idx = 0;
-		for (vector< boost::shared_ptr<LeedsCam> >::iterator it = mObj->mCams.begin(); it != mObj->mCams.end(); it++){
-			
-			boost::shared_ptr<LeedsCam> l = *it;
+		while (adjuster.numPoses() < static_cast<size_t>(mObj->mConfig.worldPoses) && !mObj->mStop) {
+			// Give the board time to move before looking for the next pose
+			boost::this_thread::sleep(milliseconds(static_cast<long>(mObj->mConfig.interval * 1000.0f)));
 			
+			size_t need = std::min<size_t>(2, n);
+			if (_waitForBoards(kept, ready, need) < need)
+				break;
 			
-			boost::shared_ptr<CalibratorWorld> p(new CalibratorWorld(l->getParams(), mObj->mConfig.camSize, mObj->mConfig.boardSize));
+			pose = adjuster.addPose();
+			for (size_t i = 0; i < n; i++){
+				if (ready[i])
+					adjuster.addObservation(i, pose, kept[i]);
+			}
+			cerr << "Leeds - world calibration pose " << adjuster.numPoses() << " of " << mObj->mConfig.worldPoses << endl;
+		}
 		
-			calibrators.push_back(p );
-			
-			
-			Mat cammat;
-				
-			if (l->isRectified())
-				cammat = l->getImageRectified();
-			else
-				cammat = l->getImage();
+		if (!mObj->mStop) {
+			double error = adjuster.solve();
+			cerr << "Leeds - bundle adjustment RMS " << error << endl;
+		}
+	}
+}
+
+/*
+ * Wait until at least need cameras have a stable board, searching only the cameras without one
+ * A board counts once it has been seen in the same place on consecutive frames, and
+ * expires after a couple of intervals so the cameras all see the same board pose
+ */
+
+size_t CameraManager::_waitForBoards(std::vector< std::vector<cv::Point2f> > &kept, std::vector<uint8_t> &ready, size_t need) {
+	using namespace boost::posix_time;
+	
+	size_t n = mObj->mCams.size();
+	
+	vector<boost::shared_ptr<ChessboardDetector> > detectors;
+	for (size_t i = 0; i < n; i++)
+		detectors.push_back(boost::shared_ptr<ChessboardDetector>(new ChessboardDetector(mObj->mConfig.boardSize)));
+	
+	vector<SharedFrame> frames(n);
+	vector< vector<Point2f> > found(n);
+	vector<uint8_t> wanted(n), hit(n);
+	vector<int> stable(n, 0);
+	vector<ptime> seen(n, ptime(min_date_time));
+	
+	kept.assign(n, vector<Point2f>());
+	ready.assign(n, 0);
+	need = std::min(need, n);
+	
+	time_duration window = milliseconds(static_cast<long>(2000.0f * mObj->mConfig.interval));
+	uint64_t frame = 0;
+	
+	while (!mObj->mStop) {
+		frame = waitForFrame(frame);
+		ptime now = microsec_clock::universal_time();
+		
+		vector<int> pending;
+		for (size_t i = 0; i < n; i++){
+			if (now - seen[i] > window)
+				stable[i] = 0;
+			ready[i] = stable[i] >= 2;
+			wanted[i] = !ready[i];
+			hit[i] = 0;
+			if (wanted[i])
+				pending.push_back(i);
+		}
+		
+		{
+			boost::lock_guard<boost::mutex> lock(mObj->mProgressMutex);
+			mObj->mPending = pending;
+		}
+		
+		if (n - pending.size() >= need)
+			return n - pending.size();
+		
+		mObj->mWaitingOn = pending[0];
+		
+		for (size_t i = 0; i < n; i++){
+			frames[i] = wanted[i] ? mObj->mCams[i]->getFrame() : SharedFrame();
+			if (!frames[i])
+				wanted[i] = 0;
+		}
+		
+		parallelFor(0, n, 1, boost::bind(&CameraManager::_findWorldBoards, this, &detectors, &frames, &found, &wanted, &hit, _1, _2));
+		
+		for (size_t i = 0; i < n; i++){
+			if (!hit[i])
+				continue;
 			
-			if (!p->addImage(cammat, mObj->mResult)){
-				go = true;
-				mObj->mWaitingOn = idx;
-				break;
+			// Stable if the board has barely moved since the last sighting
+			double moved = 0;
+			if (stable[i] > 0 && kept[i].size() == found[i].size()) {
+				for (size_t j = 0; j < found[i].size(); j++){
+					Point2f d = found[i][j] - kept[i][j];
+					moved += sqrt(d.dot(d));
+				}
+				moved /= found[i].size();
 			}
-			idx++;
 			
+			stable[i] = (stable[i] > 0 && moved < 1.5) ? stable[i] + 1 : 1;
+			kept[i].swap(found[i]);
+			seen[i] = now;
 		}
 	}
 	
-	for (vector<boost::shared_ptr<CalibratorWorld> >::iterator it = calibrators.begin(); it != calibrators.end(); it++){
-		CalibratorWorld  c = *(*it);	
-		//boost::thread(c, sThreads);
-		// go non threaded as its a fast enough operation and we need to know when we've finished
-		c(sThreads);
-	}
-	calibrators.clear();
+	return 0;
+}
+
+/*
+ * Search a range of cameras for the board
+ */
+
+void CameraManager::_findWorldBoards(std::vector<boost::shared_ptr<ChessboardDetector> > *detectors, std::vector<SharedFrame> *frames, 
+	std::vector< std::vector<cv::Point2f> > *corners, std::vector<uint8_t> *wanted, std::vector<uint8_t> *found, size_t c0, size_t c1) {
 	
-	sThreads--;
- }
+	for (size_t i = c0; i < c1; i++){
+		if (!(*wanted)[i] || !_goodFrame(*(*frames)[i]))
+			continue;
+		Mat board;
+		(*found)[i] = (*detectors)[i]->detect(*(*frames)[i], true, (*corners)[i], board);
+	}
+}
+
+/*
+ * Solve a range of cameras against the board
+ */
+
+void CameraManager::_solveWorld(std::vector<boost::shared_ptr<CalibratorWorld> > *calibrators, size_t c0, size_t c1) {
+	for (size_t i = c0; i < c1; i++)
+		(*(*calibrators)[i])();
+}
  
  /*
   * Set a control for all the cameras
@@ -394,9 +625,11 @@ void CameraManager::bind() {
 
 bool CameraManager::detectPoint(cv::Mat &data, cv::Mat &result, cv::Point2f &point){
 
-	Mat grey = Mat(data.size(), CV_8UC1);
+	// Frames hand over their grey level directly, so only convert when given colour
+	Mat grey = data;
 	Mat thresh = Mat(data.size(), CV_8UC1);
-	cvtColor( data, grey, CV_RGB2GRAY );
+	if (data.channels() == 3)
+		cvtColor( data, grey, CV_RGB2GRAY );
 	result = Mat::zeros(data.rows, data.cols, CV_8UC3);
 	vector<vector<Point> > contours;
     vector<Vec4i> hierarchy;
@@ -433,9 +666,10 @@ bool CameraManager::detectPoint(cv::Mat &data, cv::Mat &result, cv::Point2f &poi
 
 /*
  * Given a series of points and extrinsics do some maths and recreate the depth point
+ * Tables, if given, hold each view's camera tables - NULL for the projector
  */
  
-cv::Point3f CameraManager::solveForAll( std::vector< std::pair< cv::Point2f, CameraParameters > > points) {
+cv::Point3f CameraManager::solveForAll( std::vector< std::pair< cv::Point2f, CameraParameters > > points, std::vector<CalibrationTables*> *tables) {
 	
 	int idx = 0;
 	int idy = 0;
@@ -456,7 +690,10 @@ cv::Point3f CameraManager::solveForAll( std::vector< std::pair< cv::Point2f, Cam
 			
 		vector<Point2f> tpoints;
 		tpoints.push_back(p.first);
-		undistortPoints(tpoints,results, in.M, in.D);
+		if (tables && (*tables)[idy])
+			(*tables)[idy]->normalise(tpoints, results, in);
+		else
+			undistortPoints(tpoints,results, in.M, in.D);
 	
 		Mat r (Size(3,3), CV_64FC1);
 		Rodrigues(in.R,r);
@@ -504,11 +741,89 @@ cv::Point3f CameraManager::solveForAll( std::vector< std::pair< cv::Point2f, Cam
 
 	solve(m,c,s,DECOMP_QR);
 	
-	Point3f p(s.at<double_t>(0,0),s.at<double_t>(1,0),s.at<double_t>(2,0));
+	// No logging here - the dense scanners call this for every point
+	return Point3f(s.at<double_t>(0,0),s.at<double_t>(1,0),s.at<double_t>(2,0));
+}
+
+
+/*
+ * Intersect each camera ray with a plane (a,b,c,d with aX + bY + cZ + d = 0) in world space
+ * Rays are X = C + s * R^t p where C = -R^t T is the camera centre
+ */
+
+void CameraManager::solveForPlane(std::vector<cv::Point2f> &points, CameraParameters &in, CalibrationTables &tables, cv::Vec4d plane, std::vector<cv::Point3f> &results) {
+	
+	results.clear();
+	if (points.size() == 0)
+		return;
+	
+	vector<Point2f> upoints;
+	tables.normalise(points, upoints, in);
+	
+	Mat r (Size(3,3), CV_64FC1);
+	Rodrigues(in.R,r);
+	Mat rt = r.t();
+	
+	Mat c = -rt * in.T;
+	Vec3d centre(c.at<double_t>(0,0), c.at<double_t>(1,0), c.at<double_t>(2,0));
+	Vec3d n(plane[0], plane[1], plane[2]);
+	double nc = n.dot(centre) + plane[3];
+	
+	Matx33d m = rt;
+	
+	for (size_t i = 0; i < upoints.size(); i++){
+		Vec3d dir = m * Vec3d(upoints[i].x, upoints[i].y, 1.0);
+		double nd = n.dot(dir);
+		
+		// Ray parallel to the plane
+		if (fabs(nd) < 1e-9)
+			continue;
+		
+		double t = -nc / nd;
+		if (t <= 0)
+			continue;
+		
+		Vec3d p = centre + dir * t;
+		results.push_back(Point3f(p[0], p[1], p[2]));
+	}
+}
+
+/*
+ * Load the projector's parameters - saved in the same format as a camera
+ */
+
+bool CameraManager::loadProjector(std::string filename, cv::Size size) {
+	mObj->mProjectorSize = size;
+	return loadCameraParameters(filename, mObj->mProjector);
+}
+
+/*
+ * The plane of light thrown by a single projector column, in world space
+ * Spanned by the rays through the top and bottom of the column, passing through the projector centre
+ */
+
+cv::Vec4d CameraManager::projectorPlane(float column) {
+	CameraParameters &in = mObj->mProjector;
+	
+	vector<Point2f> ends, uends;
+	ends.push_back(Point2f(column, 0));
+	ends.push_back(Point2f(column, mObj->mProjectorSize.height - 1));
+	undistortPoints(ends, uends, in.M, in.D);
+	
+	Mat r (Size(3,3), CV_64FC1);
+	Rodrigues(in.R,r);
+	Mat rt = r.t();
+	Matx33d m = rt;
 	
-	cerr << "Leeds - Computed depth point: " << p << endl;
+	Mat c = -rt * in.T;
+	Vec3d centre(c.at<double_t>(0,0), c.at<double_t>(1,0), c.at<double_t>(2,0));
 	
-	return p;
+	Vec3d d0 = m * Vec3d(uends[0].x, uends[0].y, 1.0);
+	Vec3d d1 = m * Vec3d(uends[1].x, uends[1].y, 1.0);
+	Vec3d n = d0.cross(d1);
+	n = n * (1.0 / norm(n));
+	
+	return Vec4d(n[0], n[1], n[2], -n.dot(centre));
 }
 
 
@@ -516,10 +831,30 @@ cv::Point3f CameraManager::solveForAll( std::vector< std::pair< cv::Point2f, Cam
  * Save settings to disk given the filenames
  */
  
-void CameraManager::saveSettings(std::vector<std::string> filenames) {
+void CameraManager::saveSettings() {
+	vector<CameraParameters*> params;
+	vector<CalibrationTables*> tables;
+	
 	for (int i=0; i < mObj->mCams.size(); i++){
-		saveCameraParameters(filenames[i], mObj->mCams[i]->getParams());
+		saveCameraParameters(mObj->mCams[i]->getFilename(), mObj->mCams[i]->getParams());
+		params.push_back(&mObj->mCams[i]->getParams());
+		tables.push_back(&mObj->mCams[i]->getTables());
 	}
+	
+	if (!params.empty())
+		CalibrationStore::save(mObj->mConfig.calibrationBundle, params, tables, mObj->mConfig.camSize);
+}
+
+/*
+ * Map the calibration bundle - must come before the cameras are added
+ */
+
+bool CameraManager::loadBundle(std::string filename) {
+	boost::shared_ptr<CalibrationStore> store(new CalibrationStore());
+	if (!store->load(filename, mObj->mConfig.camSize))
+		return false;
+	mObj->pStore = store;
+	return true;
 }
 
 /*
@@ -527,6 +862,9 @@ void CameraManager::saveSettings(std::vector<std::string> filenames) {
  */
  
 void CameraManager::shutdown() {
+	mObj->mStop = true;
+	mObj->mFrameCond.notify_all();
+	
 	for (vector< boost::shared_ptr<UVCVideo> >::iterator it = mObj->mDevs.begin(); it != mObj->mDevs.end(); it ++){
 		(*it)->stop();
 	}
@@ -0,0 +1,71 @@
+/**
+* @brief Chessboard detection on a downscaled image with full resolution refinement
+* @file chessboard.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 25/07/2012
+*
+*/
+
+#include "chessboard.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+/*
+ * Detect the board. The board image always gets a copy of the frame, with corners if found
+ */
+
+bool ChessboardDetector::detect(cv::Mat &rgb, std::vector<cv::Point2f> &corners, cv::Mat &board) {
+	
+	cvtColor(rgb, mGrey, CV_RGB2GRAY);
+	
+	// Go down while the image stays wide enough to hold the board
+	mPyramid.resize(mLevels);
+	Mat *level = &mGrey;
+	int l = 0;
+	
+	while (l < mLevels && (level->cols / 2) >= mMinWidth) {
+		pyrDown(*level, mPyramid[l]);
+		level = &mPyramid[l];
+		l++;
+	}
+	
+	return search(*level, 1 << l, mGrey, rgb, corners, board);
+}
+
+/*
+ * Detect using the grey levels the frame already has, or builds once for everyone
+ */
+
+bool ChessboardDetector::detect(LeedsFrame &frame, bool rectified, std::vector<cv::Point2f> &corners, cv::Mat &board) {
+	Mat &grey = frame.getGrey(0, rectified);
+	
+	int l = 0;
+	while (l < mLevels && l + 1 < static_cast<int>(LeedsFrame::sLevels) && (grey.cols >> (l + 1)) >= mMinWidth)
+		l++;
+	
+	Mat &rgb = (rectified && frame.isRectified()) ? frame.getImageRectified() : frame.getImage();
+	return search(frame.getGrey(l, rectified), 1 << l, grey, rgb, corners, board);
+}
+
+/*
+ * Search the small level and refine the corners on the full size grey
+ */
+
+bool ChessboardDetector::search(cv::Mat &level, int scale, cv::Mat &grey, cv::Mat &rgb, std::vector<cv::Point2f> &corners, cv::Mat &board) {
+	
+	rgb.copyTo(board);
+	
+	if (!findChessboardCorners(level, mBoardSize, corners, CALIB_CB_ADAPTIVE_THRESH + CALIB_CB_NORMALIZE_IMAGE + CALIB_CB_FAST_CHECK))
+		return false;
+	
+	for (size_t i = 0; i < corners.size(); i++)
+		corners[i] *= static_cast<float>(scale);
+	
+	// The coarse corners are within a pixel or so of the level, so the usual window still converges
+	cornerSubPix(grey, corners, Size(11,11), Size(-1,-1), TermCriteria(CV_TERMCRIT_ITER+CV_TERMCRIT_EPS, 30, 0.01));
+	
+	drawChessboardCorners(board, mBoardSize, corners, true);
+	return true;
+}
@@ -0,0 +1,330 @@
+/**
+* @brief Shared kd-tree for the point cloud stages
+* @file cloud_index.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 10/08/2012
+*
+*/
+
+#include "cloud_index.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using namespace std;
+using namespace boost;
+
+
+/*
+ * Keep the k closest in a max heap, so the worst of them is always at the front
+ */
+
+static inline void offer(std::vector< std::pair<float, int> > &heap, size_t k, float d2, int pos) {
+	if (heap.size() < k) {
+		heap.push_back(make_pair(d2, pos));
+		push_heap(heap.begin(), heap.end());
+	}
+	else if (d2 < heap.front().first) {
+		pop_heap(heap.begin(), heap.end());
+		heap.back() = make_pair(d2, pos);
+		push_heap(heap.begin(), heap.end());
+	}
+}
+
+static inline float distance2(const float *a, const float *b) {
+	float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+	return dx * dx + dy * dy + dz * dz;
+}
+
+
+/*
+ * Rebuild only if this is a different cloud, or the same one grown or shrunk
+ */
+
+void CloudIndex::setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices) {
+	// PCL makes up a list of every point when it was given none, which is the same index
+	IndicesConstPtr wanted = indices;
+	if (wanted && cloud && wanted->size() == cloud->points.size()) {
+		size_t i = 0;
+		while (i < wanted->size() && (*wanted)[i] == static_cast<int>(i))
+			i++;
+		if (i == wanted->size())
+			wanted.reset();
+	}
+
+	if (cloud && cloud == input_ && wanted == indices_ && cloud->points.size() == mBuiltSize)
+		return;
+
+	input_ = cloud;
+	indices_ = wanted;
+	_build();
+}
+
+/*
+ * Pack the finite points, then split. The top levels go a level at a time with each level
+ * across the cores, until there are enough subtrees to keep every core busy
+ */
+
+void CloudIndex::_build() {
+	posix_time::ptime start = posix_time::microsec_clock::universal_time();
+
+	mEntries.clear();
+	mBuiltSize = 0;
+	if (!input_)
+		return;
+
+	const PointCloud &cloud = *input_;
+	size_t n = indices_ ? indices_->size() : cloud.points.size();
+	mEntries.reserve(n);
+
+	for (size_t i = 0; i < n; i++){
+		int idx = indices_ ? (*indices_)[i] : static_cast<int>(i);
+		const pcl::PointXYZ &p = cloud.points[idx];
+		if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z))
+			continue;
+
+		Entry e;
+		e.p[0] = p.x;
+		e.p[1] = p.y;
+		e.p[2] = p.z;
+		e.index = idx;
+		mEntries.push_back(e);
+	}
+	mAxis.assign(mEntries.size(), 0);
+
+	size_t wanted = ThreadPool::get().size() * 4;
+	vector<Range> ranges(1, Range(0, mEntries.size()));
+	vector<Range> next;
+
+	while (ranges.size() < wanted) {
+		next.assign(ranges.size() * 2, Range(0, 0));
+		parallelFor(0, ranges.size(), 1, boost::bind(&CloudIndex::_splitRanges, this, &ranges, &next, _1, _2));
+
+		vector<Range> kept;
+		for (size_t i = 0; i < next.size(); i++){
+			if (next[i].second > next[i].first)
+				kept.push_back(next[i]);
+		}
+
+		// Nothing split, so everything left is a leaf
+		bool done = kept.size() == ranges.size();
+		ranges.swap(kept);
+		if (done)
+			break;
+	}
+
+	parallelFor(0, ranges.size(), 1, boost::bind(&CloudIndex::_buildRanges, this, &ranges, _1, _2));
+
+	mBuiltSize = cloud.points.size();
+	mBuilds++;
+
+	posix_time::time_duration took = posix_time::microsec_clock::universal_time() - start;
+	cerr << "Leeds - Cloud index of " << mEntries.size() << " points built in " << took.total_milliseconds() << "ms" << endl;
+}
+
+/*
+ * Make one node - the median on the widest axis of the range. False for a leaf
+ */
+
+bool CloudIndex::_split(size_t lo, size_t hi) {
+	if (hi - lo <= mLeaf)
+		return false;
+
+	float mn[3], mx[3];
+	for (int a = 0; a < 3; a++)
+		mn[a] = mx[a] = mEntries[lo].p[a];
+
+	for (size_t i = lo + 1; i < hi; i++){
+		for (int a = 0; a < 3; a++){
+			mn[a] = min(mn[a], mEntries[i].p[a]);
+			mx[a] = max(mx[a], mEntries[i].p[a]);
+		}
+	}
+
+	int axis = 0;
+	for (int a = 1; a < 3; a++){
+		if (mx[a] - mn[a] > mx[axis] - mn[axis])
+			axis = a;
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	nth_element(mEntries.begin() + lo, mEntries.begin() + mid, mEntries.begin() + hi, AxisLess(axis));
+	mAxis[mid] = axis;
+	return true;
+}
+
+void CloudIndex::_buildRange(size_t lo, size_t hi) {
+	if (!_split(lo, hi))
+		return;
+	size_t mid = lo + (hi - lo) / 2;
+	_buildRange(lo, mid);
+	_buildRange(mid + 1, hi);
+}
+
+/*
+ * Range workers for the build. Each range is its own part of the array
+ */
+
+void CloudIndex::_splitRanges(std::vector<Range> *from, std::vector<Range> *to, size_t r0, size_t r1) {
+	for (size_t r = r0; r < r1; r++){
+		size_t lo = (*from)[r].first, hi = (*from)[r].second;
+		if (_split(lo, hi)) {
+			size_t mid = lo + (hi - lo) / 2;
+			(*to)[r * 2] = Range(lo, mid);
+			(*to)[r * 2 + 1] = Range(mid + 1, hi);
+		}
+		else
+			(*to)[r * 2] = (*from)[r];
+	}
+}
+
+void CloudIndex::_buildRanges(std::vector<Range> *ranges, size_t r0, size_t r1) {
+	for (size_t r = r0; r < r1; r++)
+		_buildRange((*ranges)[r].first, (*ranges)[r].second);
+}
+
+/*
+ * Descend to the side the query is on first, then only cross the split if the plane is
+ * closer than the worst of the k found so far
+ */
+
+void CloudIndex::_knn(size_t lo, size_t hi, const float *q, size_t k, std::vector<Candidate> &heap) const {
+	if (hi - lo <= mLeaf) {
+		for (size_t i = lo; i < hi; i++)
+			offer(heap, k, distance2(q, mEntries[i].p), i);
+		return;
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	offer(heap, k, distance2(q, mEntries[mid].p), mid);
+
+	int axis = mAxis[mid];
+	float diff = q[axis] - mEntries[mid].p[axis];
+
+	if (diff < 0.0f) {
+		_knn(lo, mid, q, k, heap);
+		if (heap.size() < k || diff * diff < heap.front().first)
+			_knn(mid + 1, hi, q, k, heap);
+	}
+	else {
+		_knn(mid + 1, hi, q, k, heap);
+		if (heap.size() < k || diff * diff < heap.front().first)
+			_knn(lo, mid, q, k, heap);
+	}
+}
+
+void CloudIndex::_radius(size_t lo, size_t hi, const float *q, float r2, size_t max, std::vector<Candidate> &found) const {
+	if (found.size() >= max)
+		return;
+
+	if (hi - lo <= mLeaf) {
+		for (size_t i = lo; i < hi && found.size() < max; i++){
+			float d2 = distance2(q, mEntries[i].p);
+			if (d2 <= r2)
+				found.push_back(Candidate(d2, i));
+		}
+		return;
+	}
+
+	size_t mid = lo + (hi - lo) / 2;
+	float d2 = distance2(q, mEntries[mid].p);
+	if (d2 <= r2)
+		found.push_back(Candidate(d2, mid));
+
+	int axis = mAxis[mid];
+	float diff = q[axis] - mEntries[mid].p[axis];
+	bool cross = diff * diff <= r2;
+
+	if (diff < 0.0f) {
+		_radius(lo, mid, q, r2, max, found);
+		if (cross)
+			_radius(mid + 1, hi, q, r2, max, found);
+	}
+	else {
+		_radius(mid + 1, hi, q, r2, max, found);
+		if (cross)
+			_radius(lo, mid, q, r2, max, found);
+	}
+}
+
+/*
+ * Single queries, as PCL asks for them. These only read the tree so PCL's OpenMP stages
+ * can call them from every thread at once. Results are cloud indices
+ */
+
+int CloudIndex::nearestKSearch(const pcl::PointXYZ &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const {
+	k_indices.clear();
+	k_sqr_distances.clear();
+	if (k <= 0 || mEntries.empty())
+		return 0;
+
+	float q[3] = { point.x, point.y, point.z };
+	vector<Candidate> heap;
+	heap.reserve(k);
+	_knn(0, mEntries.size(), q, k, heap);
+	sort_heap(heap.begin(), heap.end());
+
+	k_indices.resize(heap.size());
+	k_sqr_distances.resize(heap.size());
+	for (size_t i = 0; i < heap.size(); i++){
+		k_indices[i] = mEntries[heap[i].second].index;
+		k_sqr_distances[i] = heap[i].first;
+	}
+	return heap.size();
+}
+
+int CloudIndex::radiusSearch(const pcl::PointXYZ &point, double radius, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances, unsigned int max_nn) const {
+	k_indices.clear();
+	k_sqr_distances.clear();
+	if (mEntries.empty())
+		return 0;
+
+	float q[3] = { point.x, point.y, point.z };
+	size_t max = max_nn > 0 ? max_nn : numeric_limits<size_t>::max();
+	vector<Candidate> found;
+	_radius(0, mEntries.size(), q, static_cast<float>(radius * radius), max, found);
+	if (sorted_results_)
+		sort(found.begin(), found.end());
+
+	k_indices.resize(found.size());
+	k_sqr_distances.resize(found.size());
+	for (size_t i = 0; i < found.size(); i++){
+		k_indices[i] = mEntries[found[i].second].index;
+		k_sqr_distances[i] = found[i].first;
+	}
+	return found.size();
+}
+
+/*
+ * Batched queries split across the cores. Each query writes only its own results
+ */
+
+void CloudIndex::nearestKSearch(const PointCloud &cloud, const std::vector<int> &indices, int k, std::vector< std::vector<int> > &k_indices, std::vector< std::vector<float> > &k_sqr_distances) const {
+	size_t n = indices.empty() ? cloud.points.size() : indices.size();
+	k_indices.resize(n);
+	k_sqr_distances.resize(n);
+	parallelFor(0, n, 256, boost::bind(&CloudIndex::_knnBatch, this, &cloud, &indices, k, &k_indices, &k_sqr_distances, _1, _2));
+}
+
+void CloudIndex::radiusSearch(const PointCloud &cloud, const std::vector<int> &indices, double radius, std::vector< std::vector<int> > &k_indices, std::vector< std::vector<float> > &k_sqr_distances, unsigned int max_nn) const {
+	size_t n = indices.empty() ? cloud.points.size() : indices.size();
+	k_indices.resize(n);
+	k_sqr_distances.resize(n);
+	parallelFor(0, n, 256, boost::bind(&CloudIndex::_radiusBatch, this, &cloud, &indices, radius, &k_indices, &k_sqr_distances, max_nn, _1, _2));
+}
+
+void CloudIndex::_knnBatch(const PointCloud *cloud, const std::vector<int> *indices, int k, std::vector< std::vector<int> > *k_indices, std::vector< std::vector<float> > *k_sqr_distances, size_t q0, size_t q1) const {
+	for (size_t q = q0; q < q1; q++){
+		size_t idx = indices->empty() ? q : (*indices)[q];
+		nearestKSearch(cloud->points[idx], k, (*k_indices)[q], (*k_sqr_distances)[q]);
+	}
+}
+
+void CloudIndex::_radiusBatch(const PointCloud *cloud, const std::vector<int> *indices, double radius, std::vector< std::vector<int> > *k_indices, std::vector< std::vector<float> > *k_sqr_distances, unsigned int max_nn, size_t q0, size_t q1) const {
+	for (size_t q = q0; q < q1; q++){
+		size_t idx = indices->empty() ? q : (*indices)[q];
+		radiusSearch(cloud->points[idx], radius, (*k_indices)[q], (*k_sqr_distances)[q], max_nn);
+	}
+}
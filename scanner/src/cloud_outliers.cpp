@@ -0,0 +1,410 @@
+/**
+* @brief Outlier removal over a hash grid
+* @file cloud_outliers.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 12/08/2012
+*
+*/
+
+#include "cloud_outliers.hpp"
+#include "utils.hpp"
+
+#include <math.h>
+#include <float.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+using namespace boost;
+
+const uint32_t CloudOutliers::sNone = 0xffffffff;
+const float CloudOutliers::sSpreadTail = 0.05f;
+
+// Cells a side at most, so a cell fits in 21 bits of the key
+static const float sMaxCells = 1 << 20;
+
+
+/*
+ * Filter in to out, keeping the cloud's order. Returns the number of points kept
+ */
+
+size_t CloudOutliers::filter(const pcl::PointCloud<pcl::PointXYZ> &in, pcl::PointCloud<pcl::PointXYZ> &out) {
+	posix_time::ptime start = posix_time::microsec_clock::universal_time();
+	size_t n = in.points.size();
+
+	mKept.assign(n, 0);
+	_build(in);
+	size_t m = mIndex.size();
+
+	if (mRadius > 0.0f)
+		parallelFor(0, m, 256, boost::bind(&CloudOutliers::_radiusCounts, this, _1, _2));
+	else {
+		mMeanDist.resize(m);
+		parallelFor(0, m, 256, boost::bind(&CloudOutliers::_meanDistances, this, _1, _2));
+
+		// Threshold over every point that found a neighbour, as PCL does
+		double sum = 0.0, sq_sum = 0.0;
+		size_t valid = 0;
+		for (size_t s = 0; s < m; s++){
+			if (mMeanDist[s] < 0.0f)
+				continue;
+			sum += mMeanDist[s];
+			sq_sum += mMeanDist[s] * mMeanDist[s];
+			valid++;
+		}
+
+		double mean = valid > 0 ? sum / valid : 0.0;
+		double variance = valid > 1 ? (sq_sum - sum * sum / valid) / (valid - 1) : 0.0;
+		double threshold = mean + mStddevMul * sqrt(max(variance, 0.0));
+
+		for (size_t s = 0; s < m; s++)
+			mKept[mIndex[s]] = mMeanDist[s] <= threshold;
+	}
+
+	out.points.clear();
+	out.points.reserve(m);
+	for (size_t i = 0; i < n; i++){
+		if (mKept[i])
+			out.points.push_back(in.points[i]);
+	}
+	out.width = out.points.size();
+	out.height = 1;
+	out.is_dense = true;
+
+	vector<float>().swap(mX);
+	vector<float>().swap(mY);
+	vector<float>().swap(mZ);
+	vector<uint64_t>().swap(mKey);
+	vector<uint32_t>().swap(mIndex);
+	vector<uint32_t>().swap(mStart);
+	vector<float>().swap(mMeanDist);
+
+	posix_time::time_duration took = posix_time::microsec_clock::universal_time() - start;
+	cerr << "Leeds - Outlier removal kept " << out.points.size() << " of " << n << " points in " << took.total_milliseconds() << "ms" << endl;
+
+	return out.points.size();
+}
+
+/*
+ * Size the grid, then counting sort the finite points into the table by bucket. The table
+ * has at least twice as many buckets as points so few cells share one.
+ *
+ * The cell comes from the spread of the middle of the cloud rather than its bounding box,
+ * so a few far outliers - the very points being looked for - cannot blow the cells up and
+ * pile the whole object into a handful of them. The grid covers that middle with a margin
+ * and anything further out is clamped into the border cells
+ */
+
+void CloudOutliers::_build(const pcl::PointCloud<pcl::PointXYZ> &in) {
+	size_t n = in.points.size();
+	float mn[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float mx[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	size_t finite = 0;
+
+	for (size_t i = 0; i < n; i++){
+		const pcl::PointXYZ &p = in.points[i];
+		if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z))
+			continue;
+		mn[0] = min(mn[0], p.x); mx[0] = max(mx[0], p.x);
+		mn[1] = min(mn[1], p.y); mx[1] = max(mx[1], p.y);
+		mn[2] = min(mn[2], p.z); mx[2] = max(mx[2], p.z);
+		finite++;
+	}
+
+	mIndex.clear();
+	if (finite == 0)
+		return;
+
+	// Percentiles from an even spread of at most sSpreadSamples points
+	vector<float> axis[3];
+	size_t stride = max(static_cast<size_t>(1), finite / sSpreadSamples);
+	size_t seen = 0;
+	for (size_t i = 0; i < n; i++){
+		const pcl::PointXYZ &p = in.points[i];
+		if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z))
+			continue;
+		if (seen++ % stride != 0)
+			continue;
+		axis[0].push_back(p.x);
+		axis[1].push_back(p.y);
+		axis[2].push_back(p.z);
+	}
+
+	float lo[3], hi[3], extent = 0.0f;
+	for (int a = 0; a < 3; a++){
+		vector<float> &v = axis[a];
+		size_t l = static_cast<size_t>(sSpreadTail * (v.size() - 1));
+		size_t h = v.size() - 1 - l;
+		nth_element(v.begin(), v.begin() + l, v.end());
+		lo[a] = v[l];
+		nth_element(v.begin(), v.begin() + h, v.end());
+		hi[a] = v[h];
+		extent = max(extent, hi[a] - lo[a]);
+	}
+
+	// A surface across the extent with about k points in each cell it passes through
+	if (mRadius > 0.0f)
+		mCellSize = mRadius;
+	else
+		mCellSize = extent * sqrtf(static_cast<float>(mMeanK) / finite);
+
+	// The middle of the cloud and as much again each side, inside the bounding box
+	float span = 0.0f;
+	for (int a = 0; a < 3; a++){
+		lo[a] = max(mn[a], lo[a] - extent);
+		hi[a] = min(mx[a], hi[a] + extent);
+		span = max(span, hi[a] - lo[a]);
+	}
+
+	mCellSize = max(mCellSize, span / sMaxCells);
+	if (mCellSize <= 0.0f)
+		mCellSize = 1.0f;
+
+	for (int a = 0; a < 3; a++){
+		mOrigin[a] = lo[a];
+		mDims[a] = static_cast<int>((hi[a] - lo[a]) / mCellSize) + 1;
+	}
+
+	size_t buckets = 1;
+	while (buckets < finite * 2)
+		buckets <<= 1;
+	mMask = buckets - 1;
+
+	mBucketOf.resize(n);
+	mKeyOf.resize(n);
+	parallelFor(0, n, 4096, boost::bind(&CloudOutliers::_keys, this, &in, _1, _2));
+
+	mStart.assign(buckets + 1, 0);
+	for (size_t i = 0; i < n; i++){
+		if (mBucketOf[i] != sNone)
+			mStart[mBucketOf[i] + 1]++;
+	}
+	for (size_t b = 0; b < buckets; b++)
+		mStart[b + 1] += mStart[b];
+
+	mX.resize(finite);
+	mY.resize(finite);
+	mZ.resize(finite);
+	mKey.resize(finite);
+	mIndex.resize(finite);
+
+	vector<uint32_t> cursor(mStart.begin(), mStart.end() - 1);
+	for (size_t i = 0; i < n; i++){
+		if (mBucketOf[i] == sNone)
+			continue;
+		uint32_t s = cursor[mBucketOf[i]]++;
+		mX[s] = in.points[i].x;
+		mY[s] = in.points[i].y;
+		mZ[s] = in.points[i].z;
+		mKey[s] = mKeyOf[i];
+		mIndex[s] = i;
+	}
+
+	vector<uint32_t>().swap(mBucketOf);
+	vector<uint64_t>().swap(mKeyOf);
+}
+
+void CloudOutliers::_keys(const pcl::PointCloud<pcl::PointXYZ> *in, size_t p0, size_t p1) {
+	for (size_t i = p0; i < p1; i++){
+		const pcl::PointXYZ &p = in->points[i];
+		if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z)) {
+			mBucketOf[i] = sNone;
+			continue;
+		}
+
+		float q[3] = { p.x, p.y, p.z };
+		int c[3];
+		_cell(q, c);
+		mBucketOf[i] = _bucket(c[0], c[1], c[2]);
+		mKeyOf[i] = _cellKey(c[0], c[1], c[2]);
+	}
+}
+
+/*
+ * Grid helpers. Cells that share a bucket are told apart by their key
+ */
+
+uint64_t CloudOutliers::_cellKey(int x, int y, int z) const {
+	return (uint64_t(x) << 42) | (uint64_t(y) << 21) | uint64_t(z);
+}
+
+uint32_t CloudOutliers::_bucket(int x, int y, int z) const {
+	return ((uint32_t(x) * 73856093u) ^ (uint32_t(y) * 19349663u) ^ (uint32_t(z) * 83492791u)) & mMask;
+}
+
+void CloudOutliers::_cell(const float *q, int *c) const {
+	for (int a = 0; a < 3; a++){
+		// Clamped before the cast, as a far outlier may not fit in an int
+		float f = (q[a] - mOrigin[a]) / mCellSize;
+		f = min(max(f, 0.0f), static_cast<float>(mDims[a] - 1));
+		c[a] = static_cast<int>(f);
+	}
+}
+
+/*
+ * Squared distances over a run of the table, four at a time with SSE and any left over
+ * one by one. The table is split into x, y and z runs so the loads need no shuffling
+ */
+
+void CloudOutliers::_distances(size_t s, size_t e, const float *q, float *d) const {
+	const float *x = &mX[s];
+	const float *y = &mY[s];
+	const float *z = &mZ[s];
+	float qx = q[0], qy = q[1], qz = q[2];
+	size_t n = e - s, j = 0;
+
+#ifdef __SSE__
+	__m128 qx4 = _mm_set1_ps(qx), qy4 = _mm_set1_ps(qy), qz4 = _mm_set1_ps(qz);
+	for (; j + 4 <= n; j += 4){
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + j), qx4);
+		__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + j), qy4);
+		__m128 dz = _mm_sub_ps(_mm_loadu_ps(z + j), qz4);
+		_mm_storeu_ps(d + j, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+	}
+#endif
+
+	for (; j < n; j++){
+		float dx = x[j] - qx, dy = y[j] - qy, dz = z[j] - qz;
+		d[j] = dx * dx + dy * dy + dz * dz;
+	}
+}
+
+void CloudOutliers::_gatherCell(int x, int y, int z, const float *q, std::vector<float> &found) const {
+	if (x < 0 || y < 0 || z < 0 || x >= mDims[0] || y >= mDims[1] || z >= mDims[2])
+		return;
+
+	uint64_t key = _cellKey(x, y, z);
+	uint32_t b = _bucket(x, y, z);
+	float d[sBlock];
+
+	for (size_t s = mStart[b]; s < mStart[b + 1]; s += sBlock){
+		size_t e = min(s + sBlock, static_cast<size_t>(mStart[b + 1]));
+		_distances(s, e, q, d);
+		for (size_t j = 0; j < e - s; j++){
+			if (mKey[s + j] == key)
+				found.push_back(d[j]);
+		}
+	}
+}
+
+size_t CloudOutliers::_countCell(int x, int y, int z, const float *q, float r2, size_t enough) const {
+	if (x < 0 || y < 0 || z < 0 || x >= mDims[0] || y >= mDims[1] || z >= mDims[2])
+		return 0;
+
+	uint64_t key = _cellKey(x, y, z);
+	uint32_t b = _bucket(x, y, z);
+	float d[sBlock];
+	size_t count = 0;
+
+	for (size_t s = mStart[b]; s < mStart[b + 1]; s += sBlock){
+		size_t e = min(s + sBlock, static_cast<size_t>(mStart[b + 1]));
+		_distances(s, e, q, d);
+		for (size_t j = 0; j < e - s; j++){
+			if (mKey[s + j] == key && d[j] <= r2 && ++count >= enough)
+				return count;
+		}
+	}
+	return count;
+}
+
+/*
+ * Mean distance to the k nearest, leaving out the nearest which is the point itself. Shells
+ * of cells are gathered until the kth found is closer than anything outside them can be.
+ * Only the k closest so far are kept between shells.
+ *
+ * Shells are clipped to the grid. A side of the shell that has reached the edge of the grid
+ * has nothing beyond it, clamped points included, so only the other sides bound the search
+ */
+
+void CloudOutliers::_meanDistances(size_t s0, size_t s1) {
+	size_t k = mMeanK + 1;
+	vector<float> found;
+
+	for (size_t s = s0; s < s1; s++){
+		float q[3] = { mX[s], mY[s], mZ[s] };
+		int c[3];
+		_cell(q, c);
+		found.clear();
+
+		for (int r = 0; ; r++){
+			int x0 = max(c[0] - r, 0), x1 = min(c[0] + r, mDims[0] - 1);
+			int y0 = max(c[1] - r, 0), y1 = min(c[1] + r, mDims[1] - 1);
+			int z0 = max(c[2] - r, 0), z1 = min(c[2] + r, mDims[2] - 1);
+
+			for (int x = x0; x <= x1; x++){
+				for (int y = y0; y <= y1; y++){
+					if (abs(x - c[0]) == r || abs(y - c[1]) == r) {
+						for (int z = z0; z <= z1; z++)
+							_gatherCell(x, y, z, q, found);
+						continue;
+					}
+
+					// Inside the shell only the two end cells along z are new
+					if (c[2] - r >= 0)
+						_gatherCell(x, y, c[2] - r, q, found);
+					if (c[2] + r < mDims[2])
+						_gatherCell(x, y, c[2] + r, q, found);
+				}
+			}
+
+			if (found.size() > k) {
+				nth_element(found.begin(), found.begin() + (k - 1), found.end());
+				found.resize(k);
+			}
+
+			float cover = FLT_MAX;
+			for (int a = 0; a < 3; a++){
+				if (c[a] - r > 0)
+					cover = min(cover, q[a] - (mOrigin[a] + (c[a] - r) * mCellSize));
+				if (c[a] + r < mDims[a] - 1)
+					cover = min(cover, mOrigin[a] + (c[a] + r + 1) * mCellSize - q[a]);
+			}
+
+			if (cover == FLT_MAX || (found.size() == k && *max_element(found.begin(), found.end()) <= cover * cover))
+				break;
+		}
+
+		if (found.size() <= 1) {
+			mMeanDist[s] = -1.0f;
+			continue;
+		}
+
+		float sum = 0.0f, nearest = FLT_MAX;
+		for (size_t j = 0; j < found.size(); j++){
+			sum += sqrtf(found[j]);
+			nearest = min(nearest, found[j]);
+		}
+		mMeanDist[s] = (sum - sqrtf(nearest)) / (found.size() - 1);
+	}
+}
+
+/*
+ * With the cell as big as the radius only the cells next door can hold a neighbour. Counting
+ * stops as soon as there are enough, the point itself included
+ */
+
+void CloudOutliers::_radiusCounts(size_t s0, size_t s1) {
+	float r2 = mRadius * mRadius;
+	size_t enough = mMinCount + 1;
+
+	for (size_t s = s0; s < s1; s++){
+		float q[3] = { mX[s], mY[s], mZ[s] };
+		int c[3];
+		_cell(q, c);
+
+		size_t count = 0;
+		for (int dx = -1; dx <= 1 && count < enough; dx++){
+			for (int dy = -1; dy <= 1 && count < enough; dy++){
+				for (int dz = -1; dz <= 1 && count < enough; dz++)
+					count += _countCell(c[0] + dx, c[1] + dy, c[2] + dz, q, r2, enough - count);
+			}
+		}
+
+		mKept[mIndex[s]] = count >= enough;
+	}
+}
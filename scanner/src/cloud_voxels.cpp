@@ -0,0 +1,198 @@
+/**
+* @brief Voxel grid reduction of the point cloud before meshing
+* @file cloud_voxels.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 11/08/2012
+*
+*/
+
+#include "cloud_voxels.hpp"
+#include "utils.hpp"
+
+#include <math.h>
+#include <algorithm>
+#include <boost/unordered_map.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using namespace std;
+using namespace boost;
+
+const uint64_t CloudVoxels::sEmpty = ~uint64_t(0);
+
+// 21 bits a side, centred on the origin
+static const int64_t sBias = 1 << 20;
+static const int64_t sLimit = (1 << 21) - 1;
+
+
+/*
+ * Reduce in to out. Keys, then the points grouped by partition, then each partition summed
+ * and written out. Returns the number of points kept
+ */
+
+size_t CloudVoxels::filter(const pcl::PointCloud<pcl::PointXYZ> &in, pcl::PointCloud<pcl::PointXYZ> &out) {
+	posix_time::ptime start = posix_time::microsec_clock::universal_time();
+	size_t n = in.points.size();
+
+	if (mSize <= 0.0f) {
+		out = in;
+		mCounts.assign(n, 1);
+		return n;
+	}
+
+	mKeys.resize(n);
+	parallelFor(0, n, 4096, boost::bind(&CloudVoxels::_makeKeys, this, &in, _1, _2));
+
+	size_t workers = ThreadPool::get().size();
+	mChunks = n < workers * 4096 ? 1 : workers;
+	mParts = workers * 4;
+
+	mChunkBounds.resize(mChunks + 1);
+	for (size_t c = 0; c <= mChunks; c++)
+		mChunkBounds[c] = n * c / mChunks;
+
+	mOffsets.assign(mChunks * mParts, 0);
+	parallelFor(0, mChunks, 1, boost::bind(&CloudVoxels::_countParts, this, _1, _2));
+
+	// Counts to offsets - each partition is its chunks one after the other, so within a
+	// partition the points keep the cloud's order
+	mPartBounds.resize(mParts + 1);
+	size_t total = 0;
+	for (size_t p = 0; p < mParts; p++){
+		mPartBounds[p] = total;
+		for (size_t c = 0; c < mChunks; c++){
+			size_t count = mOffsets[c * mParts + p];
+			mOffsets[c * mParts + p] = total;
+			total += count;
+		}
+	}
+	mPartBounds[mParts] = total;
+
+	mOrder.resize(total);
+	parallelFor(0, mChunks, 1, boost::bind(&CloudVoxels::_scatter, this, _1, _2));
+
+	mVoxels.assign(mParts, vector<Voxel>());
+	parallelFor(0, mParts, 1, boost::bind(&CloudVoxels::_accumulate, this, &in, _1, _2));
+
+	mVoxelBounds.resize(mParts + 1);
+	size_t kept = 0;
+	for (size_t p = 0; p < mParts; p++){
+		mVoxelBounds[p] = kept;
+		kept += mVoxels[p].size();
+	}
+	mVoxelBounds[mParts] = kept;
+
+	out.points.resize(kept);
+	mCounts.resize(kept);
+	parallelFor(0, mParts, 1, boost::bind(&CloudVoxels::_emit, this, &out, _1, _2));
+
+	out.width = kept;
+	out.height = 1;
+	out.is_dense = true;
+
+	vector<uint64_t>().swap(mKeys);
+	vector<uint32_t>().swap(mOrder);
+	vector< vector<Voxel> >().swap(mVoxels);
+
+	posix_time::time_duration took = posix_time::microsec_clock::universal_time() - start;
+	cerr << "Leeds - Voxel grid reduced " << n << " points to " << kept << " in " << took.total_milliseconds() << "ms" << endl;
+
+	return kept;
+}
+
+/*
+ * Mix the key before taking the partition so neighbouring voxels spread out evenly
+ */
+
+size_t CloudVoxels::_part(uint64_t key) const {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key % mParts;
+}
+
+/*
+ * Range workers. Points that are not finite get the empty key and are left out
+ */
+
+void CloudVoxels::_makeKeys(const pcl::PointCloud<pcl::PointXYZ> *in, size_t p0, size_t p1) {
+	float inv = 1.0f / mSize;
+	for (size_t i = p0; i < p1; i++){
+		const pcl::PointXYZ &p = in->points[i];
+		if (!pcl_isfinite(p.x) || !pcl_isfinite(p.y) || !pcl_isfinite(p.z)) {
+			mKeys[i] = sEmpty;
+			continue;
+		}
+
+		int64_t x = static_cast<int64_t>(floorf(p.x * inv)) + sBias;
+		int64_t y = static_cast<int64_t>(floorf(p.y * inv)) + sBias;
+		int64_t z = static_cast<int64_t>(floorf(p.z * inv)) + sBias;
+		x = min(max(x, int64_t(0)), sLimit);
+		y = min(max(y, int64_t(0)), sLimit);
+		z = min(max(z, int64_t(0)), sLimit);
+
+		mKeys[i] = (uint64_t(x) << 42) | (uint64_t(y) << 21) | uint64_t(z);
+	}
+}
+
+void CloudVoxels::_countParts(size_t c0, size_t c1) {
+	for (size_t c = c0; c < c1; c++){
+		size_t *counts = &mOffsets[c * mParts];
+		for (size_t i = mChunkBounds[c]; i < mChunkBounds[c + 1]; i++){
+			if (mKeys[i] != sEmpty)
+				counts[_part(mKeys[i])]++;
+		}
+	}
+}
+
+void CloudVoxels::_scatter(size_t c0, size_t c1) {
+	for (size_t c = c0; c < c1; c++){
+		size_t *cursor = &mOffsets[c * mParts];
+		for (size_t i = mChunkBounds[c]; i < mChunkBounds[c + 1]; i++){
+			if (mKeys[i] != sEmpty)
+				mOrder[cursor[_part(mKeys[i])]++] = i;
+		}
+	}
+}
+
+/*
+ * Every point of a voxel lands in the same partition, so each one is summed here alone.
+ * Sums are in doubles as a dense voxel can take thousands of points
+ */
+
+void CloudVoxels::_accumulate(const pcl::PointCloud<pcl::PointXYZ> *in, size_t r0, size_t r1) {
+	for (size_t r = r0; r < r1; r++){
+		vector<Voxel> &voxels = mVoxels[r];
+		boost::unordered_map<uint64_t, uint32_t> slots;
+		slots.rehash(mPartBounds[r + 1] - mPartBounds[r]);
+
+		for (size_t o = mPartBounds[r]; o < mPartBounds[r + 1]; o++){
+			uint32_t i = mOrder[o];
+			pair<boost::unordered_map<uint64_t, uint32_t>::iterator, bool> slot = slots.insert(make_pair(mKeys[i], static_cast<uint32_t>(voxels.size())));
+			if (slot.second) {
+				Voxel v = { 0.0, 0.0, 0.0, 0 };
+				voxels.push_back(v);
+			}
+
+			Voxel &v = voxels[slot.first->second];
+			const pcl::PointXYZ &p = in->points[i];
+			v.x += p.x;
+			v.y += p.y;
+			v.z += p.z;
+			v.count++;
+		}
+	}
+}
+
+void CloudVoxels::_emit(pcl::PointCloud<pcl::PointXYZ> *out, size_t r0, size_t r1) {
+	for (size_t r = r0; r < r1; r++){
+		const vector<Voxel> &voxels = mVoxels[r];
+		for (size_t v = 0; v < voxels.size(); v++){
+			size_t o = mVoxelBounds[r] + v;
+			double s = 1.0 / voxels[v].count;
+			out->points[o].x = voxels[v].x * s;
+			out->points[o].y = voxels[v].y * s;
+			out->points[o].z = voxels[v].z * s;
+			mCounts[o] = voxels[v].count;
+		}
+	}
+}
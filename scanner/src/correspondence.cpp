@@ -0,0 +1,155 @@
+/**
+* @brief Multiple dot detection and epipolar correspondence between views
+* @file correspondence.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 20/07/2012
+*
+*/
+
+#include "correspondence.hpp"
+
+#include <cfloat>
+
+using namespace std;
+using namespace cv;
+
+
+/*
+ * Find every bright blob, its centroid and which of the three colours it was projected in
+ * The brightest channel is used so coloured dots are not lost in the grey conversion
+ */
+
+void detectDots(cv::Mat &rgb, uint8_t threshold, std::vector<Dot> &dots) {
+	vector<Mat> channels;
+	split(rgb, channels);
+	
+	Mat peak = max(max(channels[0], channels[1]), channels[2]);
+	Mat mask;
+	cv::threshold(peak, mask, threshold, 255, THRESH_BINARY);
+	
+	vector<vector<Point> > contours;
+	findContours(mask.clone(), contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+	
+	dots.clear();
+	
+	for (size_t i = 0; i < contours.size(); i++){
+		Rect r = boundingRect(contours[i]);
+		
+		// Brightness weighted centroid over the blob
+		Moments m = moments(peak(r).mul(mask(r) / 255), false);
+		if (m.m00 <= 0)
+			continue;
+		
+		Scalar c = mean(rgb(r), mask(r));
+		int code = 0;
+		if (c[1] > c[code]) code = 1;
+		if (c[2] > c[code]) code = 2;
+		
+		Dot d;
+		d.p = Point2f(r.x + m.m10 / m.m00, r.y + m.m01 / m.m00);
+		d.code = code;
+		dots.push_back(d);
+	}
+}
+
+/*
+ * Add a view. Points are undistorted up front so each pair only costs a dot product
+ */
+
+void DotMatcher::addView(std::vector<Dot> &dots, CameraParameters &params) {
+	mViews.push_back(View());
+	View &v = mViews.back();
+	v.dots = dots;
+	v.params = params;
+	Rodrigues(params.R, v.R);
+	
+	if (dots.empty())
+		return;
+	
+	vector<Point2f> pixels;
+	for (size_t i = 0; i < dots.size(); i++)
+		pixels.push_back(dots[i].p);
+	
+	undistortPoints(pixels, v.normalised, params.M, params.D);
+}
+
+/*
+ * Essential matrix taking normalised points in a to epipolar lines in b. E = [t]x R
+ */
+
+cv::Matx33d DotMatcher::essential(View &a, View &b) {
+	Mat R = b.R * a.R.t();
+	Mat t = b.params.T - R * a.params.T;
+	
+	Matx33d tx( 0, -t.at<double>(2), t.at<double>(1),
+				t.at<double>(2), 0, -t.at<double>(0),
+				-t.at<double>(1), t.at<double>(0), 0);
+	
+	return tx * Matx33d(R);
+}
+
+/*
+ * For each reference dot pick the same coloured dot nearest its epipolar line in every other view
+ * Ambiguous or distant matches are dropped; anything seen in two views or more is a group
+ */
+
+void DotMatcher::match(std::vector< std::vector< std::pair<cv::Point2f, CameraParameters> > > &groups) {
+	groups.clear();
+	if (mViews.size() < 2)
+		return;
+	
+	View &ref = mViews[0];
+	
+	vector<Matx33d> E;
+	vector< vector<bool> > used;
+	for (size_t v = 0; v < mViews.size(); v++){
+		E.push_back(essential(ref, mViews[v]));
+		used.push_back(vector<bool>(mViews[v].dots.size(), false));
+	}
+	
+	for (size_t i = 0; i < ref.dots.size(); i++){
+		vector< pair<Point2f, CameraParameters> > group;
+		group.push_back( pair<Point2f, CameraParameters>(ref.dots[i].p, ref.params) );
+		
+		Vec3d x (ref.normalised[i].x, ref.normalised[i].y, 1.0);
+		
+		for (size_t v = 1; v < mViews.size(); v++){
+			View &view = mViews[v];
+			Vec3d l = E[v] * x;
+			double n = sqrt(l[0] * l[0] + l[1] * l[1]);
+			if (n <= 0)
+				continue;
+			
+			// Normalised distances back to pixels with the focal length
+			double scale = view.params.M.at<double>(0,0) / n;
+			
+			double best = DBL_MAX, second = DBL_MAX;
+			int bi = -1;
+			
+			for (size_t j = 0; j < view.dots.size(); j++){
+				if (view.dots[j].code != ref.dots[i].code)
+					continue;
+				
+				double d = fabs(l[0] * view.normalised[j].x + l[1] * view.normalised[j].y + l[2]) * scale;
+				if (d < best){
+					second = best;
+					best = d;
+					bi = j;
+				}
+				else if (d < second)
+					second = d;
+			}
+			
+			if (bi < 0 || best > mTolerance || used[v][bi])
+				continue;
+			if (second < DBL_MAX && best > mRatio * second)
+				continue;
+			
+			used[v][bi] = true;
+			group.push_back( pair<Point2f, CameraParameters>(view.dots[bi].p, view.params) );
+		}
+		
+		if (group.size() > 1)
+			groups.push_back(group);
+	}
+}
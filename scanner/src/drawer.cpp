@@ -28,6 +28,7 @@ using namespace boost::assign;
 	mObj->mShaderNormals.load("./data/meshnormal.vert", "./data/meshnormal.frag");
 	mObj->mShaderGripper.load("./data/gripper.vert", "./data/gripper.frag");
 	mObj->mShaderPicker.load("./data/picker.vert", "./data/picker.frag");
+	mObj->mShaderProjective.load("./data/projective.vert", "./data/projective.frag");
 	
 	mObj->mFBOPick.setup(640,480);
 	mObj->mFBOTool.setup(640,480);
@@ -396,11 +397,71 @@ void Drawer::moveCamera(int dx, int dy, double dt){
 
 }
 
+const size_t Drawer::sMaxProjected;
+
+/*
+ * Hand each camera's projection to the shader so texcoords are made per vertex on the GPU.
+ * The vertices only carry blend weights, so recalibrating needs no new VBO. Gains are three
+ * per camera and any that are missing count as one
+ */
+
+void Drawer::setProjection(Shader &shader, std::vector<boost::shared_ptr<LeedsCam> > &cams, std::vector<GLfloat> &gains) {
+	GLfloat R[sMaxProjected * 9], T[sMaxProjected * 3], K[sMaxProjected * 4], D[sMaxProjected * 4], K3[sMaxProjected];
+	GLfloat G[sMaxProjected * 3];
+	GLint samplers[sMaxProjected];
+	size_t n = std::min(cams.size(), sMaxProjected);
+	
+	for (size_t i = 0; i < n; i++){
+		CameraParameters &p = cams[i]->getParams();
+		
+		cv::Mat r = cv::Mat::eye(3, 3, CV_64F), t = cv::Mat::zeros(3, 1, CV_64F), d = cv::Mat::zeros(5, 1, CV_64F);
+		if (!p.R.empty()) cv::Rodrigues(p.R, r);
+		if (!p.T.empty()) p.T.convertTo(t, CV_64F);
+		if (!p.D.empty()) p.D.reshape(1, p.D.total()).convertTo(d, CV_64F);
+		cv::Mat m;
+		p.M.convertTo(m, CV_64F);
+		
+		for (int j = 0; j < 9; j++)
+			R[i * 9 + j] = r.at<double>(j / 3, j % 3);
+		for (int j = 0; j < 3; j++)
+			T[i * 3 + j] = t.at<double>(j);
+		
+		K[i * 4] = m.at<double>(0,0);
+		K[i * 4 + 1] = m.at<double>(1,1);
+		K[i * 4 + 2] = m.at<double>(0,2);
+		K[i * 4 + 3] = m.at<double>(1,2);
+		
+		for (int j = 0; j < 4; j++)
+			D[i * 4 + j] = j < d.rows ? d.at<double>(j) : 0.0;
+		K3[i] = d.rows > 4 ? d.at<double>(4) : 0.0;
+		
+		for (int j = 0; j < 3; j++)
+			G[i * 3 + j] = i * 3 + j < gains.size() ? gains[i * 3 + j] : 1.0f;
+		
+		samplers[i] = i;
+	}
+	
+	if (n == 0)
+		return;
+	
+	GLuint program = shader.getProgram();
+	
+	// Row major rotations, so ask GL to transpose
+	glUniformMatrix3fv(glGetUniformLocation(program, "uCamR"), n, GL_TRUE, R);
+	glUniform3fv(glGetUniformLocation(program, "uCamT"), n, T);
+	glUniform4fv(glGetUniformLocation(program, "uCamK"), n, K);
+	glUniform4fv(glGetUniformLocation(program, "uCamD"), n, D);
+	glUniform1fv(glGetUniformLocation(program, "uCamK3"), n, K3);
+	glUniform1iv(glGetUniformLocation(program, "uCamTex"), n, samplers);
+	glUniform3fv(glGetUniformLocation(program, "uCamGain"), n, G);
+	glUniform1i(glGetUniformLocation(program, "uCamCount"), n);
+}
+
 /*
  * Draw Mesh Filled in
  */
  
- void Drawer::drawMesh(VBOData &mesh, std::vector<boost::shared_ptr<LeedsCam> > &cams) {
+ void Drawer::drawMesh(VBOData &mesh, std::vector<boost::shared_ptr<LeedsCam> > &cams, std::vector<GLfloat> &gains) {
 	glm::mat4 MVP = mObj->mCam.getProjMatrix() * mObj->mCam.getViewMatrix()  * mObj->mModelMatrix;
 	glm::mat4 MV = mObj->mCam.getViewMatrix() * mObj->mModelMatrix;
 	glm::mat4 MN = glm::inverseTranspose(mObj->mCam.getViewMatrix());
@@ -422,32 +483,31 @@ void Drawer::moveCamera(int dx, int dy, double dt){
 	mesh.bind();
 	
 
-	mObj->mShaderLighting.begin();
+	mObj->mShaderProjective.begin();
 		
-	GLint location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mMVPMatrix");
+	GLint location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "mMVPMatrix");
 	glUniformMatrix4fv(	location, 1, GL_FALSE, glm::value_ptr(MVP)); 
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mMVMatrix");
+	location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "mMVMatrix");
 	glUniformMatrix4fv(	location, 1, GL_FALSE, glm::value_ptr(MV)); 
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mNormalMatrix");
+	location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "mNormalMatrix");
 	glUniformMatrix4fv(	location, 1, GL_FALSE, glm::value_ptr(MN)); 
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mBaseTex");
-	glUniform1i( location, 0); 
+	setProjection(mObj->mShaderProjective, cams, gains);
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "uShininess");
+	location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "uShininess");
 	glUniform1f( location, 20.0f); 
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mLight0");
+	location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "mLight0");
 	glUniform3f( location, 1.0f,1.0f,1.0f); 
 	
-	// We ARE NOT USING DRAW ELEMENTS as we need to do per face operations so we duplicate vertices
+	// Vertices are shared per camera, so the mesh is indexed
 
-	glDrawArrays(GL_TRIANGLES, 0, mesh.mNumElements);
+	glDrawElements(GL_TRIANGLES, mesh.mNumIndices, GL_UNSIGNED_INT, 0);
 	
 	
-	mObj->mShaderLighting.end();
+	mObj->mShaderProjective.end();
 	mesh.unbind();
 	checkError(__LINE__);
 	glDisable(GL_DEPTH_TEST);
@@ -600,7 +660,7 @@ void Drawer::drawReferenceQuad(){
  * Draw Tool View
  */
  
-void Drawer::drawToolView(VBOData &mesh,std::vector<boost::shared_ptr<LeedsCam> > &cams) {
+void Drawer::drawToolView(VBOData &mesh,std::vector<boost::shared_ptr<LeedsCam> > &cams, std::vector<GLfloat> &gains) {
 	
 
 	glm::vec3 t0 = mObj->mGripper.getPos();
@@ -642,31 +702,30 @@ void Drawer::drawToolView(VBOData &mesh,std::vector<boost::shared_ptr<LeedsCam>
 	mesh.bind();
 	
 
-	mObj->mShaderLighting.begin();
+	mObj->mShaderProjective.begin();
 		
-	GLint location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mMVPMatrix");
+	GLint location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "mMVPMatrix");
 	glUniformMatrix4fv(	location, 1, GL_FALSE, glm::value_ptr(MVP)); 
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mMVMatrix");
+	location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "mMVMatrix");
 	glUniformMatrix4fv(	location, 1, GL_FALSE, glm::value_ptr(MV)); 
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mNormalMatrix");
+	location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "mNormalMatrix");
 	glUniformMatrix4fv(	location, 1, GL_FALSE, glm::value_ptr(MN)); 
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mBaseTex");
-	glUniform1i( location, 0); 
+	setProjection(mObj->mShaderProjective, cams, gains);
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "uShininess");
+	location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "uShininess");
 	glUniform1f( location, 20.0f); 
 	
-	location = glGetUniformLocation(mObj->mShaderLighting.getProgram(), "mLight0");
+	location = glGetUniformLocation(mObj->mShaderProjective.getProgram(), "mLight0");
 	glUniform3f( location, 1.0f,1.0f,1.0f); 
 	
-	// We ARE NOT USING DRAW ELEMENTS as we need to do per face operations so we duplicate vertices
+	// Vertices are shared per camera, so the mesh is indexed
 
-	glDrawArrays(GL_TRIANGLES, 0, mesh.mNumElements);
+	glDrawElements(GL_TRIANGLES, mesh.mNumIndices, GL_UNSIGNED_INT, 0);
 	checkError(__LINE__);
-	mObj->mShaderLighting.end();
+	mObj->mShaderProjective.end();
 	mesh.unbind();
 	checkError(__LINE__);
 	glDisable(GL_DEPTH_TEST);
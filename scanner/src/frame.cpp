@@ -0,0 +1,147 @@
+/**
+* @brief A single camera frame with a lazily built grey pyramid
+* @file frame.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 01/08/2012
+*
+*/
+
+#include "frame.hpp"
+
+using namespace std;
+using namespace cv;
+
+
+/*
+ * Find a free buffer of the right shape that nobody else is still looking at
+ */
+
+cv::Mat FramePool::acquire(cv::Size size, int type) {
+	boost::lock_guard<boost::mutex> lock(mMutex);
+	
+	for (size_t i = 0; i < mFree.size(); i++){
+		Mat &m = mFree[i];
+		if (m.size() == size && m.type() == type && m.refcount && *m.refcount == 1) {
+			Mat r = m;
+			mFree.erase(mFree.begin() + i);
+			return r;
+		}
+	}
+	return Mat(size, type);
+}
+
+void FramePool::release(cv::Mat &m) {
+	if (m.empty())
+		return;
+	
+	boost::lock_guard<boost::mutex> lock(mMutex);
+	if (mFree.size() < mLimit)
+		mFree.push_back(m);
+	m.release();
+}
+
+/*
+ * The camera fills these straight after construction
+ */
+
+LeedsFrame::LeedsFrame(SharedPool pool, cv::Size size, bool rectified) : pPool(pool), mMeasured(false) {
+	mTime = boost::posix_time::microsec_clock::universal_time();
+	mRGB = pPool->acquire(size, CV_8UC3);
+	if (rectified)
+		mRectified = pPool->acquire(size, CV_8UC3);
+}
+
+LeedsFrame::~LeedsFrame() {
+	pPool->release(mRGB);
+	pPool->release(mRectified);
+	for (size_t s = 0; s < 2; s++){
+		for (size_t l = 0; l < sLevels; l++)
+			pPool->release(mGrey[s][l]);
+	}
+}
+
+/*
+ * Grey level of the raw or rectified image. Level 0 is full size, each level halves it
+ */
+
+cv::Mat& LeedsFrame::getGrey(size_t level, bool rectified) {
+	if (level >= sLevels)
+		level = sLevels - 1;
+	
+	size_t source = (rectified && isRectified()) ? 1 : 0;
+	
+	boost::lock_guard<boost::mutex> lock(mMutex);
+	return _getGrey(level, source);
+}
+
+cv::Mat& LeedsFrame::_getGrey(size_t level, size_t source) {
+	Mat &g = mGrey[source][level];
+	if (!g.empty())
+		return g;
+	
+	if (level == 0) {
+		Mat &rgb = source ? mRectified : mRGB;
+		g = pPool->acquire(rgb.size(), CV_8UC1);
+		cvtColor(rgb, g, CV_RGB2GRAY);
+	}
+	else {
+		Mat &up = _getGrey(level - 1, source);
+		g = pPool->acquire(Size((up.cols + 1) / 2, (up.rows + 1) / 2), CV_8UC1);
+		pyrDown(up, g, g.size());
+	}
+	return g;
+}
+
+/*
+ * Measure the raw grey image once. Sharpness, clipping and the moments all come out of 
+ * the same walk over the rows. Each row sums into 32 bits with no branches, which the
+ * release flags let the compiler vectorise, and the totals into 64
+ */
+
+const FrameQuality& LeedsFrame::getQuality() {
+	boost::lock_guard<boost::mutex> lock(mMutex);
+	if (mMeasured)
+		return mQuality;
+	
+	Mat &g = _getGrey(0, 0);
+	const int clip = 250;
+	
+	uint64_t sum = 0, sumsq = 0, grad = 0, clipped = 0;
+	
+	for (int y = 0; y < g.rows - 1; y++){
+		const uint8_t *r0 = g.ptr<uint8_t>(y);
+		const uint8_t *r1 = g.ptr<uint8_t>(y + 1);
+		uint32_t s = 0, ss = 0, gg = 0, c = 0;
+		
+		for (int x = 0; x < g.cols - 1; x++){
+			int v = r0[x];
+			int dx = r0[x + 1] - v;
+			int dy = r1[x] - v;
+			s += v;
+			ss += v * v;
+			gg += dx * dx + dy * dy;
+			c += v >= clip;
+		}
+		sum += s; sumsq += ss; grad += gg; clipped += c;
+	}
+	
+	double n = static_cast<double>(g.rows - 1) * static_cast<double>(g.cols - 1);
+	if (n < 1.0) n = 1.0;
+	
+	mQuality.mean = sum / n;
+	mQuality.variance = sumsq / n - mQuality.mean * mQuality.mean;
+	mQuality.sharpness = grad / n;
+	mQuality.saturation = clipped / n;
+	mMeasured = true;
+	
+	return mQuality;
+}
+
+/*
+ * Does a frame pass the limits?
+ */
+
+bool acceptable(const FrameQuality &q, const QualityLimits &l) {
+	return q.sharpness >= l.minSharpness && q.saturation <= l.maxSaturation &&
+		q.mean >= l.minMean && q.mean <= l.maxMean;
+}
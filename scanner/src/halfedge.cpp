@@ -0,0 +1,324 @@
+/**
+* @brief Index based half edge mesh
+* @file halfedge.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 03/08/2012
+*
+*/
+
+#include "halfedge.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+
+/*
+ * Release everything - swapping with empties gives the memory back rather than just the size
+ */
+
+void HalfEdgeMesh::clear() {
+	vector<GLfloat>().swap(mX);
+	vector<GLfloat>().swap(mY);
+	vector<GLfloat>().swap(mZ);
+	vector<GLfloat>().swap(mVNX);
+	vector<GLfloat>().swap(mVNY);
+	vector<GLfloat>().swap(mVNZ);
+	vector<GLfloat>().swap(mNX);
+	vector<GLfloat>().swap(mNY);
+	vector<GLfloat>().swap(mNZ);
+	vector<GLfloat>().swap(mArea);
+	vector<GLuint>().swap(mTex);
+	vector<uint32_t>().swap(mOrigin);
+	vector<uint32_t>().swap(mTwin);
+	vector<uint32_t>().swap(mVertexEdge);
+	vector<EdgeKey>().swap(mKeys);
+}
+
+/*
+ * Build from packed xyz positions and triangle indices. Faces that repeat a directed edge
+ * (badly wound), repeat a vertex or point past the vertices are dropped. Returns the face count
+ */
+
+size_t HalfEdgeMesh::build(const std::vector<GLfloat> &positions, const std::vector<uint32_t> &triangles) {
+	clear();
+
+	size_t nv = positions.size() / 3;
+	mX.resize(nv);
+	mY.resize(nv);
+	mZ.resize(nv);
+	parallelFor(0, nv, 4096, boost::bind(&HalfEdgeMesh::_splitPositions, this, &positions, _1, _2));
+
+	mOrigin.assign(triangles.begin(), triangles.begin() + triangles.size() / 3 * 3);
+
+	vector<uint8_t> bad(numFaces(), 0);
+	for (size_t f = 0; f < numFaces(); f++){
+		uint32_t a = mOrigin[f * 3], b = mOrigin[f * 3 + 1], c = mOrigin[f * 3 + 2];
+		bad[f] = a >= nv || b >= nv || c >= nv || a == b || b == c || c == a;
+	}
+	_compact(bad);
+
+	// Sort the directed edges. Equal neighbours mean a repeated edge - keep the earliest face
+	// and go round again, as dropping a face can only ever remove keys
+	while (true) {
+		mKeys.resize(numHalfEdges());
+		parallelFor(0, numHalfEdges(), 4096, boost::bind(&HalfEdgeMesh::_makeKeys, this, _1, _2));
+		_sortKeys();
+
+		bad.assign(numFaces(), 0);
+		bool any = false;
+		for (size_t i = 1; i < mKeys.size(); i++){
+			if (mKeys[i].key == mKeys[i - 1].key) {
+				bad[face(mKeys[i].edge)] = 1;
+				any = true;
+			}
+		}
+		if (!any)
+			break;
+		_compact(bad);
+	}
+
+	mTwin.resize(numHalfEdges());
+	parallelFor(0, numHalfEdges(), 4096, boost::bind(&HalfEdgeMesh::_matchTwins, this, _1, _2));
+
+	mVertexEdge.assign(nv, sNone);
+	parallelFor(0, mKeys.size(), 4096, boost::bind(&HalfEdgeMesh::_vertexEdges, this, _1, _2));
+
+	vector<EdgeKey>().swap(mKeys);
+
+	mNX.assign(numFaces(), 0.0f);
+	mNY.assign(numFaces(), 0.0f);
+	mNZ.assign(numFaces(), 0.0f);
+	mArea.assign(numFaces(), 0.0f);
+	mTex.assign(numFaces(), 0);
+	mVNX.assign(nv, 0.0f);
+	mVNY.assign(nv, 0.0f);
+	mVNZ.assign(nv, 0.0f);
+
+	return numFaces();
+}
+
+/*
+ * Remove flagged faces, keeping the order of the rest
+ */
+
+size_t HalfEdgeMesh::_compact(std::vector<uint8_t> &bad) {
+	size_t kept = 0;
+	for (size_t f = 0; f < bad.size(); f++){
+		if (bad[f])
+			continue;
+		if (kept != f) {
+			mOrigin[kept * 3] = mOrigin[f * 3];
+			mOrigin[kept * 3 + 1] = mOrigin[f * 3 + 1];
+			mOrigin[kept * 3 + 2] = mOrigin[f * 3 + 2];
+		}
+		kept++;
+	}
+	size_t removed = bad.size() - kept;
+	mOrigin.resize(kept * 3);
+	return removed;
+}
+
+/*
+ * Sort the keys in one chunk per core then merge the chunks pairwise
+ */
+
+void HalfEdgeMesh::_sortKeys() {
+	size_t n = mKeys.size();
+	size_t chunks = ThreadPool::get().size();
+	if (chunks < 1 || n < chunks * 4096)
+		chunks = 1;
+
+	vector<size_t> bounds(chunks + 1);
+	for (size_t i = 0; i <= chunks; i++)
+		bounds[i] = n * i / chunks;
+
+	parallelFor(0, chunks, 1, boost::bind(&HalfEdgeMesh::_sortChunks, this, &bounds, _1, _2));
+
+	for (size_t width = 1; width < chunks; width *= 2)
+		parallelFor(0, (chunks + 2 * width - 1) / (2 * width), 1, boost::bind(&HalfEdgeMesh::_mergeChunks, this, &bounds, width, _1, _2));
+}
+
+void HalfEdgeMesh::_sortChunks(std::vector<size_t> *bounds, size_t c0, size_t c1) {
+	for (size_t c = c0; c < c1; c++)
+		sort(mKeys.begin() + (*bounds)[c], mKeys.begin() + (*bounds)[c + 1]);
+}
+
+void HalfEdgeMesh::_mergeChunks(std::vector<size_t> *bounds, size_t width, size_t p0, size_t p1) {
+	size_t chunks = bounds->size() - 1;
+	for (size_t p = p0; p < p1; p++){
+		size_t lo = p * 2 * width;
+		size_t mid = min(lo + width, chunks);
+		size_t hi = min(lo + 2 * width, chunks);
+		if (mid < hi)
+			inplace_merge(mKeys.begin() + (*bounds)[lo], mKeys.begin() + (*bounds)[mid], mKeys.begin() + (*bounds)[hi]);
+	}
+}
+
+/*
+ * Range workers for the parallel passes
+ */
+
+void HalfEdgeMesh::_splitPositions(const std::vector<GLfloat> *positions, size_t v0, size_t v1) {
+	for (size_t v = v0; v < v1; v++){
+		mX[v] = (*positions)[v * 3];
+		mY[v] = (*positions)[v * 3 + 1];
+		mZ[v] = (*positions)[v * 3 + 2];
+	}
+}
+
+void HalfEdgeMesh::_makeKeys(size_t e0, size_t e1) {
+	for (size_t e = e0; e < e1; e++){
+		uint64_t k = mOrigin[e];
+		mKeys[e].key = (k << 32) | mOrigin[next(e)];
+		mKeys[e].edge = e;
+	}
+}
+
+void HalfEdgeMesh::_matchTwins(size_t e0, size_t e1) {
+	for (size_t e = e0; e < e1; e++){
+		uint64_t k = mOrigin[next(e)];
+		EdgeKey t;
+		t.key = (k << 32) | mOrigin[e];
+		t.edge = 0;
+
+		vector<EdgeKey>::const_iterator it = lower_bound(mKeys.begin(), mKeys.end(), t);
+		mTwin[e] = (it != mKeys.end() && it->key == t.key) ? it->edge : sNone;
+	}
+}
+
+/*
+ * Keys are sorted by origin, so the first key for each vertex gives its outgoing edge
+ */
+
+void HalfEdgeMesh::_vertexEdges(size_t k0, size_t k1) {
+	for (size_t k = k0; k < k1; k++){
+		uint32_t v = mKeys[k].key >> 32;
+		if (k == 0 || (mKeys[k - 1].key >> 32) != v)
+			mVertexEdge[v] = mKeys[k].edge;
+	}
+}
+
+/*
+ * Face normals then vertex normals, each split across the cores. Faces only read the
+ * positions and vertices only read the faces, so neither pass needs a lock
+ */
+
+void HalfEdgeMesh::computeNormals() {
+	parallelFor(0, numFaces(), 4096, boost::bind(&HalfEdgeMesh::_faceNormals, this, _1, _2));
+	parallelFor(0, numVertices(), 4096, boost::bind(&HalfEdgeMesh::_vertexNormals, this, _1, _2));
+}
+
+/*
+ * Four faces at a time with SSE - the corners are gathered into registers and the cross
+ * product, length and scaling done across all four - then any left over one by one. The
+ * winding gives the same facing as the old winged edge normals
+ */
+
+void HalfEdgeMesh::_faceNormals(size_t f0, size_t f1) {
+	const uint32_t *o = &mOrigin[0];
+	const GLfloat *x = &mX[0];
+	const GLfloat *y = &mY[0];
+	const GLfloat *z = &mZ[0];
+	size_t f = f0;
+	
+#ifdef __SSE__
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+	
+	for (; f + 4 <= f1; f += 4){
+		const uint32_t *t = &o[f * 3];
+		__m128 ax = _mm_setr_ps(x[t[0]], x[t[3]], x[t[6]], x[t[9]]);
+		__m128 ay = _mm_setr_ps(y[t[0]], y[t[3]], y[t[6]], y[t[9]]);
+		__m128 az = _mm_setr_ps(z[t[0]], z[t[3]], z[t[6]], z[t[9]]);
+		
+		__m128 ux = _mm_sub_ps(_mm_setr_ps(x[t[1]], x[t[4]], x[t[7]], x[t[10]]), ax);
+		__m128 uy = _mm_sub_ps(_mm_setr_ps(y[t[1]], y[t[4]], y[t[7]], y[t[10]]), ay);
+		__m128 uz = _mm_sub_ps(_mm_setr_ps(z[t[1]], z[t[4]], z[t[7]], z[t[10]]), az);
+		__m128 vx = _mm_sub_ps(_mm_setr_ps(x[t[2]], x[t[5]], x[t[8]], x[t[11]]), ax);
+		__m128 vy = _mm_sub_ps(_mm_setr_ps(y[t[2]], y[t[5]], y[t[8]], y[t[11]]), ay);
+		__m128 vz = _mm_sub_ps(_mm_setr_ps(z[t[2]], z[t[5]], z[t[8]], z[t[11]]), az);
+		
+		__m128 nx = _mm_sub_ps(_mm_mul_ps(vy, uz), _mm_mul_ps(vz, uy));
+		__m128 ny = _mm_sub_ps(_mm_mul_ps(vz, ux), _mm_mul_ps(vx, uz));
+		__m128 nz = _mm_sub_ps(_mm_mul_ps(vx, uy), _mm_mul_ps(vy, ux));
+		
+		// A degenerate face divides by zero, and the mask turns that into a zero normal
+		__m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+		__m128 s = _mm_and_ps(_mm_cmpgt_ps(l, zero), _mm_div_ps(one, l));
+		
+		_mm_storeu_ps(&mNX[f], _mm_mul_ps(nx, s));
+		_mm_storeu_ps(&mNY[f], _mm_mul_ps(ny, s));
+		_mm_storeu_ps(&mNZ[f], _mm_mul_ps(nz, s));
+		_mm_storeu_ps(&mArea[f], _mm_mul_ps(half, l));
+	}
+#endif
+	
+	for (; f < f1; f++){
+		uint32_t a = o[f * 3], b = o[f * 3 + 1], c = o[f * 3 + 2];
+		
+		GLfloat ux = x[b] - x[a], uy = y[b] - y[a], uz = z[b] - z[a];
+		GLfloat vx = x[c] - x[a], vy = y[c] - y[a], vz = z[c] - z[a];
+		
+		GLfloat nx = vy * uz - vz * uy;
+		GLfloat ny = vz * ux - vx * uz;
+		GLfloat nz = vx * uy - vy * ux;
+		
+		GLfloat l = sqrtf(nx * nx + ny * ny + nz * nz);
+		GLfloat s = l > 0.0f ? 1.0f / l : 0.0f;
+		
+		mNX[f] = nx * s;
+		mNY[f] = ny * s;
+		mNZ[f] = nz * s;
+		mArea[f] = 0.5f * l;
+	}
+}
+
+/*
+ * Walk the fan of faces round each vertex. On a boundary the walk stops at the open edge,
+ * so go back to the start and walk the other way
+ */
+
+void HalfEdgeMesh::_vertexNormals(size_t v0, size_t v1) {
+	for (size_t v = v0; v < v1; v++){
+		uint32_t start = mVertexEdge[v];
+		GLfloat nx = 0.0f, ny = 0.0f, nz = 0.0f;
+		
+		if (start != sNone) {
+			uint32_t e = start;
+			bool closed = false;
+			do {
+				uint32_t f = face(e);
+				nx += mNX[f] * mArea[f];
+				ny += mNY[f] * mArea[f];
+				nz += mNZ[f] * mArea[f];
+				
+				e = mTwin[prev(e)];
+				closed = e == start;
+			} while (e != sNone && !closed);
+			
+			if (!closed) {
+				e = mTwin[start];
+				while (e != sNone) {
+					e = next(e);
+					uint32_t f = face(e);
+					nx += mNX[f] * mArea[f];
+					ny += mNY[f] * mArea[f];
+					nz += mNZ[f] * mArea[f];
+					e = mTwin[e];
+				}
+			}
+		}
+		
+		GLfloat l = sqrtf(nx * nx + ny * ny + nz * nz);
+		GLfloat s = l > 0.0f ? 1.0f / l : 0.0f;
+		mVNX[v] = nx * s;
+		mVNY[v] = ny * s;
+		mVNZ[v] = nz * s;
+	}
+}
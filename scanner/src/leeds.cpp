@@ -11,8 +11,22 @@
 using namespace cv;
 using namespace std;
 using namespace boost;
+using namespace boost::assign;
 
 namespace po = boost::program_options;
+
+
+/*
+ * Read an optional setting, leaving the default alone if the element is missing
+ */
+
+template<class T> static void readOptional(TiXmlElement *pParent, const char *name, T &value) {
+	if (!pParent)
+		return;
+	TiXmlElement *pP = pParent->FirstChildElement(name);
+	if (pP && pP->GetText())
+		value = fromStringS9<T>(string(pP->GetText()));
+}
 	
 
 /*
@@ -79,38 +93,17 @@ void Leeds::_update(){
 void Leeds::stop(){
 	mGo = false;
 	
+	// Cancel any mesh job and wait for it, as texturing and export read the cameras
+	mM.stop();
 	
-	vector<string> fn;
-	
-	TiXmlDocument doc( "./data/settings.xml" );
-	bool loadOkay = doc.LoadFile();
+	// The cameras remember their own filenames so there is no need to read settings.xml again
+	cout << "Leeds - Saving Camera Settings" << endl;
+	mManager.saveSettings();
 	
-	if (loadOkay){
-		
-		try{
-			TiXmlElement *pRoot = doc.FirstChildElement( "leeds" );
-			
-			TiXmlElement *pP;
-			if ( pRoot ) {
-				// Deal with the Cameras
-				
-				TiXmlElement *pCameras= pRoot->FirstChildElement("cameras");
-				
-				// Grab all the cameras
-				TiXmlElement *pCam = pCameras->FirstChildElement("cam");
-				while (pCam) {
-					pP = pCam->FirstChildElement("in"); 	
-					fn.push_back(string(pP->GetText()));
-					pCam = pCam->NextSiblingElement();
-				}
-			}
-		}
-		catch(...){
-			cerr << "Leeds - Error in saving" << endl;
-		}
+	if (mManager.hasProjector()){
+		cout << "Leeds - Saving Projector Settings" << endl;
+		saveCameraParameters(mConfig.projectorFile, mManager.getProjector());
 	}
-	cout << "Leeds - Saving Camera Settings" << endl;
-	mManager.saveSettings(fn);
 	mManager.shutdown();
 					
 }
@@ -127,6 +120,49 @@ Leeds::~Leeds() {
 }
 
 void Leeds::parseXML(){
+	
+	// Defaults for the optional settings
+	mConfig.phaseSteps = 4;
+	mConfig.phaseFrequencies.clear();
+	mConfig.phaseFrequencies += 1,8,64;
+	mConfig.phaseMinModulation = 10.0f;
+	mConfig.phasePitch = 2;
+	
+	mConfig.stripeThreshold = 60;
+	mConfig.stripeWindow = 4;
+	mConfig.stripeGaussian = true;
+	mConfig.stripeColumns = false;
+	
+	mConfig.planCoarse = 0;	// Opt in - the scan key keeps the full raster unless a plan is set
+	mConfig.planFine = 5;
+	mConfig.planJump = 0.5f;
+	
+	mConfig.dotCount = 16;
+	mConfig.dotThreshold = 60;
+	mConfig.dotTolerance = 2.0f;
+	
+	mConfig.calibrationBundle = "./data/calibration.bin";
+	mConfig.worldPoses = 1;
+	mConfig.worldIntrinsics = false;
+	
+	mConfig.qualitySharpness = 20.0f;
+	mConfig.qualitySaturation = 0.05f;
+	mConfig.qualityDark = 20.0f;
+	mConfig.qualityBright = 235.0f;
+	
+	mConfig.textureBlend = true;
+	mConfig.textureGain = true;
+	
+	mConfig.pclVoxelSize = 0.0f;
+	mConfig.pclFilterRadius = 0.0f;
+	mConfig.pclFilterCount = 4;
+	
+	mConfig.threads = 0;
+	mConfig.threadAffinity = false;
+	
+	mConfig.projectorSize = cv::Size(1024,768);
+	mConfig.projectorFile = "./data/projector.xml";
+	
 	TiXmlDocument doc( "./data/settings.xml" );
 	bool loadOkay = doc.LoadFile();
 	if (loadOkay){
@@ -149,6 +185,10 @@ void Leeds::parseXML(){
 				// Load the camera manager
 				mManager.setup(mConfig);
 				
+				// Calibration bundle - optional, falls back to each camera's own file
+				readOptional(pRoot->FirstChildElement("calibration"), "bundle", mConfig.calibrationBundle);
+				mManager.loadBundle(mConfig.calibrationBundle);
+				
 				// Grab all the cameras
 				TiXmlElement *pCam = pCameras->FirstChildElement("cam");
 				while (pCam) {
@@ -219,12 +259,88 @@ void Leeds::parseXML(){
 				pP = pPCL->FirstChildElement("polynomial"); mConfig.pclPolynomialOrder = fromStringS9<float>(string(pP->GetText()));
 				pP = pPCL->FirstChildElement("sampleradius"); mConfig.pclUpsamplingRadius = fromStringS9<float>(string(pP->GetText()));
 				pP = pPCL->FirstChildElement("stepsize"); mConfig.pclUpsamplingStepSize = fromStringS9<float>(string(pP->GetText()));
+				readOptional(pPCL, "voxel", mConfig.pclVoxelSize);
+				readOptional(pPCL, "filterradius", mConfig.pclFilterRadius);
+				readOptional(pPCL, "filtercount", mConfig.pclFilterCount);
+				
+				// One voxel per mesh cell on the finest axis
+				if (mConfig.pclVoxelSize == 0.0f) {
+					float cells[3] = { fabs(mConfig.xe - mConfig.xs) / std::max(mConfig.meshResolution.x, 1),
+						fabs(mConfig.ye - mConfig.ys) / std::max(mConfig.meshResolution.y, 1),
+						fabs(mConfig.ze - mConfig.zs) / std::max(mConfig.meshResolution.z, 1) };
+					mConfig.pclVoxelSize = std::min(cells[0], std::min(cells[1], cells[2]));
+				}
 				
 				
 				// Deal with OpenCV
 				TiXmlElement *pOpenCV = pRoot->FirstChildElement("opencv");
 				pP = pOpenCV->FirstChildElement("threshold"); mConfig.pointThreshold = fromStringS9<float>(string(pP->GetText()));
 				
+				// Deal with World Calibration - optional
+				TiXmlElement *pWorld = pRoot->FirstChildElement("world");
+				readOptional(pWorld, "poses", mConfig.worldPoses);
+				readOptional(pWorld, "intrinsics", mConfig.worldIntrinsics);
+				
+				// Deal with the Frame Quality gate - optional
+				TiXmlElement *pQuality = pRoot->FirstChildElement("quality");
+				readOptional(pQuality, "sharpness", mConfig.qualitySharpness);
+				readOptional(pQuality, "saturation", mConfig.qualitySaturation);
+				readOptional(pQuality, "dark", mConfig.qualityDark);
+				readOptional(pQuality, "bright", mConfig.qualityBright);
+				
+				// Deal with Texturing - optional
+				TiXmlElement *pTexture = pRoot->FirstChildElement("texture");
+				readOptional(pTexture, "blend", mConfig.textureBlend);
+				readOptional(pTexture, "gain", mConfig.textureGain);
+				
+				// Deal with the Projector - optional, only there once it has been calibrated
+				TiXmlElement *pProjector = pRoot->FirstChildElement("projector");
+				readOptional(pProjector, "width", mConfig.projectorSize.width);
+				readOptional(pProjector, "height", mConfig.projectorSize.height);
+				if (pProjector && pProjector->FirstChildElement("in") && pProjector->FirstChildElement("in")->GetText()){
+					mConfig.projectorFile = string(pProjector->FirstChildElement("in")->GetText());
+					mManager.loadProjector(mConfig.projectorFile, mConfig.projectorSize);
+				}
+				
+				// Deal with Stripe Scanning - optional
+				TiXmlElement *pStripe = pRoot->FirstChildElement("stripe");
+				readOptional(pStripe, "threshold", mConfig.stripeThreshold);
+				readOptional(pStripe, "window", mConfig.stripeWindow);
+				readOptional(pStripe, "gaussian", mConfig.stripeGaussian);
+				readOptional(pStripe, "columns", mConfig.stripeColumns);
+				
+				// Deal with Planned Scanning - optional, a coarse pitch of 0 goes back to the full raster
+				TiXmlElement *pPlan = pRoot->FirstChildElement("plan");
+				readOptional(pPlan, "coarse", mConfig.planCoarse);
+				readOptional(pPlan, "fine", mConfig.planFine);
+				readOptional(pPlan, "jump", mConfig.planJump);
+				
+				// Deal with Multiple Dot Scanning - optional
+				TiXmlElement *pDots = pRoot->FirstChildElement("dots");
+				readOptional(pDots, "count", mConfig.dotCount);
+				readOptional(pDots, "threshold", mConfig.dotThreshold);
+				readOptional(pDots, "tolerance", mConfig.dotTolerance);
+				
+				// Deal with the Thread Pool - optional
+				TiXmlElement *pThreads = pRoot->FirstChildElement("threads");
+				readOptional(pThreads, "workers", mConfig.threads);
+				readOptional(pThreads, "affinity", mConfig.threadAffinity);
+				ThreadPool::get().setup(mConfig.threads, mConfig.threadAffinity);
+				
+				// Deal with Phase Shifting - optional
+				TiXmlElement *pPhase = pRoot->FirstChildElement("phase");
+				readOptional(pPhase, "steps", mConfig.phaseSteps);
+				readOptional(pPhase, "modulation", mConfig.phaseMinModulation);
+				readOptional(pPhase, "pitch", mConfig.phasePitch);
+				
+				if (pPhase && pPhase->FirstChildElement("frequencies") && pPhase->FirstChildElement("frequencies")->GetText()){
+					std::istringstream fs (pPhase->FirstChildElement("frequencies")->GetText());
+					int f;
+					mConfig.phaseFrequencies.clear();
+					while (fs >> f)
+						mConfig.phaseFrequencies.push_back(f);
+				}
+				
 				
 			
 			}
@@ -253,7 +369,7 @@ void Leeds::setup(){
 	// Mesh starting
 	mM.setup(mConfig);
 
-	pInfo = shared_ptr<StateInfo>(new StateInfo(mManager,mD,mM, *pProject));
+	pInfo = shared_ptr<StateInfo>(new StateInfo(mManager,mD,mM, *pProject, mConfig));
 
 	// Configure States
 	StackState<BaseState> l(qState,pInfo);
@@ -375,6 +491,7 @@ void Leeds::paintGL() {
 	glClearBufferfv(GL_DEPTH, 0, &depth );
 	
 	mManager.update(); // Placed here as it has opengl texture calls
+	mM.upload(mManager.getCams()); // Swaps in a finished mesh job, if there is one
 	if (qState.size() > 0)
 		qState.back().draw();
 	
@@ -402,11 +519,56 @@ void Leeds::toggleShowCameras() {
  */
 
 void Leeds::toggleScanning() {
+	if (mConfig.planCoarse > 0) {
+		StackState<StatePlannedScan> s(qState,pInfo);
+		if (!s.remove())
+			s();
+		else
+			pProject->setMode(PROJECT_POINT);
+		return;
+	}
+	
 	StackState<StateScan> s(qState,pInfo);
 	if (!s.remove())
 		s();
 }
 
+/*
+ * Toggle the phase shifting scan. Put the projector back to dots if we abort early
+ */
+
+void Leeds::togglePhaseScanning() {
+	StackState<StatePhaseScan> s(qState,pInfo);
+	if (!s.remove())
+		s();
+	else
+		pProject->setMode(PROJECT_POINT);
+}
+
+/*
+ * Toggle the line stripe scan
+ */
+
+void Leeds::toggleStripeScanning() {
+	StackState<StateStripeScan> s(qState,pInfo);
+	if (!s.remove())
+		s();
+	else
+		pProject->setMode(PROJECT_POINT);
+}
+
+/*
+ * Toggle the multiple dot scan
+ */
+
+void Leeds::toggleDotScanning() {
+	StackState<StateDotScan> s(qState,pInfo);
+	if (!s.remove())
+		s();
+	else
+		pProject->setMode(PROJECT_POINT);
+}
+
 /*
  * Toggle Texturing State
  */
@@ -452,12 +614,26 @@ void Leeds::toggleToolView() {
 		s();
  }
  
+ /*
+  * Fire up the projector calibration - put the projector back if we abort early
+  */
+ 
+ void Leeds::calibrateProjector() {
+	StackState<StateCalibrateProjector> s(qState,pInfo);
+	if (!s.remove())
+		s();
+	else {
+		pProject->setFlash(false);
+		pProject->setMode(PROJECT_POINT);
+	}
+ }
+ 
  /*
   * Toggle the detected points
   */
   
  void Leeds::toggleDetected(){
-	if (qState.back().mID == "StateScan"){
+	if (qState.back().mID == "StateScan" || qState.back().mID == "StatePlannedScan"){
 		pInfo->sr = !pInfo->sr;
 	}
  }
@@ -467,9 +643,8 @@ void Leeds::toggleToolView() {
   */
   
 void Leeds::save() {
-	mM.generate(mManager.getCams());
 	mM.saveToFile("./data/test.pcd");
-	mM.saveMeshToFile("./data/test.stl");
+	mM.generate(mManager.getCams(), "./data/test");
 }
 
 void Leeds::load(std::string filename) {
@@ -496,6 +671,18 @@ void Leeds::clearMesh() {mM.clearMesh(); }
 
 void Leeds::generateMesh() { mM.generate(pInfo->c.getCams()); }
 
+/*
+ * Status of the running state, plus the mesh job while it runs
+ */
+
+std::string Leeds::getStatus() {
+	std::string status = pInfo ? pInfo->getStatus() : "Leeds - Nonestate";
+	std::string progress = mM.getProgress();
+	if (!progress.empty())
+		status += " - " + progress;
+	return status;
+}
+
 /*
  * Toggle drawing the mesh filled in
  */
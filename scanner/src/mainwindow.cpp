@@ -215,6 +215,18 @@ void MainWindow::keyPressEvent ( QKeyEvent * event ) {
 	else if(event->key() == Qt::Key_T){
 		pLeedsWidget->toggleTexturing();
 	}
+	else if(event->key() == Qt::Key_P){
+		pLeedsWidget->togglePhaseScanning();
+	}
+	else if(event->key() == Qt::Key_L){
+		pLeedsWidget->toggleStripeScanning();
+	}
+	else if(event->key() == Qt::Key_J){
+		pLeedsWidget->calibrateProjector();
+	}
+	else if(event->key() == Qt::Key_K){
+		pLeedsWidget->toggleDotScanning();
+	}
 }
 
 void MainWindow::handleExit() {
@@ -8,22 +8,36 @@
 
 #include "mesh.hpp"
 
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 using namespace std;
 using namespace boost;
 using namespace pcl;
 
 size_t LeedsMesh::sBufferSize = 100; // Number of elements in the buffer
+size_t LeedsMesh::sVotePasses = 3; // Neighbour voting passes when picking cameras for texturing
+float LeedsMesh::sVisibleTolerance = 0.02f; // Fraction of the depth a face may sit behind the depth map
+float LeedsMesh::sBlendCutoff = 0.05f; // Cameras giving less than this share of a vertex are dropped
+size_t LeedsMesh::sGainSamples = 16384; // Vertices sampled to measure the camera gains
+
+const size_t LeedsMesh::sMaxBlend;
+
+const char *LeedsMesh::sStageNames[] = { "Waiting", "Reducing", "Filtering", "Smoothing", "Normals", "Poisson",
+	"Half edges", "Texturing", "Exporting", "Done" };
 
 void LeedsMesh::setup(GlobalConfig &config) {
 	mObj.reset(new SharedObj(config));
 	
 	// Create basic mesh
 	mObj->pCloud.reset(new pcl::PointCloud<pcl::PointXYZ>);	
-	mObj->pCloudFiltered.reset(new pcl::PointCloud<pcl::PointXYZ>);
 	
 	// Create bits to generate normals
 	mObj->mNormals.reset (new pcl::PointCloud<pcl::Normal>);
-	mObj->mTree.reset (new pcl::search::KdTree<pcl::PointXYZ>);
 	mObj->mCloud_with_normals.reset (new pcl::PointCloud<pcl::PointNormal>);
 
 	
@@ -31,7 +45,7 @@ void LeedsMesh::setup(GlobalConfig &config) {
 	mObj->mPass.setInputCloud (mObj->pCloud);
 	mObj->mPass.setFilterFieldName ("z");
 	mObj->mPass.setFilterLimits (-0.1,config.meshResolution.z);
-	mObj->mPass.filter (*(mObj->pCloudFiltered));
+	mObj->mPass.filter (*(mObj->pFront->pCloudFiltered));
 	
 	mObj->mTextured = false;
 	
@@ -94,7 +108,52 @@ void LeedsMesh::addPoint(double_t x, double_t y, double_t z){
 }
 
 /*
- * Convert the winged edge into a VBO
+ * Add many points at once with a single buffer upload. Like addPoint call on the OpenGL Thread
+ */
+
+void LeedsMesh::addPoints(std::vector<cv::Point3f> &points) {
+	if (points.size() == 0)
+		return;
+	
+	size_t start = mObj->mPointsVBO.mNumElements;
+	size_t needed = (start + points.size()) * 3;
+	
+	// Keep the same headroom rule as addPoint so the buffer is never more than 2/3rds full
+	bool grow = false;
+	while (needed > static_cast<GLfloat>(mObj->mPointsVBO.mVertices.size()) * 0.6){
+		for (int i=0; i < sBufferSize * 3; i ++)
+			mObj->mPointsVBO.mVertices.push_back(0.0f);
+		grow = true;
+	}
+	
+	for (size_t i = 0; i < points.size(); i++){
+		pcl::PointXYZ pos(points[i].x, points[i].y, points[i].z);
+		mObj->pCloud->points.push_back(pos);
+		
+		mObj->mPointsVBO.mVertices[(start + i) * 3] = static_cast<GLfloat>(points[i].x);
+		mObj->mPointsVBO.mVertices[(start + i) * 3 + 1] = static_cast<GLfloat>(points[i].y);
+		mObj->mPointsVBO.mVertices[(start + i) * 3 + 2] = static_cast<GLfloat>(points[i].z);
+	}
+	
+	mObj->mUpdate = true;
+	mObj->mPointsVBO.mNumElements += points.size();
+	
+	mObj->mPointsVBO.bind();
+	if (grow)
+		mObj->mPointsVBO.allocateVertices();
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, mObj->mPointsVBO.mVID);
+		glBufferSubData(GL_ARRAY_BUFFER, start * 3 * sizeof(GLfloat),
+				points.size() * 3 * sizeof(GLfloat), &mObj->mPointsVBO.mVertices[start * 3]);
+	}
+	mObj->mPointsVBO.unbind();
+	
+	checkError(__LINE__);
+}
+
+
+/*
+ * Convert the half edge mesh into a VBO
  */
 
 void LeedsMesh::generateMeshVBO(std::vector<boost::shared_ptr<LeedsCam> >&cameras) {	
@@ -103,67 +162,75 @@ void LeedsMesh::generateMeshVBO(std::vector<boost::shared_ptr<LeedsCam> >&camera
 	mObj->mMeshVBO.mNormals.clear();
 	mObj->mMeshVBO.mTexCoords.clear();
 	mObj->mMeshVBO.vTexIDs.clear();
-
+	mObj->mMeshVBO.mBlend.clear();
+	mObj->mMeshVBO.mIndices.clear();
 			
-	for (size_t i = 0; i < mObj->mWE.size(); ++i) {
+	HalfEdgeMesh &he = mObj->pFront->mHE;
 	
-		shared_ptr<WE_Face> sf = mObj->mWE[i];
-			
-		shared_ptr<WE_Vertex> v0 = sf->edge->v0;
-		shared_ptr<WE_Vertex> v1 = sf->edge->next->v0;
-		shared_ptr<WE_Vertex> v2 = sf->edge->next->next->v0;
-			
-		// Vertices
-		
-		mObj->mMeshVBO.mVertices.push_back(v0->x);
-		mObj->mMeshVBO.mVertices.push_back(v0->y);
-		mObj->mMeshVBO.mVertices.push_back(v0->z);
-		
-		mObj->mMeshVBO.mVertices.push_back(v1->x);
-		mObj->mMeshVBO.mVertices.push_back(v1->y);
-		mObj->mMeshVBO.mVertices.push_back(v1->z);
-		
-		mObj->mMeshVBO.mVertices.push_back(v2->x);
-		mObj->mMeshVBO.mVertices.push_back(v2->y);
-		mObj->mMeshVBO.mVertices.push_back(v2->z);
-		
-		// TexCoords
+	if (mObj->mConfig.textureBlend && mObj->pFront->mBlend.size() == he.numVertices() * sMaxBlend) {
+		// The weights belong to the vertex and blend across its faces, so the mesh goes in as it is
+		for (size_t v = 0; v < he.numVertices(); v++){
+			mObj->mMeshVBO.mVertices.push_back(he.mX[v]);
+			mObj->mMeshVBO.mVertices.push_back(he.mY[v]);
+			mObj->mMeshVBO.mVertices.push_back(he.mZ[v]);
+			mObj->mMeshVBO.mNormals.push_back(he.mVNX[v]);
+			mObj->mMeshVBO.mNormals.push_back(he.mVNY[v]);
+			mObj->mMeshVBO.mNormals.push_back(he.mVNZ[v]);
+		}
+		mObj->mMeshVBO.mBlend = mObj->pFront->mBlend;
 		
-		vector<cv::Point3f> tOPoints;
-		tOPoints.push_back(cv::Point3f(v0->x, v0->y, v0->z));
-		tOPoints.push_back(cv::Point3f(v1->x, v1->y, v1->z));
-		tOPoints.push_back(cv::Point3f(v2->x, v2->y, v2->z));
-		vector<cv::Point2f> results;
-				
-		boost::shared_ptr<LeedsCam> cam = cameras[ sf->t ];
-		CameraParameters in = cam->getParams();
-		cv::projectPoints(tOPoints, in.R, in.T, in.M, in.D, results );
+		for (size_t f = 0; f < he.numFaces(); f++){
+			for (size_t j = 0; j < 3; j++)
+				mObj->mMeshVBO.mIndices.push_back(he.vertex(f, j));
+		}
+	}
+	else {
+		// Group the faces by camera. A vertex is shared by every face of the same camera - the
+		// texcoords are made in the shader, so nothing is projected here. Faces with no camera
+		// the shader can take, or no cameras at all, go in one more group with no weights
+		size_t n = min(cameras.size(), sMaxBlend);
+		vector< vector<uint32_t> > byCamera(n + 1);
+		for (size_t i = 0; i < he.numFaces(); ++i)
+			byCamera[he.mTex[i] < n ? he.mTex[i] : n].push_back(i);
 	
-		// We need to mirror the co-ordinates here but only in the X plane
-		
-		mObj->mMeshVBO.mTexCoords.push_back(results[0].x);
-		mObj->mMeshVBO.mTexCoords.push_back(results[0].y);
-		
-		mObj->mMeshVBO.mTexCoords.push_back(results[1].x);
-		mObj->mMeshVBO.mTexCoords.push_back(results[1].y);
+		vector<uint32_t> stamp(he.numVertices(), HalfEdgeMesh::sNone);
+		vector<GLuint> remap(he.numVertices());
+	
+		for (size_t c = 0; c <= n; c++){
+			vector<uint32_t> &faces = byCamera[c];
+			if (faces.empty())
+				continue;
 		
-		mObj->mMeshVBO.mTexCoords.push_back(results[2].x);
-		mObj->mMeshVBO.mTexCoords.push_back(results[2].y);
+			GLuint base = mObj->mMeshVBO.mVertices.size() / 3;
+			GLuint added = 0;
 		
-			
-		// Normals and TexIDs
-		///\todo could use the winged edge to interpolate the normals for smoother shading?
-		
-		for (size_t j =0; j < 3; j++){
-			mObj->mMeshVBO.mNormals.push_back(sf->nx);
-			mObj->mMeshVBO.mNormals.push_back(sf->ny);
-			mObj->mMeshVBO.mNormals.push_back(sf->nz);
-			mObj->mMeshVBO.vTexIDs.push_back(sf->t);
+			for (size_t i = 0; i < faces.size(); i++){
+				for (size_t j = 0; j < 3; j++){
+					uint32_t v = he.vertex(faces[i], j);
+					if (stamp[v] != c) {
+						stamp[v] = c;
+						remap[v] = base + added++;
+					
+						// Smoothed vertex normals so the shading is interpolated across the surface
+						mObj->mMeshVBO.mVertices.push_back(he.mX[v]);
+						mObj->mMeshVBO.mVertices.push_back(he.mY[v]);
+						mObj->mMeshVBO.mVertices.push_back(he.mZ[v]);
+						mObj->mMeshVBO.mNormals.push_back(he.mVNX[v]);
+						mObj->mMeshVBO.mNormals.push_back(he.mVNY[v]);
+						mObj->mMeshVBO.mNormals.push_back(he.mVNZ[v]);
+						
+						// One camera per vertex is a weight of one
+						for (size_t k = 0; k < sMaxBlend; k++)
+							mObj->mMeshVBO.mBlend.push_back(k == c && c < n ? 1.0f : 0.0f);
+					}
+					mObj->mMeshVBO.mIndices.push_back(remap[v]);
+				}
+			}
 		}
 	}
 			
-	// Finally, compile the VBO
-	mObj->mMeshVBO.compile(VBO_VERT | VBO_TEXC | VBO_NORM | VBO_TEXI);
+	// Finally, compile the VBO - one interleaved buffer drawn with the indices
+	mObj->mMeshVBO.compileInterleaved(VBO_VERT | VBO_NORM | VBO_BLND);
 	checkError(__LINE__);
 	
 	// Now create the normals VBO
@@ -206,387 +273,887 @@ void LeedsMesh::generateMeshVBO(std::vector<boost::shared_ptr<LeedsCam> >&camera
 	
 		
 	cout << "Leeds Mesh VBO Normals Count: " << mObj->mMeshVBO.mNormals.size() / 3 << endl;	
-	cout << "Leeds Mesh VBO Triangle count: " << mObj->mMeshVBO.mVertices.size() / 9 << endl;
-	cout << "Leeds Mesh VBO TexIDS count: " << mObj->mMeshVBO.vTexIDs.size() << endl;
+	cout << "Leeds Mesh VBO Vertex count: " << mObj->mMeshVBO.mVertices.size() / 3 << endl;
+	cout << "Leeds Mesh VBO Triangle count: " << mObj->mMeshVBO.mIndices.size() / 3 << endl;
+	cout << "Leeds Mesh VBO Blend weights count: " << mObj->mMeshVBO.mBlend.size() << endl;
 	
 }
 
 
 /*
- * Generate the Winged Edge Structure with embedded data
+ * Generate the half edge structure with embedded data
  */
 
-void LeedsMesh::generateWinged(std::vector<boost::shared_ptr<LeedsCam> >&cameras, bool reverse = false) {
+void LeedsMesh::generateHalfEdge(MeshBuffer &b, std::vector<boost::shared_ptr<LeedsCam> >&cameras, bool reverse) {
 	// Loop through computed cloud and save values
-
-	mObj->mWE.clear();
+	pcl::PolygonMesh &mesh = b.mTriangles;
 	
-	unsigned int nr_points = mObj->mTriangles.cloud.width * mObj->mTriangles.cloud.height;
-	unsigned int nr_polygons = static_cast<unsigned int> (mObj->mTriangles.polygons.size ());
+	unsigned int nr_points = mesh.cloud.width * mesh.cloud.height;
+	unsigned int nr_polygons = static_cast<unsigned int> (mesh.polygons.size ());
 
 	// get field indices for x, y, z (as well as rgb and/or rgba)
 	int idx_x = -1, idx_y = -1, idx_z = -1, idx_rgb = -1, idx_rgba = -1, idx_normal_x = -1, idx_normal_y = -1, idx_normal_z = -1;
 	
-	for (int d = 0; d < static_cast<int> (mObj->mTriangles.cloud.fields.size ()); ++d) {
-		if (mObj->mTriangles.cloud.fields[d].name == "x") idx_x = d;
-		else if (mObj->mTriangles.cloud.fields[d].name == "y") idx_y = d;
-		else if (mObj->mTriangles.cloud.fields[d].name == "z") idx_z = d;
-		else if (mObj->mTriangles.cloud.fields[d].name == "rgb") idx_rgb = d;
-		else if (mObj->mTriangles.cloud.fields[d].name == "rgba") idx_rgba = d;
-		else if (mObj->mTriangles.cloud.fields[d].name == "normal_x") idx_normal_x = d;
-		else if (mObj->mTriangles.cloud.fields[d].name == "normal_y") idx_normal_y = d;
-		else if (mObj->mTriangles.cloud.fields[d].name == "normal_z") idx_normal_z = d;
+	for (int d = 0; d < static_cast<int> (mesh.cloud.fields.size ()); ++d) {
+		if (mesh.cloud.fields[d].name == "x") idx_x = d;
+		else if (mesh.cloud.fields[d].name == "y") idx_y = d;
+		else if (mesh.cloud.fields[d].name == "z") idx_z = d;
+		else if (mesh.cloud.fields[d].name == "rgb") idx_rgb = d;
+		else if (mesh.cloud.fields[d].name == "rgba") idx_rgba = d;
+		else if (mesh.cloud.fields[d].name == "normal_x") idx_normal_x = d;
+		else if (mesh.cloud.fields[d].name == "normal_y") idx_normal_y = d;
+		else if (mesh.cloud.fields[d].name == "normal_z") idx_normal_z = d;
 		else
-			cout << mObj->mTriangles.cloud.fields[d].name << endl;
+			cout << mesh.cloud.fields[d].name << endl;
 		
 	}
 	if ( ( idx_x == -1 ) || ( idx_y == -1 ) || ( idx_z == -1 ) )
 		nr_points = 0;
 
-	// Create a temporary array of vertices for now. 
-	///\todo since we only ever get vertices from Poisson we could remove the step below?
-	std::vector< boost::shared_ptr<WE_Vertex> > vs;
-
-	if (nr_points > 0){					
-		Eigen::Array4i xyz_offset (mObj->mTriangles.cloud.fields[idx_x].offset, mObj->mTriangles.cloud.fields[idx_y].offset, mObj->mTriangles.cloud.fields[idx_z].offset, 0);
-		for (vtkIdType cp = 0; cp < static_cast<vtkIdType> (nr_points); ++cp, xyz_offset += mObj->mTriangles.cloud.point_step) {
-			float_t v;
-			shared_ptr<WE_Vertex> sv (new WE_Vertex);
-			vs.push_back(sv);
-			memcpy(&v, &mObj->mTriangles.cloud.data[xyz_offset[0]], sizeof (float_t));
-			sv->x = v;
-			memcpy(&v, &mObj->mTriangles.cloud.data[xyz_offset[1]], sizeof (float_t));
-			sv->y = v;
-			memcpy(&v, &mObj->mTriangles.cloud.data[xyz_offset[2]], sizeof (float_t));
-			sv->z = v;
-		}
-	} else
+	if (nr_points == 0) {
+		b.mHE.clear();
 		return;
+	}
+	
+	// Pack the positions and indices flat, then hand them over to be matched up
+	vector<GLfloat> positions(nr_points * 3);
+	const size_t step = mesh.cloud.point_step;
+	const uint8_t *data = &mesh.cloud.data[0];
+	
+	for (size_t cp = 0; cp < nr_points; ++cp) {
+		memcpy(&positions[cp * 3], data + cp * step + mesh.cloud.fields[idx_x].offset, sizeof (GLfloat));
+		memcpy(&positions[cp * 3 + 1], data + cp * step + mesh.cloud.fields[idx_y].offset, sizeof (GLfloat));
+		memcpy(&positions[cp * 3 + 2], data + cp * step + mesh.cloud.fields[idx_z].offset, sizeof (GLfloat));
+	}
+	
+	vector<uint32_t> triangles;
+	triangles.reserve(nr_polygons * 3);
+	
+	for (unsigned int i = 0; i < nr_polygons; i++) {
+		unsigned int nr_points_in_polygon = static_cast<unsigned int> (mesh.polygons[i].vertices.size ());
+		if (nr_points_in_polygon != 3){
+			throw std::runtime_error("Non triangular polygon detected");
+		}
+		
+		uint32_t idcs[3];
+		if (reverse){
+			for (int j =2; j >= 0; j--)
+				idcs[j] = mesh.polygons[i].vertices[j];
+		}
+		else{
+			for (int j =0; j < 3; j++)
+				idcs[j] = mesh.polygons[i].vertices[j];
+		}
+		triangles.insert(triangles.end(), idcs, idcs + 3);
+	}
+	
+	HalfEdgeMesh &he = b.mHE;
+	he.build(positions, triangles);
 	
+	cerr << "Leeds Half Edge Vertices Count: " << he.numVertices() << endl;
+	cerr << "Leeds Half Edge edges count: " << he.numHalfEdges() << endl;
+	cerr << "Leeds Half Edge Face Count: " << he.numFaces() << endl;
 	
-	cerr << "Leeds Winged Edge Vertices Count: " << vs.size() << endl;
+	// Face and smoothed vertex normals, timed on their own as they scale with the cores
+	posix_time::ptime start = posix_time::microsec_clock::universal_time();
+	he.computeNormals();
+	posix_time::time_duration took = posix_time::microsec_clock::universal_time() - start;
+	cerr << "Leeds Half Edge normals took " << took.total_milliseconds() << "ms on " << ThreadPool::get().size() << " threads" << endl;
+}
+
+
+/*
+ * Generate the TexIDs for the half edge mesh. Each face takes the camera it faces most
+ * directly out of those that can see it, then a few passes of neighbour voting smooth
+ * out the odd stray face. Only the cameras the shader has room for are used
+ */
 
+void LeedsMesh::generateTexIDs(MeshBuffer &b, std::vector<boost::shared_ptr<LeedsCam> >&all) {
+	HalfEdgeMesh &he = b.mHE;
+	if (he.numFaces() == 0 || all.size() == 0)
+		return;
 	
-	// Now create proper winged edge and indices using a concatenated 32 bit index to a 64 bit key
-	// In addition we create a straight list of unique triangles
+	if (all.size() > sMaxBlend)
+		cerr << "Leeds - Texturing with the first " << sMaxBlend << " of " << all.size() << " cameras" << endl;
 	
-	map< uint64_t, shared_ptr<WE_Edge> > es;
+	vector<boost::shared_ptr<LeedsCam> > cameras(all.begin(), all.begin() + min(all.size(), sMaxBlend));
 	
-	if (nr_polygons > 0) {
-		for (unsigned int i = 0; i < nr_polygons; i++) {
-			
-			unsigned int nr_points_in_polygon = static_cast<unsigned int> (mObj->mTriangles.polygons[i].vertices.size ());
-			if (nr_points_in_polygon != 3){
-				cerr << "Leeds - Non triangular polygon detected" << endl;
-				throw;
-			}
+	// Camera normals packed as x, y and z runs so the inner loop stays flat
+	size_t nc = cameras.size();
+	vector<GLfloat> normals(nc * 3);
+	
+	for (size_t i = 0; i < nc; i ++){
+		cv::Mat n = cameras[i]->getNormal();
+		Eigen::Vector3d nn (n.at<double_t>(0,0),n.at<double_t>(1,0),n.at<double_t>(2,0));
+		nn.normalize();
+		normals[i] = nn.x();
+		normals[nc + i] = nn.y();
+		normals[nc * 2 + i] = nn.z();
+	}
+	
+	// Depth map per camera, once, then a visible flag per camera per face. Cameras with no
+	// extrinsics see everything so they behave as before
+	posix_time::ptime start = posix_time::microsec_clock::universal_time();
+	size_t nf = he.numFaces();
+	vector<uint8_t> visible(nc * nf, 1);
+	
+	for (size_t i = 0; i < nc; i ++){
+		DepthMap depth(mObj->mConfig.camSize);
+		if (depth.render(he, cameras[i]->getParams()))
+			depth.visible(&visible[i * nf], sVisibleTolerance);
+	}
+	
+	posix_time::time_duration took = posix_time::microsec_clock::universal_time() - start;
+	cerr << "Leeds Mesh visibility took " << took.total_milliseconds() << "ms for " << nc << " cameras" << endl;
+	
+	// The largest dot product is the smallest angle, so there is no need for acos
+	parallelFor(0, nf, 4096, boost::bind(&LeedsMesh::_bestCameras, this, &he, &normals, &visible, _1, _2));
+	
+	// Vote in passes from one buffer into the other so every face sees the same labels
+	vector<GLuint> labels(he.mTex);
+	for (size_t pass = 0; pass < sVotePasses; pass++){
+		parallelFor(0, nf, 4096, boost::bind(&LeedsMesh::_voteCameras, this, &he, &he.mTex, &labels, &visible, _1, _2));
+		bool changed = he.mTex != labels;
+		he.mTex.swap(labels);
+		if (!changed)
+			break;
+	}
+	
+	generateBlend(b, cameras, visible);
+}
 
+/*
+ * Best facing camera for a range of faces. Works through the faces in blocks with the
+ * cameras on the outside, so each camera is a branch free compare over the block.
+ * Faces no camera can see fall back to the best facing one
+ */
 
-			shared_ptr<WE_Face>  f (new WE_Face());
-			bool bf = false;
-			uint32_t idcs[3];
-			
-			if (reverse){
-				for (int j =2; j >= 0; j--)
-					idcs[j] = mObj->mTriangles.polygons[i].vertices[j];
-			}
-			else{
-				for (int j =0; j < 3; j++)
-					idcs[j] = mObj->mTriangles.polygons[i].vertices[j];
-			}
-			
-			// Find Edges to add to face
-			map< uint64_t, shared_ptr<WE_Edge> >::iterator pi = es.end();
-			
-			boost::shared_ptr<WE_Edge> prev;
-			boost::shared_ptr<WE_Edge> current;
-			boost::shared_ptr<WE_Edge> first;
-			
-			vector<uint64_t> keys;
-			
-			for (int j = 0; j < 3; j++){
-				
-				map< uint64_t, shared_ptr<WE_Edge> >::iterator fi;
-				
-				// create two keys and perform lookup
-				int k = j == 2 ? 0 : j + 1;
-				uint64_t jk = idcs[j]; jk = jk << 32;
-				jk |= idcs[k];
-				
-				uint64_t kj = idcs[k]; kj = kj << 32;
-				kj |= idcs[j];
-							
-									
-				// new edge	
-				shared_ptr<WE_Edge> sp (new WE_Edge);
-				sp->face = f;
-				f->edge = sp;
-								
-				// Do we have a symetric edge?
-				fi = es.find(kj);
-				if (fi != es.end() ){
-					sp->sym = fi->second;
-					fi->second->sym = sp;
-				}
-				
-				current = sp;
-				sp->v0 = vs[idcs[j]];
-				sp->v1 = vs[idcs[k]];
-				
-				if (j == 0){
-					prev = current;
-					first = current;
-				}else {
-					prev->next = current;
-					current->prev = prev;
-					prev = current;
-				}
-				
-				
-				// this should never happen as its basically a badly wound polygon - 
-				// in this case remove the face and all associated edges
-				fi = es.find(jk);
-				if (fi != es.end()){
-					bf = true;
-					break;
-				}
-				keys.push_back(jk);
-				es.insert( pair<uint64_t, shared_ptr<WE_Edge> > (jk, sp) );
+void LeedsMesh::_bestCameras(HalfEdgeMesh *mesh, std::vector<GLfloat> *normals, std::vector<uint8_t> *visible, size_t f0, size_t f1) {
+	HalfEdgeMesh &he = *mesh;
+	const size_t nc = normals->size() / 3;
+	const size_t nf = he.numFaces();
+	const GLfloat *cx = &(*normals)[0];
+	const GLfloat *cy = cx + nc;
+	const GLfloat *cz = cy + nc;
+	
+	const size_t block = 64;
+	GLfloat best[block], bestAny[block];
+	GLuint idx[block], idxAny[block];
+	
+	for (size_t b = f0; b < f1; b += block){
+		size_t n = min(block, f1 - b);
+		const GLfloat *nx = &he.mNX[b];
+		const GLfloat *ny = &he.mNY[b];
+		const GLfloat *nz = &he.mNZ[b];
+		
+		for (size_t k = 0; k < n; k++){
+			best[k] = bestAny[k] = -2.0f;
+			idx[k] = idxAny[k] = 0;
+		}
+		
+		for (size_t c = 0; c < nc; c++){
+			const uint8_t *seen = &(*visible)[c * nf + b];
+			for (size_t k = 0; k < n; k++){
+				GLfloat d = nx[k] * cx[c] + ny[k] * cy[c] + nz[k] * cz[c];
+				bool better = d > bestAny[k];
+				bestAny[k] = better ? d : bestAny[k];
+				idxAny[k] = better ? static_cast<GLuint>(c) : idxAny[k];
 				
-			}
-			
-			if (!bf) {
-				// Close the loop off
-				first->prev = current;
-				current->next = first;
-				mObj->mWE.push_back(f);
-			}else {
-				// Delete any added edges for this badly wound face
-				for (size_t i = 0; i < keys.size(); i++){
-					map< uint64_t, shared_ptr<WE_Edge> >::iterator pi = es.find(keys[i]);
-					es.erase (pi);      
-				}
+				better = seen[k] && d > best[k];
+				best[k] = better ? d : best[k];
+				idx[k] = better ? static_cast<GLuint>(c) : idx[k];
 			}
 		}
 		
+		for (size_t k = 0; k < n; k++)
+			he.mTex[b + k] = best[k] > -2.0f ? idx[k] : idxAny[k];
 	}
+}
+
+/*
+ * One voting pass - a face takes the most common camera across its neighbours, the lower
+ * index on a tie. Only cameras that can see the face count, and with none it keeps its own
+ */
+
+void LeedsMesh::_voteCameras(HalfEdgeMesh *mesh, std::vector<GLuint> *from, std::vector<GLuint> *to, std::vector<uint8_t> *visible, size_t f0, size_t f1) {
+	HalfEdgeMesh &he = *mesh;
+	const size_t nf = he.numFaces();
 	
-	cerr << "Leeds Winged Edge edges count: " << es.size() << endl;
-	cerr << "Leeds Winged Edge Face Count: " << mObj->mWE.size() << endl;
-	
-	// Recreate the normals using a bruteforce simple method
+	for (size_t f = f0; f < f1; f++){
+		GLuint l[3];
+		size_t n = 0;
 		
-	for (size_t i = 0; i < mObj->mWE.size(); ++i) {
-		
-		shared_ptr<WE_Face> sf = mObj->mWE[i];
-			
-		shared_ptr<WE_Vertex> v0 = sf->edge->v0;
-		shared_ptr<WE_Vertex> v1 = sf->edge->next->v0;
-		shared_ptr<WE_Vertex> v2 = sf->edge->next->next->v0;
+		for (uint32_t j = 0; j < 3; j++){
+			uint32_t t = he.twin(f * 3 + j);
+			if (t == HalfEdgeMesh::sNone)
+				continue;
+			GLuint c = (*from)[he.face(t)];
+			if ((*visible)[c * nf + f])
+				l[n++] = c;
+		}
 		
+		GLuint label = (*from)[f];
+		size_t votes = 0;
+		for (size_t j = 0; j < n; j++){
+			size_t c = 0;
+			for (size_t k = 0; k < n; k++)
+				c += l[k] == l[j];
+			if (c > votes || (c == votes && l[j] < label)) {
+				label = l[j];
+				votes = c;
+			}
+		}
+		(*to)[f] = label;
+	}
+}
+
+
+/*
+ * Blend weights per vertex over every camera that sees it, then the camera gains. A
+ * vertex is seen by a camera if any face round it is
+ */
+
+void LeedsMesh::generateBlend(MeshBuffer &b, std::vector<boost::shared_ptr<LeedsCam> >&cameras, std::vector<uint8_t> &visible) {
+	HalfEdgeMesh &he = b.mHE;
+	size_t nc = cameras.size();
+	size_t nv = he.numVertices();
 	
-		// Use Eigen for conversion as its part of PCL anyway
-		Eigen::Vector3d v(v0->x, v0->y, v0->z);
-		Eigen::Vector3d w(v1->x, v1->y, v1->z);
-		Eigen::Vector3d d(v2->x, v2->y, v2->z);
-		
-		Eigen::Vector3d n = (w - v).cross(w - d);
-		n.normalize();
+	posix_time::ptime start = posix_time::microsec_clock::universal_time();
 	
-		// These normals are effectively face normals and not interpolated "across" the surface
-		sf->nx = n.x();
-		sf->ny = n.y();
-		sf->nz = n.z();
+	vector<uint8_t> seen(nc * nv, 0);
+	parallelFor(0, nc, 1, boost::bind(&LeedsMesh::_seenVertices, this, &he, &visible, &seen, _1, _2));
+	
+	// Camera centres as x, y, z and valid runs. Without extrinsics there is no centre
+	vector<GLfloat> centres(nc * 4, 0.0f);
+	for (size_t i = 0; i < nc; i++){
+		CameraParameters &p = cameras[i]->getParams();
+		if (p.R.empty() || p.T.empty())
+			continue;
+		
+		cv::Mat r, t;
+		cv::Rodrigues(p.R, r);
+		r.convertTo(r, CV_64F);
+		p.T.convertTo(t, CV_64F);
+		cv::Mat c = -r.t() * t.reshape(1, 3);
+		
+		centres[i] = c.at<double>(0);
+		centres[nc + i] = c.at<double>(1);
+		centres[nc * 2 + i] = c.at<double>(2);
+		centres[nc * 3 + i] = 1.0f;
 	}
 	
-	generateTexIDs(cameras);
+	b.mBlend.assign(nv * sMaxBlend, 0.0f);
+	parallelFor(0, nv, 4096, boost::bind(&LeedsMesh::_blendWeights, this, &b, &centres, &seen, _1, _2));
+	
+	if (mObj->mConfig.textureGain)
+		generateGains(b, cameras, seen);
+	else
+		b.mGains.assign(nc * 3, 1.0f);
+	
+	posix_time::time_duration took = posix_time::microsec_clock::universal_time() - start;
+	cerr << "Leeds Mesh blend weights and gains took " << took.total_milliseconds() << "ms" << endl;
 }
 
+void LeedsMesh::_seenVertices(HalfEdgeMesh *mesh, std::vector<uint8_t> *visible, std::vector<uint8_t> *seen, size_t c0, size_t c1) {
+	HalfEdgeMesh &he = *mesh;
+	const size_t nf = he.numFaces();
+	const size_t nv = he.numVertices();
+	
+	for (size_t c = c0; c < c1; c++){
+		const uint8_t *vis = &(*visible)[c * nf];
+		uint8_t *s = &(*seen)[c * nv];
+		for (size_t f = 0; f < nf; f++){
+			if (vis[f])
+				s[he.vertex(f, 0)] = s[he.vertex(f, 1)] = s[he.vertex(f, 2)] = 1;
+		}
+	}
+}
 
 /*
- * Generate the TexIDs for the Winged Edge
+ * Each camera gets cos squared of its view angle over its distance squared, so square on
+ * and close wins. Squaring the cosine means the normal's winding does not matter - the
+ * depth maps have already thrown out the cameras looking at the back. Vertices no camera
+ * sees take the camera of a face round them
  */
 
-void LeedsMesh::generateTexIDs(std::vector<boost::shared_ptr<LeedsCam> >&cameras) {
-	vector<Eigen::Vector3d> normals;
+void LeedsMesh::_blendWeights(MeshBuffer *b, std::vector<GLfloat> *centres, std::vector<uint8_t> *seen, size_t v0, size_t v1) {
+	HalfEdgeMesh &he = b->mHE;
+	const size_t nc = centres->size() / 4;
+	const size_t n = min(nc, sMaxBlend);
+	const size_t nv = he.numVertices();
+	const GLfloat *cx = &(*centres)[0];
+	const GLfloat *cy = cx + nc;
+	const GLfloat *cz = cy + nc;
+	const GLfloat *cv = cz + nc;
 	
-	for (int i =0; i < cameras.size(); i ++){
-		boost::shared_ptr<LeedsCam> cam = cameras[i];
-		cv::Mat n = cam->getNormal();
-		Eigen::Vector3d nn (n.at<double_t>(0,0),n.at<double_t>(1,0),n.at<double_t>(2,0));
-		nn.normalize();
-		normals.push_back(nn);
+	for (size_t v = v0; v < v1; v++){
+		GLfloat *w = &b->mBlend[v * sMaxBlend];
+		GLfloat total = 0.0f;
+		
+		for (size_t c = 0; c < n; c++){
+			GLfloat dx = cx[c] - he.mX[v], dy = cy[c] - he.mY[v], dz = cz[c] - he.mZ[v];
+			GLfloat d2 = dx * dx + dy * dy + dz * dz;
+			GLfloat facing = dx * he.mVNX[v] + dy * he.mVNY[v] + dz * he.mVNZ[v];	// |d| cos
+			bool use = cv[c] > 0.0f && d2 > 0.0f && (*seen)[c * nv + v];
+			w[c] = use ? facing * facing / (d2 * d2) : 0.0f;
+			total += w[c];
+		}
+		
+		if (total <= 0.0f) {
+			uint32_t e = he.outgoing(v);
+			GLuint c = e == HalfEdgeMesh::sNone ? 0 : he.mTex[he.face(e)];
+			if (c < n)
+				w[c] = 1.0f;
+			continue;
+		}
+		
+		GLfloat kept = 0.0f;
+		for (size_t c = 0; c < n; c++){
+			w[c] = w[c] >= total * sBlendCutoff ? w[c] : 0.0f;
+			kept += w[c];
+		}
+		for (size_t c = 0; c < n; c++)
+			w[c] /= kept;
 	}
+}
+
+/*
+ * Overlap of two cameras' masks, and each one's colour summed over it. Four samples at a
+ * time with SSE, any left over one by one
+ */
+
+static void maskedSums(const GLfloat *mi, const GLfloat *mj, const GLfloat *ci, const GLfloat *cj, size_t ns, GLfloat &n, GLfloat &si, GLfloat &sj) {
+	size_t s = 0;
+	n = si = sj = 0.0f;
+	
+#ifdef __SSE__
+	__m128 n4 = _mm_setzero_ps(), si4 = _mm_setzero_ps(), sj4 = _mm_setzero_ps();
+	for (; s + 4 <= ns; s += 4){
+		__m128 m = _mm_mul_ps(_mm_loadu_ps(mi + s), _mm_loadu_ps(mj + s));
+		n4 = _mm_add_ps(n4, m);
+		si4 = _mm_add_ps(si4, _mm_mul_ps(m, _mm_loadu_ps(ci + s)));
+		sj4 = _mm_add_ps(sj4, _mm_mul_ps(m, _mm_loadu_ps(cj + s)));
+	}
+	
+	GLfloat l[4];
+	_mm_storeu_ps(l, n4);
+	n = (l[0] + l[1]) + (l[2] + l[3]);
+	_mm_storeu_ps(l, si4);
+	si = (l[0] + l[1]) + (l[2] + l[3]);
+	_mm_storeu_ps(l, sj4);
+	sj = (l[0] + l[1]) + (l[2] + l[3]);
+#endif
+	
+	for (; s < ns; s++){
+		GLfloat m = mi[s] * mj[s];
+		n += m;
+		si += m * ci[s];
+		sj += m * cj[s];
+	}
+}
+
+/*
+ * Gain per camera and channel from the colours where the cameras overlap, as in Brown and
+ * Lowe's panorama gain compensation - pull overlapping colours together while keeping each
+ * gain near one. Only a spread of vertices is sampled as the means settle quickly.
+ * Setting the derivative of their error to zero gives, for each camera i,
+ *   sum_j N_ij (2 I_ij (g_i I_ij - g_j I_ji) / noise + (g_i - 1) / spread) = 0
+ * the 2 coming from each pair appearing in the error both ways round
+ */
+
+void LeedsMesh::generateGains(MeshBuffer &buffer, std::vector<boost::shared_ptr<LeedsCam> >&cameras, std::vector<uint8_t> &seen) {
+	HalfEdgeMesh &he = buffer.mHE;
+	size_t nc = cameras.size();
+	size_t nv = he.numVertices();
+	
+	buffer.mGains.assign(nc * 3, 1.0f);
+	if (nc < 2 || nv == 0)
+		return;
+	
+	vector<uint32_t> samples;
+	size_t step = max(static_cast<size_t>(1), nv / sGainSamples);
+	for (size_t v = 0; v < nv; v += step)
+		samples.push_back(v);
+	size_t ns = samples.size();
+	
+	// Colours as one run per camera and channel, with a 0 or 1 mask per camera
+	vector<GLfloat> colours(nc * 3 * ns, 0.0f);
+	vector<GLfloat> mask(nc * ns, 0.0f);
+	parallelFor(0, nc, 1, boost::bind(&LeedsMesh::_sampleCameras, this, &he, &cameras, &samples, &seen, &colours, &mask, _1, _2));
 	
-	for (size_t i = 0; i < mObj->mWE.size(); ++i) {
+	const double noise = 10.0 * 10.0;	// Colour difference, squared, we expect anyway
+	const double spread = 0.1 * 0.1;		// How far a gain may wander from one, squared
+	
+	for (size_t k = 0; k < 3; k++){
+		cv::Mat A = cv::Mat::zeros(nc, nc, CV_64F);
+		cv::Mat b = cv::Mat::zeros(nc, 1, CV_64F);
 		
-		shared_ptr<WE_Face> sf = mObj->mWE[i];
-			
-		Eigen::Vector3d p(sf->nx,sf->ny,sf->nz);
+		for (size_t i = 0; i < nc; i++){
+			for (size_t j = 0; j < nc; j++){
+				if (i == j)
+					continue;
 				
-		float range = 3.0;
-		GLuint idx = 0;
-		for (GLuint j=0; j < normals.size(); j++){
-			
-			Eigen::Vector3d nn = normals[j];
+				GLfloat n, si, sj;
+				maskedSums(&mask[i * ns], &mask[j * ns], &colours[(i * 3 + k) * ns], &colours[(j * 3 + k) * ns], ns, n, si, sj);
+				if (n < 1.0f)
+					continue;
 				
-			float angle =  acosf(p.dot(nn)) ;
-			if (fabs(angle) < range){
-				idx = j;
-				range = fabs(angle);
+				double Iij = si / n, Iji = sj / n;
+				A.at<double>(i, i) += n * (2.0 * Iij * Iij / noise + 1.0 / spread);
+				A.at<double>(i, j) -= n * 2.0 * Iij * Iji / noise;
+				b.at<double>(i) += n / spread;
+			}
+		}
+		
+		// Cameras that overlap nothing stay as they are
+		for (size_t i = 0; i < nc; i++){
+			if (A.at<double>(i, i) == 0.0) {
+				A.at<double>(i, i) = 1.0;
+				b.at<double>(i) = 1.0;
 			}
 		}
-		sf->t = idx;
+		
+		cv::Mat g;
+		if (!cv::solve(A, b, g, cv::DECOMP_LU))
+			continue;
+		for (size_t i = 0; i < nc; i++)
+			buffer.mGains[i * 3 + k] = min(max(g.at<double>(i), 0.5), 2.0);
 	}
 	
-	// Now we have texids - check winged edge for these we need to change
-	// Assume a maximum choice of 8 textures
+	for (size_t i = 0; i < nc; i++)
+		cerr << "Leeds - Camera " << i << " gain " << buffer.mGains[i * 3] << ", " << buffer.mGains[i * 3 + 1] << ", " << buffer.mGains[i * 3 + 2] << endl;
+}
+
+/*
+ * Colour of each sampled vertex in a range of cameras. Clipped pixels say nothing about
+ * the gain so they are left out
+ */
+
+void LeedsMesh::_sampleCameras(HalfEdgeMesh *mesh, std::vector<boost::shared_ptr<LeedsCam> > *cameras, std::vector<uint32_t> *samples, std::vector<uint8_t> *seen, std::vector<GLfloat> *colours, std::vector<GLfloat> *mask, size_t c0, size_t c1) {
+	HalfEdgeMesh &he = *mesh;
+	const size_t ns = samples->size();
+	const size_t nv = he.numVertices();
 	
-	for (size_t i = 0; i < mObj->mWE.size(); ++i) {	
-		shared_ptr<WE_Face> sf = mObj->mWE[i];
+	for (size_t c = c0; c < c1; c++){
+		CameraParameters &p = (*cameras)[c]->getParams();
+		SharedFrame frame = (*cameras)[c]->getFrame();
+		cv::Mat image = frame ? frame->getImage() : (*cameras)[c]->getImage();
+		if (p.R.empty() || p.T.empty() || image.empty())
+			continue;
 		
-		int counts[] = {0,0,0,0,0,0,0,0};
+		vector<cv::Point3f> points(ns);
+		for (size_t s = 0; s < ns; s++){
+			uint32_t v = (*samples)[s];
+			points[s] = cv::Point3f(he.mX[v], he.mY[v], he.mZ[v]);
+		}
 		
-		if (sf->edge->sym != boost::shared_ptr<WE_Edge>()) counts[sf->edge->sym->face->t]+=1;
-		if (sf->edge->next->sym != boost::shared_ptr<WE_Edge>()) counts[sf->edge->next->sym->face->t]+=1;
-		if (sf->edge->next->next->sym != boost::shared_ptr<WE_Edge>()) counts[sf->edge->next->next->sym->face->t]+=1;
+		vector<cv::Point2f> projected;
+		cv::projectPoints(points, p.R, p.T, p.M, p.D, projected);
 		
-		int tc = 0;
-		for (size_t j=0; j < 8; j++){
-			if (counts[j] > tc){
-				sf->t = j;
-				tc = counts[j];
-			}
+		GLfloat *r = &(*colours)[c * 3 * ns];
+		GLfloat *g = r + ns;
+		GLfloat *b = g + ns;
+		GLfloat *m = &(*mask)[c * ns];
+		
+		for (size_t s = 0; s < ns; s++){
+			if (!(*seen)[c * nv + (*samples)[s]])
+				continue;
+			int x = cvRound(projected[s].x), y = cvRound(projected[s].y);
+			if (x < 0 || y < 0 || x >= image.cols || y >= image.rows)
+				continue;
+			
+			cv::Vec3b px = image.at<cv::Vec3b>(y, x);
+			bool clipped = px[0] >= 250 || px[1] >= 250 || px[2] >= 250 || (px[0] <= 5 && px[1] <= 5 && px[2] <= 5);
+			if (clipped)
+				continue;
+			
+			r[s] = px[0];
+			g[s] = px[1];
+			b[s] = px[2];
+			m[s] = 1.0f;
 		}
 	}
 }
 
 
 /*
- * Update mesh if needed, if any values have changed
+ * Mesh the cloud as a background job on the shared pool. The job gets its own copy of the
+ * cloud so scanning and drawing the points carry on while it runs, and any job already
+ * running is cancelled. If no points were added since the last job the copy is reused,
+ * with its voxel grid, its filtered points and the index over them.
+ * With an export base the mesh is also saved as base.stl and base.obj once it is built
  */
 
-void LeedsMesh::generate(std::vector<boost::shared_ptr<LeedsCam> >&cameras) {
+void LeedsMesh::generate(std::vector<boost::shared_ptr<LeedsCam> >&cameras, std::string exportBase) {
+	if (mObj->pCloud->points.size() <= 3)
+		return;
 	
-	if (mObj->pCloud->points.size() > 3){
+	cancel();
+	
+	size_t job;
+	pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+		if (mObj->mUpdate || !mObj->pJobCloud) {
+			mObj->pJobCloud.reset(new pcl::PointCloud<pcl::PointXYZ>(*(mObj->pCloud)));
+			mObj->pJobReduced.reset();
+			mObj->pJobFiltered.reset();
+			mObj->pJobIndex.reset();
+			mObj->mUpdate = false;
+		}
+		cloud = mObj->pJobCloud;
 		
+		job = ++mObj->mJobId;
+		mObj->mRunning = true;
+		mObj->mStage = MESH_IDLE;
+	}
+	
+	// Bound to a copy of this mesh so the shared object outlives a job that was let go
+	mObj->mJob = ThreadPool::get().submit(boost::bind(&LeedsMesh::_generate, *this, job, cloud, cameras, exportBase));
+}
+
+/*
+ * Let go of the job without waiting for it. It stops at the end of the stage it is in, or
+ * as soon as a worker picks it up, and what it built is thrown away. Only the newest job
+ * ever hands a mesh over
+ */
+
+void LeedsMesh::cancel() {
+	if (!mObj)
+		return;
+	
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+		if (!mObj->mRunning)
+			return;
+		mObj->mJobId++;
+		mObj->mRunning = false;
+		mObj->mStage = MESH_IDLE;
+	}
+	
+	// Kept so stop can wait on it. Any that have stopped already are let go of here
+	size_t kept = 0;
+	for (size_t i = 0; i < mObj->mLetGo.size(); i++){
+		if (!mObj->mLetGo[i]->ready())
+			mObj->mLetGo[kept++] = mObj->mLetGo[i];
+	}
+	mObj->mLetGo.resize(kept);
+	if (mObj->mJob)
+		mObj->mLetGo.push_back(mObj->mJob);
+	
+	mObj->mJob.reset();
+	cerr << "Leeds - Meshing cancelled" << endl;
+}
+
+/*
+ * Cancel, then wait for the current job and any let go of before it. Jobs part way through
+ * texturing or exporting still read the cameras, so this comes before they are shut down
+ */
+
+void LeedsMesh::stop() {
+	if (!mObj)
+		return;
+	
+	cancel();
+	
+	for (size_t i = 0; i < mObj->mLetGo.size(); i++){
 		try {
-		// Statistical removal
-			pcl::StatisticalOutlierRemoval<pcl::PointXYZ> sor;
-			sor.setInputCloud (mObj->pCloud);
-			sor.setMeanK (mObj->mConfig.pclFilterMeanK);
-			sor.setStddevMulThresh (mObj->mConfig.pclFilterThresh);
-			sor.filter (*(mObj->pCloudFiltered));
-			
-			// now setup the points VBO for filtered points
-			
-			mObj->mPointsFilteredVBO.mVertices.clear();
-			for (pcl::PointCloud<pcl::PointXYZ>::iterator it = mObj->pCloudFiltered->begin(); it != mObj->pCloudFiltered->end(); it++){
-				mObj->mPointsFilteredVBO.mVertices.push_back( it->x);
-				mObj->mPointsFilteredVBO.mVertices.push_back( it->y);
-				mObj->mPointsFilteredVBO.mVertices.push_back( it->z);
+			mObj->mLetGo[i]->wait();
+		}
+		catch (std::exception &e) {
+			cerr << "Leeds - Meshing failed: " << e.what() << endl;
+		}
+	}
+	mObj->mLetGo.clear();
+}
+
+/*
+ * Stage the job is at, for the status bar
+ */
+
+std::string LeedsMesh::getProgress() {
+	if (!mObj)
+		return "";
+	
+	boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+	if (!mObj->mRunning)
+		return "";
+	
+	std::ostringstream s;
+	s << "Meshing - " << sStageNames[mObj->mStage] << " (" << mObj->mStage << "/" << MESH_DONE - 1 << ")";
+	return s.str();
+}
+
+/*
+ * Move the job on to the next stage, unless a newer job or a cancel has replaced it
+ */
+
+bool LeedsMesh::_stage(size_t job, MeshStage stage) {
+	boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+	if (job != mObj->mJobId)
+		return false;
+	
+	mObj->mStage = stage;
+	cerr << "Leeds - Meshing: " << sStageNames[stage] << endl;
+	return true;
+}
+
+/*
+ * The job thread. It builds into a buffer of its own, so a job that was let go never
+ * touches the one that replaced it. A finished mesh is handed over for upload if the
+ * job is still the current one
+ */
+
+void LeedsMesh::_generate(size_t job, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<boost::shared_ptr<LeedsCam> > cameras, std::string exportBase) {
+	posix_time::ptime start = posix_time::microsec_clock::universal_time();
+	SharedBuffer buffer(new MeshBuffer());
+	bool built = _build(job, *buffer, cloud, cameras, exportBase);
+	posix_time::time_duration took = posix_time::microsec_clock::universal_time() - start;
+	
+	boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+	if (job != mObj->mJobId)
+		return;
+	
+	if (built) {
+		mObj->pReady = buffer;
+		cerr << "Leeds - Meshing finished in " << took.total_milliseconds() << "ms" << endl;
+	}
+	else
+		cerr << "Leeds - Meshing failed" << endl;
+	
+	mObj->mStage = MESH_DONE;
+	mObj->mRunning = false;
+}
+
+/*
+ * Every stage of the mesh, into the job's buffer. No GL calls in here
+ */
+
+bool LeedsMesh::_build(size_t job, MeshBuffer &b, pcl::PointCloud<pcl::PointXYZ>::Ptr cloud, std::vector<boost::shared_ptr<LeedsCam> > &cameras, std::string &exportBase) {
+	try {
+		// Voxel grid - repeated and overlapping scans pile points up, and every stage after
+		// this pays for each one
+		if (!_stage(job, MESH_REDUCE))
+			return false;
+		
+		PointCloud<PointXYZ>::Ptr source = cloud;
+		PointCloud<PointXYZ>::Ptr reduced, filtered;
+		CloudIndex::Ptr index;
+		{
+			boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+			if (mObj->pJobCloud == source) {
+				reduced = mObj->pJobReduced;
+				filtered = mObj->pJobFiltered;
+				index = mObj->pJobIndex;
 			}
-			mObj->mPointsFilteredVBO.compile(VBO_VERT);
-			
-			
-			MovingLeastSquaresOMP<PointXYZ, PointXYZ> mls;
-			mls.setNumberOfThreads(6);
-			mls.setInputCloud (mObj->pCloudFiltered);
-			mls.setSearchRadius (mObj->mConfig.pclSearchRadius);
-			mls.setPolynomialFit (true);
-			mls.setPolynomialOrder (mObj->mConfig.pclPolynomialOrder);
-			mls.setUpsamplingMethod (MovingLeastSquares<PointXYZ, PointXYZ>::SAMPLE_LOCAL_PLANE);
-			mls.setUpsamplingRadius (mObj->mConfig.pclUpsamplingRadius);
-			mls.setUpsamplingStepSize (mObj->mConfig.pclUpsamplingStepSize);
-			PointCloud<PointXYZ>::Ptr cloud_smoothed (new PointCloud<PointXYZ> ());
-			mls.process (*cloud_smoothed);
-			
-			cout << "Leeds - Cloud smoothed: " << cloud_smoothed->size() << endl;
-			
-			NormalEstimationOMP<PointXYZ, Normal> ne;
-			ne.setNumberOfThreads (8);
-			ne.setInputCloud (cloud_smoothed);
-			ne.setRadiusSearch (0.01);
-			
-			Eigen::Vector4f centroid;
-			compute3DCentroid (*cloud_smoothed, centroid);
-			ne.setViewPoint (centroid[0], centroid[1], centroid[2]);
-			PointCloud<Normal>::Ptr cloud_normals (new PointCloud<Normal> ());
-			ne.compute (*cloud_normals);
-				
-			
-			cout << "Leeds Centroid: " << centroid << endl;
-			
-			cout << "Leeds Normals Smoothed: " << cloud_normals->size() << endl;
+		}
 		
-	/*		for (size_t i = 0; i < cloud_normals->size (); ++i) {
-				cloud_normals->points[i].normal_x *= -1;
-				cloud_normals->points[i].normal_y *= -1;
-				cloud_normals->points[i].normal_z *= -1;
-			}*/
-			
-			PointCloud<PointNormal>::Ptr cloud_smoothed_normals (new PointCloud<PointNormal> ());
-			concatenateFields (*cloud_smoothed, *cloud_normals, *cloud_smoothed_normals);
+		if (!reduced) {
+			if (mObj->mConfig.pclVoxelSize > 0.0f) {
+				reduced.reset(new PointCloud<PointXYZ> ());
+				CloudVoxels voxels(mObj->mConfig.pclVoxelSize);
+				voxels.filter(*cloud, *reduced);
+			}
+			else
+				reduced = cloud;
 			
-			// Setup the computed normals VBO
-			mObj->mComputedNormalsVBO.mVertices.clear();
-			for (size_t i = 0; i < cloud_smoothed_normals->size (); ++i) {
-				
-				mObj->mComputedNormalsVBO.mVertices.push_back( cloud_smoothed_normals->points[i].x);
-				mObj->mComputedNormalsVBO.mVertices.push_back( cloud_smoothed_normals->points[i].y);
-				mObj->mComputedNormalsVBO.mVertices.push_back( cloud_smoothed_normals->points[i].z);
-				
-				mObj->mComputedNormalsVBO.mColours.push_back(0.0);
-				mObj->mComputedNormalsVBO.mColours.push_back(1.0);
-				mObj->mComputedNormalsVBO.mColours.push_back(0.0);
-				mObj->mComputedNormalsVBO.mColours.push_back(1.0);
-				
-				mObj->mComputedNormalsVBO.mVertices.push_back( cloud_smoothed_normals->points[i].x + cloud_smoothed_normals->points[i].normal_x);
-				mObj->mComputedNormalsVBO.mVertices.push_back( cloud_smoothed_normals->points[i].y + cloud_smoothed_normals->points[i].normal_y );
-				mObj->mComputedNormalsVBO.mVertices.push_back( cloud_smoothed_normals->points[i].z + cloud_smoothed_normals->points[i].normal_z);
+			// Kept for the next job unless the points have changed since
+			boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+			if (mObj->pJobCloud == source)
+				mObj->pJobReduced = reduced;
+		}
+		cloud = reduced;
+		
+		// Statistical removal, or a neighbour count inside a radius if one is set
+		if (!_stage(job, MESH_FILTER))
+			return false;
+		
+		if (!filtered) {
+			filtered.reset(new PointCloud<PointXYZ> ());
+			CloudOutliers sor;
+			sor.setMeanK (mObj->mConfig.pclFilterMeanK);
+			sor.setStddevMulThresh (mObj->mConfig.pclFilterThresh);
+			sor.setRadiusSearch (mObj->mConfig.pclFilterRadius, mObj->mConfig.pclFilterCount);
+			sor.filter (*cloud, *filtered);
 			
-				mObj->mComputedNormalsVBO.mColours.push_back(0.0);
-				mObj->mComputedNormalsVBO.mColours.push_back(0.0);
-				mObj->mComputedNormalsVBO.mColours.push_back(1.0);
-				mObj->mComputedNormalsVBO.mColours.push_back(1.0);
+			// Built here, before it is shared, so jobs only ever search it. PCL handing the
+			// same cloud over again finds it built and leaves it be
+			index.reset(new CloudIndex());
+			index->setInputCloud (filtered);
 			
+			// Kept with the reduced copy, so meshing the same points again skips both
+			boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+			if (mObj->pJobCloud == source) {
+				mObj->pJobFiltered = filtered;
+				mObj->pJobIndex = index;
 			}
-			mObj->mComputedNormalsVBO.compile(VBO_VERT | VBO_COLR);
-
-			pcl::Poisson<pcl::PointNormal> pp;
-			pp.setInputCloud(cloud_smoothed_normals);
-			pp.setDepth(mObj->mConfig.poissonDepth);
-			//pp.setOutputPolygons(true);
-			pp.setSamplesPerNode(mObj->mConfig.poissonSamples);
-			pp.setScale(mObj->mConfig.poissonScale);
-			pp.reconstruct (mObj->mTriangles);
-	
-		
 		}
-		catch(...) {
-			std::cerr << "Leeds - Exception in  generating mesh" << std::endl;
+		b.pCloudFiltered = filtered;
+		
+		if (!_stage(job, MESH_SMOOTH))
+			return false;
+		
+		// PCL runs these stages on OpenMP threads of its own. Only as many as the workers that
+		// are idle, plus this one which waits on them, so the cores are not taken twice
+		MovingLeastSquaresOMP<PointXYZ, PointXYZ> mls;
+		mls.setNumberOfThreads(ThreadPool::get().idle() + 1);
+		mls.setInputCloud (b.pCloudFiltered);
+		mls.setSearchMethod (index);
+		mls.setSearchRadius (mObj->mConfig.pclSearchRadius);
+		mls.setPolynomialFit (true);
+		mls.setPolynomialOrder (mObj->mConfig.pclPolynomialOrder);
+		mls.setUpsamplingMethod (MovingLeastSquares<PointXYZ, PointXYZ>::SAMPLE_LOCAL_PLANE);
+		mls.setUpsamplingRadius (mObj->mConfig.pclUpsamplingRadius);
+		mls.setUpsamplingStepSize (mObj->mConfig.pclUpsamplingStepSize);
+		PointCloud<PointXYZ>::Ptr cloud_smoothed (new PointCloud<PointXYZ> ());
+		mls.process (*cloud_smoothed);
+		
+		cout << "Leeds - Cloud smoothed: " << cloud_smoothed->size() << endl;
+		
+		if (!_stage(job, MESH_NORMALS))
+			return false;
+		
+		NormalEstimationOMP<PointXYZ, Normal> ne;
+		ne.setNumberOfThreads (ThreadPool::get().idle() + 1);
+		ne.setInputCloud (cloud_smoothed);
+		ne.setSearchMethod (CloudIndex::Ptr(new CloudIndex()));
+		ne.setRadiusSearch (0.01);
+		
+		Eigen::Vector4f centroid;
+		compute3DCentroid (*cloud_smoothed, centroid);
+		ne.setViewPoint (centroid[0], centroid[1], centroid[2]);
+		PointCloud<Normal>::Ptr cloud_normals (new PointCloud<Normal> ());
+		ne.compute (*cloud_normals);
+		
+		cout << "Leeds Centroid: " << centroid << endl;
+		
+		cout << "Leeds Normals Smoothed: " << cloud_normals->size() << endl;
+		
+		PointCloud<PointNormal>::Ptr cloud_smoothed_normals (new PointCloud<PointNormal> ());
+		concatenateFields (*cloud_smoothed, *cloud_normals, *cloud_smoothed_normals);
+		
+		// Line ends for the computed normals VBO, made into a VBO on upload
+		b.mNormalLines.reserve(cloud_smoothed_normals->size() * 6);
+		for (size_t i = 0; i < cloud_smoothed_normals->size (); ++i) {
+			PointNormal &p = cloud_smoothed_normals->points[i];
+			b.mNormalLines.push_back(p.x);
+			b.mNormalLines.push_back(p.y);
+			b.mNormalLines.push_back(p.z);
+			b.mNormalLines.push_back(p.x + p.normal_x);
+			b.mNormalLines.push_back(p.y + p.normal_y);
+			b.mNormalLines.push_back(p.z + p.normal_z);
 		}
 		
-		generateWinged(cameras);
-		generateMeshVBO(cameras);
+		if (!_stage(job, MESH_POISSON))
+			return false;
+		
+		pcl::Poisson<pcl::PointNormal> pp;
+		pp.setInputCloud(cloud_smoothed_normals);
+		pp.setDepth(mObj->mConfig.poissonDepth);
+		pp.setSamplesPerNode(mObj->mConfig.poissonSamples);
+		pp.setScale(mObj->mConfig.poissonScale);
+		pp.reconstruct (b.mTriangles);
+		
+		if (!_stage(job, MESH_HALFEDGE))
+			return false;
+		generateHalfEdge(b, cameras);
+		
+		if (!_stage(job, MESH_TEXTURE))
+			return false;
+		generateTexIDs(b, cameras);
+		
+		if (!exportBase.empty()) {
+			if (!_stage(job, MESH_EXPORT))
+				return false;
+			_saveMesh(b, exportBase + ".stl");
+			_saveTexturedMesh(b, exportBase + ".obj", cameras);
+		}
 	}
+	catch (std::exception &e) {
+		// Nothing is handed over, so the mesh on screen stays as it was
+		std::cerr << "Leeds - Exception in generating mesh: " << e.what() << std::endl;
+		return false;
+	}
+	catch(...) {
+		std::cerr << "Leeds - Exception in generating mesh" << std::endl;
+		return false;
+	}
+	
+	return true;
 }
 
+/*
+ * Swap a finished mesh to the front and make its VBOs. Call on the GL thread - this is
+ * the only part of a mesh job that touches GL. Returns true if there was a new mesh
+ */
+
+bool LeedsMesh::upload(std::vector<boost::shared_ptr<LeedsCam> >&cameras) {
+	SharedBuffer ready;
+	bool running;
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+		ready.swap(mObj->pReady);
+		running = mObj->mRunning;
+	}
+	
+	// The job has finished so let go of it
+	if (!running)
+		mObj->mJob.reset();
+	
+	if (!ready)
+		return false;
+	
+	mObj->pFront = ready;
+	
+	// Points VBO for the filtered points
+	mObj->mPointsFilteredVBO.mVertices.clear();
+	for (pcl::PointCloud<pcl::PointXYZ>::iterator it = ready->pCloudFiltered->begin(); it != ready->pCloudFiltered->end(); it++){
+		mObj->mPointsFilteredVBO.mVertices.push_back( it->x);
+		mObj->mPointsFilteredVBO.mVertices.push_back( it->y);
+		mObj->mPointsFilteredVBO.mVertices.push_back( it->z);
+	}
+	mObj->mPointsFilteredVBO.compile(VBO_VERT);
+	
+	// Computed normals VBO - green at the point, blue at the tip
+	mObj->mComputedNormalsVBO.mVertices = ready->mNormalLines;
+	mObj->mComputedNormalsVBO.mColours.clear();
+	for (size_t i = 0; i < ready->mNormalLines.size() / 6; ++i) {
+		GLfloat c[8] = {0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f};
+		mObj->mComputedNormalsVBO.mColours.insert(mObj->mComputedNormalsVBO.mColours.end(), c, c + 8);
+	}
+	mObj->mComputedNormalsVBO.compile(VBO_VERT | VBO_COLR);
+	
+	generateMeshVBO(cameras);
+	return true;
+}
 
 
 /*
- * Generates a mesh from the STL
+ * Generates a mesh from the STL. Quick enough to do in place, but it goes through the same
+ * buffers as a job so the mesh is swapped in the same way
  */
 
 void LeedsMesh::loadFromSTL(std::string filename, std::vector<boost::shared_ptr<LeedsCam> >&cameras) {
 
 	clearMesh();
 	
-	pcl::io::loadPolygonFileSTL ( filename, mObj->mTriangles);
-			
-	generateWinged(cameras, true);
-	generateMeshVBO(cameras);
+	SharedBuffer buffer(new MeshBuffer());
+	pcl::io::loadPolygonFileSTL ( filename, buffer->mTriangles);
 	
+	try {
+		generateHalfEdge(*buffer, cameras, true);
+		generateTexIDs(*buffer, cameras);
+	}
+	catch (std::exception &e) {
+		cerr << "Leeds - Could not load " << filename << ": " << e.what() << endl;
+		return;
+	}
+	
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+		mObj->pReady = buffer;
+	}
+	upload(cameras);
 }
 
 
@@ -608,7 +1175,31 @@ void LeedsMesh::saveToFile(std::string filename) {
  */
 
 void LeedsMesh::saveMeshToFile(std::string filename){
-	pcl::io::savePolygonFileSTL (filename, mObj->mTriangles);
+	_saveMesh(*(mObj->pFront), filename);
+}
+
+void LeedsMesh::_saveMesh(MeshBuffer &buffer, std::string filename){
+	pcl::io::savePolygonFileSTL (filename, buffer.mTriangles);
+}
+
+/*
+ * Bake the camera textures into an atlas and write an OBJ that uses it
+ */
+
+void LeedsMesh::saveTexturedMesh(std::string filename, std::vector<boost::shared_ptr<LeedsCam> >&cameras) {
+	_saveTexturedMesh(*(mObj->pFront), filename, cameras);
+}
+
+void LeedsMesh::_saveTexturedMesh(MeshBuffer &buffer, std::string filename, std::vector<boost::shared_ptr<LeedsCam> >&cameras) {
+	if (buffer.mHE.numFaces() == 0) {
+		cerr << "Leeds - No textured mesh to save" << endl;
+		return;
+	}
+	
+	AtlasBaker baker;
+	baker.setGains(buffer.mGains);
+	if (!baker.bake(buffer.mHE, cameras) || !baker.save(filename))
+		cerr << "Leeds - Failed to save textured mesh " << filename << endl;
 }
 
 /*
@@ -616,8 +1207,10 @@ void LeedsMesh::saveMeshToFile(std::string filename){
  */
 
 void LeedsMesh::clearMesh() {
+	cancel();
+	
 	mObj->pCloud->clear();
-	mObj->pCloudFiltered->clear();
+	mObj->mUpdate = true;
 	mObj->mNormals->clear();
 	mObj->mCloud_with_normals->clear();	
 	
@@ -635,11 +1228,15 @@ void LeedsMesh::clearMesh() {
 	mObj->mMeshVBO.mTexCoords.clear();
 	mObj->mMeshVBO.mIndices.clear();
 	mObj->mMeshVBO.vTexIDs.clear();
+	mObj->mMeshVBO.mBlend.clear();
 	mObj->mMeshVBO.mNumElements = 0;
 	mObj->mMeshVBO.mNumIndices = 0;
 	
-	// Clear the Winged Edge
-	mObj->mWE.clear();
+	// A fresh front buffer hands the half edges and weights back too
+	mObj->pFront.reset(new MeshBuffer());
+	
+	boost::lock_guard<boost::mutex> lock(mObj->mJobMutex);
+	mObj->pReady.reset();
 }
 
 /*
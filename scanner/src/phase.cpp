@@ -0,0 +1,154 @@
+/**
+* @brief Phase shifting decoder for fringe scans
+* @file phase.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 16/07/2012
+*
+*/
+
+#include "phase.hpp"
+
+using namespace std;
+using namespace cv;
+
+static const size_t sBandRows = 32; // Rows per tile handed to each thread
+
+
+/*
+ * Decode all the frames for one camera. Tiles of rows are decoded in parallel
+ */
+
+void PhaseDecoder::decode(std::vector<cv::Mat> &frames, cv::Mat &map, cv::Mat &mask, cv::Mat &modulation) {
+	
+	if (frames.size() != numFrames() || frames.size() == 0) {
+		cerr << "Leeds - Phase decoder expected " << numFrames() << " frames but got " << frames.size() << endl;
+		return;
+	}
+	
+	Size size = frames[0].size();
+	map.create(size, CV_32FC2);
+	mask.create(size, CV_8UC1);
+	modulation.create(size, CV_32FC1);
+	
+	parallelFor(0, size.height, sBandRows,
+		boost::bind(&PhaseDecoder::decodeBand, this, &frames, &map, &mask, &modulation, _1, _2));
+}
+
+
+/*
+ * Decode a band of rows for both axes and merge into the map and mask
+ */
+
+void PhaseDecoder::decodeBand(std::vector<cv::Mat> *frames, cv::Mat *map, cv::Mat *mask, cv::Mat *modulation, size_t r0, size_t r1) {
+	Range rows(r0,r1);
+	Mat u, v, mu, mv;
+	
+	decodeAxis(*frames, 0, rows, u, mu);
+	decodeAxis(*frames, 1, rows, v, mv);
+	
+	// Confidence is the weaker of the two axes
+	Mat mod = min(mu, mv);
+	mod.copyTo(modulation->rowRange(rows));
+	
+	Mat m = mod > mMinModulation;
+	m &= (u >= 0) & (u < mProjector.width) & (v >= 0) & (v < mProjector.height);
+	m.copyTo(mask->rowRange(rows));
+	
+	Mat planes[] = {u, v};
+	Mat band = map->rowRange(rows);
+	merge(planes, 2, band);
+}
+
+
+/*
+ * Wrapped phase per frequency via atan2, then temporal unwrapping from the coarsest frequency up
+ * With I_n = A + B cos(phi + 2 pi n / N), phi = atan2(-sum I_n sin, sum I_n cos)
+ */
+
+void PhaseDecoder::decodeAxis(std::vector<cv::Mat> &frames, size_t axis, cv::Range rows, cv::Mat &coord, cv::Mat &modulation) {
+	
+	size_t base = axis * mFrequencies.size() * mSteps;
+	Size size(frames[0].cols, rows.end - rows.start);
+	
+	Mat unwrapped;
+	Mat I, S, C, phi, t, ti;
+	
+	for (size_t k = 0; k < mFrequencies.size(); k++){
+		
+		S = Mat::zeros(size, CV_32FC1);
+		C = Mat::zeros(size, CV_32FC1);
+		
+		for (int n = 0; n < mSteps; n++){
+			double delta = 2.0 * M_PI * n / mSteps;
+			frames[base + k * mSteps + n].rowRange(rows).convertTo(I, CV_32F);
+			scaleAdd(I, sin(delta), S, S);
+			scaleAdd(I, cos(delta), C, C);
+		}
+		
+		// cv::phase gives atan2 in [0, 2pi) and is vectorised
+		phase(C, -S, phi);
+		
+		if (k == 0) {
+			unwrapped = phi.clone();
+		}
+		else {
+			// Predict from the coarser frequency and snap to the nearest period
+			double ratio = static_cast<double>(mFrequencies[k]) / mFrequencies[k-1];
+			t = (unwrapped * ratio - phi) * (1.0 / (2.0 * M_PI));
+			t.convertTo(ti, CV_32S);	// rounds to nearest
+			ti.convertTo(t, CV_32F);
+			Mat next = phi + t * (2.0 * M_PI);
+			unwrapped = next;
+		}
+		
+		// Modulation from the finest frequency - that is the one we trust for position
+		if (k == mFrequencies.size() - 1) {
+			magnitude(C, S, modulation);
+			modulation *= 2.0 / mSteps;
+		}
+	}
+	
+	int extent = axis == 0 ? mProjector.width : mProjector.height;
+	coord = unwrapped * (extent / (2.0 * M_PI * mFrequencies.back()));
+}
+
+
+/*
+ * Bin camera pixels into projector cells. Each cell holds the mean camera pixel that saw it,
+ * so any two cameras sharing a cell give a correspondence for solveForAll
+ */
+
+void PhaseDecoder::accumulate(cv::Mat &map, cv::Mat &mask, int pitch, cv::Mat &cells) {
+	
+	Size cs ( (mProjector.width + pitch - 1) / pitch, (mProjector.height + pitch - 1) / pitch);
+	cells = Mat::zeros(cs, CV_32FC3);
+	
+	float ip = 1.0f / pitch;
+	
+	for (int y = 0; y < map.rows; y++){
+		const Vec2f *mp = map.ptr<Vec2f>(y);
+		const uint8_t *kp = mask.ptr<uint8_t>(y);
+		
+		for (int x = 0; x < map.cols; x++){
+			if (!kp[x])
+				continue;
+			
+			int cx = static_cast<int>(mp[x][0] * ip);
+			int cy = static_cast<int>(mp[x][1] * ip);
+			Vec3f &c = cells.at<Vec3f>(cy,cx);
+			c[0] += x;
+			c[1] += y;
+			c[2] += 1.0f;
+		}
+	}
+	
+	for (int y = 0; y < cells.rows; y++){
+		Vec3f *cp = cells.ptr<Vec3f>(y);
+		for (int x = 0; x < cells.cols; x++){
+			if (cp[x][2] > 0){
+				cp[x][0] /= cp[x][2];
+				cp[x][1] /= cp[x][2];
+			}
+		}
+	}
+}
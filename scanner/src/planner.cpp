@@ -0,0 +1,136 @@
+/**
+* @brief Coarse to fine planning of projector positions for dot scanning
+* @file planner.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 23/07/2012
+*
+*/
+
+#include "planner.hpp"
+
+using namespace std;
+using namespace cv;
+
+enum {
+	CELL_UNTOUCHED = 0,
+	CELL_QUEUED,
+	CELL_MISSED,
+	CELL_HIT
+};
+
+
+/*
+ * Work on a grid of fine cells and seed the queue with the coarse pass
+ */
+
+ScanPlanner::ScanPlanner(cv::Size projector, int coarse, int fine, float jump) {
+	mFine = fine < 1 ? 1 : fine;
+	mJump = jump;
+	mSeq = 0;
+	mVisitedCount = 0;
+	mHitCount = 0;
+	
+	Size grid ( (projector.width + mFine - 1) / mFine, (projector.height + mFine - 1) / mFine);
+	mVisited = Mat::zeros(grid, CV_8U);
+	mPoints = Mat::zeros(grid, CV_32FC3);
+	
+	int pitch = coarse / mFine;
+	pitch = pitch < 1 ? 1 : pitch;
+	
+	for (int y = pitch / 2; y < grid.height; y += pitch){
+		for (int x = pitch / 2; x < grid.width; x += pitch)
+			push(Point(x,y), pitch, false);
+	}
+	
+	mCurrent.pitch = 0;
+}
+
+/*
+ * Coarser pitches always come first so the whole field is covered before any refinement
+ */
+
+void ScanPlanner::push(cv::Point p, int pitch, bool edge) {
+	if (p.x < 0 || p.y < 0 || p.x >= mVisited.cols || p.y >= mVisited.rows)
+		return;
+	
+	uint8_t &v = mVisited.at<uint8_t>(p);
+	if (v != CELL_UNTOUCHED)
+		return;
+	v = CELL_QUEUED;
+	
+	Cell c;
+	c.p = p;
+	c.pitch = pitch;
+	c.priority = pitch * 2 + (edge ? 1 : 0);
+	c.seq = mSeq++;
+	mQueue.push(c);
+}
+
+/*
+ * Pop the next position in projector pixels
+ */
+
+bool ScanPlanner::next(cv::Point &p) {
+	if (mQueue.empty())
+		return false;
+	
+	mCurrent = mQueue.top();
+	mQueue.pop();
+	
+	p = Point(mCurrent.p.x * mFine, mCurrent.p.y * mFine);
+	return true;
+}
+
+/*
+ * Does this point jump away from any hit within a pitch of it?
+ */
+
+bool ScanPlanner::discontinuity(cv::Point p, int pitch, cv::Point3f &point) {
+	for (int y = p.y - pitch; y <= p.y + pitch; y += pitch){
+		for (int x = p.x - pitch; x <= p.x + pitch; x += pitch){
+			if (x < 0 || y < 0 || x >= mVisited.cols || y >= mVisited.rows)
+				continue;
+			if (mVisited.at<uint8_t>(y,x) != CELL_HIT || (x == p.x && y == p.y))
+				continue;
+			
+			Vec3f o = mPoints.at<Vec3f>(y,x);
+			Point3f d = point - Point3f(o[0],o[1],o[2]);
+			if (d.dot(d) > mJump * mJump)
+				return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Record the result and queue the half pitch neighbourhood around a hit
+ * Hits next to misses refine towards them, so the silhouette gets the fine pitch too
+ */
+
+void ScanPlanner::report(bool hit, cv::Point3f point) {
+	if (mCurrent.pitch == 0)
+		return;
+	
+	Point c = mCurrent.p;
+	mVisitedCount++;
+	
+	if (!hit) {
+		mVisited.at<uint8_t>(c) = CELL_MISSED;
+		return;
+	}
+	
+	mHitCount++;
+	mVisited.at<uint8_t>(c) = CELL_HIT;
+	mPoints.at<Vec3f>(c) = Vec3f(point.x, point.y, point.z);
+	
+	if (mCurrent.pitch <= 1)
+		return;
+	
+	bool edge = discontinuity(c, mCurrent.pitch, point);
+	int half = mCurrent.pitch / 2;
+	
+	for (int dy = -1; dy <= 1; dy++){
+		for (int dx = -1; dx <= 1; dx++)
+			push(Point(c.x + dx * half, c.y + dy * half), half, edge);
+	}
+}
@@ -8,6 +8,8 @@
 
 #include "projector_window.hpp"
 
+#include <math.h>
+
 /*
  * Projector Windows
  */
@@ -27,31 +29,239 @@ ProjectorWindow::ProjectorWindow(QWidget *parent ) :  QWidget(parent) {
     mSize = 5;
 	mPoint.setX(0);
 	mPoint.setY(0);
+	mMoved = boost::posix_time::microsec_clock::universal_time();
+	
+	mMode = PROJECT_POINT;
+	mSteps = 4;
+	mFringe = 0;
+	mFringeDirty = true;
+	mLine = 0;
+	mDotCols = 1;
+	mDotRows = 1;
 }
 
 void ProjectorWindow::paintEvent(QPaintEvent *event){
 	QPainter painter(this);
-	painter.setPen(QPen(Qt::white, mSize));
-	painter.drawPoints(&mPoint,1);
+	
+	switch(mMode){
+		case PROJECT_FRINGE:
+			if (mFringeDirty || mFringeImage.width() != width() || mFringeImage.height() != height())
+				generateFringe();
+			painter.drawImage(0,0,mFringeImage);
+			break;
+			
+		case PROJECT_LINE:
+			painter.setPen(QPen(Qt::white, 1));
+			painter.drawLine(mLine, 0, mLine, height());
+			break;
+			
+		case PROJECT_DOTS: {
+			std::vector<QPoint> dots;
+			std::vector<int> codes;
+			getDots(dots, codes);
+			for (size_t i = 0; i < dots.size(); i++){
+				painter.setPen(QPen(dotColour(codes[i]), mSize));
+				painter.drawPoint(dots[i]);
+			}
+			break;
+		}
+			
+		case PROJECT_POINT:
+		case PROJECT_PLANNED:
+		default:
+			painter.setPen(QPen(Qt::white, mSize));
+			painter.drawPoint(getPoint());
+			break;
+	}
 }
 
-void ProjectorWindow::advance() {
+/*
+ * Set the phase steps and the number of periods across the projector for each fringe frequency
+ * The first frequency should be 1 so the coarsest phase is unambiguous
+ */
+
+void ProjectorWindow::setFringes(int steps, std::vector<int> frequencies) {
+	mSteps = steps;
+	mFrequencies = frequencies;
+	mFringe = 0;
+	mFringeDirty = true;
+}
+
+/*
+ * Choose which fringe pattern in the sequence to show
+ */
+
+void ProjectorWindow::setFringe(size_t idx) {
+	if (numFringes() == 0)
+		return;
+	mFringe = idx % numFringes();
+	mFringeDirty = true;
+	update();
+}
+
+/*
+ * Regenerate the current fringe image at the window size
+ * I = 0.5 + 0.5 cos(2 pi f x / W + 2 pi n / N)
+ */
+
+void ProjectorWindow::generateFringe() {
+	int w = width();
+	int h = height();
+	
+	if (mFringeImage.width() != w || mFringeImage.height() != h)
+		mFringeImage = QImage(w, h, QImage::Format_RGB32);
+	
+	size_t perAxis = mFrequencies.size() * mSteps;
+	size_t axis = mFringe / perAxis;
+	size_t freq = (mFringe % perAxis) / mSteps;
+	size_t step = mFringe % mSteps;
+	
+	int extent = axis == 0 ? w : h;
+	double k = 2.0 * M_PI * mFrequencies[freq] / static_cast<double>(extent);
+	double shift = 2.0 * M_PI * step / static_cast<double>(mSteps);
+	
+	// One lookup along the varying axis, then fill rows
+	std::vector<QRgb> ramp(extent);
+	for (int i = 0; i < extent; i++){
+		int v = static_cast<int>( 127.5 + 127.5 * cos(k * i + shift) + 0.5);
+		ramp[i] = qRgb(v,v,v);
+	}
+	
+	for (int y = 0; y < h; y++){
+		QRgb *line = reinterpret_cast<QRgb*>(mFringeImage.scanLine(y));
+		if (axis == 0) {
+			for (int x = 0; x < w; x++)
+				line[x] = ramp[x];
+		} else {
+			for (int x = 0; x < w; x++)
+				line[x] = ramp[y];
+		}
+	}
+	
+	mFringeDirty = false;
+}
+
+/*
+ * Step the line one dot size to the right
+ */
+
+bool ProjectorWindow::advanceLine() {
+	mLine += mSize;
+	update();
+	return mLine < width();
+}
+
+/*
+ * Lay out a grid of about count dots with roughly square cells for the window
+ */
+
+void ProjectorWindow::setDots(int count) {
+	count = count < 1 ? 1 : count;
+	mDotCols = static_cast<int>( ceil( sqrt( count * width() / static_cast<double>(height()) ) ) );
+	mDotCols = mDotCols < 1 ? 1 : mDotCols;
+	mDotRows = (count + mDotCols - 1) / mDotCols;
+	mDotOffset = QPoint(0,0);
+	update();
+}
+
+/*
+ * Shift every dot on by the dot size within its cell
+ */
+
+bool ProjectorWindow::advanceDots() {
+	int cw = width() / mDotCols;
+	int ch = height() / mDotRows;
+	
+	mDotOffset.setX(mDotOffset.x() + mSize);
+	if (mDotOffset.x() >= cw) {
+		mDotOffset.setX(0);
+		mDotOffset.setY(mDotOffset.y() + mSize);
+	}
+	update();
+	return mDotOffset.y() < ch;
+}
+
+/*
+ * Current dot positions and their colour codes. Neighbours never share a colour along a row
+ * or a column, so the matcher only has to separate dots a few cells apart
+ */
+
+void ProjectorWindow::getDots(std::vector<QPoint> &dots, std::vector<int> &codes) {
+	int cw = width() / mDotCols;
+	int ch = height() / mDotRows;
 	
-	if (mPoint.x() + mSize > width()) {
-		mPoint.setX(0);
-		mPoint.setY(mPoint.y() + mSize);
+	dots.clear();
+	codes.clear();
+	for (int r = 0; r < mDotRows; r++){
+		for (int c = 0; c < mDotCols; c++){
+			dots.push_back(QPoint(c * cw + mDotOffset.x(), r * ch + mDotOffset.y()));
+			codes.push_back( (c + 2 * r) % 3 );
+		}
+	}
+}
+
+/*
+ * Codes map onto the camera's RGB channels
+ */
+
+QColor ProjectorWindow::dotColour(int code) {
+	switch(code){
+		case 0: return Qt::red;
+		case 1: return Qt::green;
+		default: return Qt::blue;
 	}
-	else {
-		if (mPoint.y() + mSize > height()){
+}
+
+/*
+ * Move the dot on - only the point mode rasters, fringes are stepped by the scanning state
+ */
+
+void ProjectorWindow::advance() {
+	
+	if (mMode != PROJECT_POINT)
+		return;
+	
+	{
+		boost::lock_guard<boost::mutex> lock(mPointMutex);
+		if (mPoint.x() + mSize > width()) {
 			mPoint.setX(0);
-			mPoint.setY(0);
+			mPoint.setY(mPoint.y() + mSize);
+		}
+		else {
+			if (mPoint.y() + mSize > height()){
+				mPoint.setX(0);
+				mPoint.setY(0);
+			}
+			mPoint.setX(mPoint.x() + mSize);
 		}
-		mPoint.setX(mPoint.x() + mSize);
+		mMoved = boost::posix_time::microsec_clock::universal_time();
 	}
 	update();
  }
  
+/*
+ * The dot and when it moved there, read together so a scan can tell which frames are new
+ * enough to show it
+ */
+
+boost::posix_time::ptime ProjectorWindow::getPoint(QPoint &point) {
+	boost::lock_guard<boost::mutex> lock(mPointMutex);
+	point = mPoint;
+	return mMoved;
+}
+ 
+/*
+ * Place the dot directly - used by the planned scan
+ */
+
 void ProjectorWindow::setPos(int x, int y) {
+	{
+		boost::lock_guard<boost::mutex> lock(mPointMutex);
+		mPoint.setX(x);
+		mPoint.setY(y);
+		mMoved = boost::posix_time::microsec_clock::universal_time();
+	}
+	update();
 }
 
 /*
@@ -81,7 +81,12 @@ void StateCalibrateCamera::update() {
 		mF = true; // We can remove this now
 	}
 	
-	 mI->updateStatus("Leeds - Calibrating Camera"); 
+	std::stringstream Num;
+	vector<int> progress = mI->c.calibrationProgress();
+	for (size_t i = 0; i < progress.size(); i++)
+		Num << " " << i << ":" << progress[i] << "/" << mI->g.maxImages;
+	
+	mI->updateStatus("Leeds - Calibrating Cameras -" + Num.str()); 
 }
 
 /*
@@ -113,9 +118,11 @@ void StateCalibrateWorld::update() {
 	
 	std::stringstream Num;
 	std::string str;
-	Num << mI->c.waitingOn();
+	vector<int> pending = mI->c.pendingCameras();
+	for (size_t i = 0; i < pending.size(); i++)
+		Num << " " << pending[i];
 	
-	str = "Leeds - Calibrating World - Waiting on " + Num.str();
+	str = "Leeds - Calibrating World - Waiting on" + Num.str();
 	mI->updateStatus(str);
 
 }
@@ -137,6 +144,145 @@ void StateCalibrateWorld::draw(){
 }
 
 
+/*
+ * Projector calibration update - alternates between finding the board under a white flash
+ * and capturing the fringe sequence from the camera that found it
+ */
+
+void StateCalibrateProjector::update() {
+	
+	if (mObj->mStage == PROJ_CALIB_DONE){
+		mF = true;
+		return;
+	}
+	
+	if (!mObj->mStarted) {
+		mObj->mStarted = true;
+		mObj->mSize = cv::Size(mI->p.width(), mI->p.height());
+		mI->p.setMode(PROJECT_POINT);
+		mI->p.setFlash(true);
+		mI->p.setFringes(mI->g.phaseSteps, mI->g.phaseFrequencies);
+		mObj->mT = 0;
+		return;
+	}
+	
+	mObj->mT += mI->dt;
+	
+	std::stringstream Num;
+	Num << mObj->mCalibrator.numViews() << " of " << mI->g.maxImages;
+	
+	if (mObj->mStage == PROJ_CALIB_BOARD) {
+		// The interval gives the user time to move the board between views
+		if (mObj->mT < mI->g.interval)
+			return;
+		mObj->mT = 0;
+		
+		mI->updateStatus("Leeds - Calibrating Projector - Looking for board - View " + Num.str());
+		
+		if (findBoard()){
+			mI->p.setFlash(false);
+			mI->p.setMode(PROJECT_FRINGE);
+			mI->p.setFringe(0);
+			mObj->mFrames.clear();
+			mObj->mFrame = 0;
+			mObj->mStage = PROJ_CALIB_FRINGE;
+		}
+		return;
+	}
+	
+	if (mObj->mT < mI->g.scanInterval)
+		return;
+	mObj->mT = 0;
+	
+	SharedFrame frame = mI->c.getCams()[mObj->mCam]->getFrame();
+	if (!frame)
+		return;
+	mObj->mFrames.push_back(frame->getGrey(0));
+	mObj->mFrame++;
+	
+	mI->updateStatus("Leeds - Calibrating Projector - Fringes - View " + Num.str());
+	
+	if (mObj->mFrame < mI->p.numFringes()) {
+		mI->p.setFringe(mObj->mFrame);
+		return;
+	}
+	
+	addView();
+	
+	mI->p.setMode(PROJECT_POINT);
+	mI->p.setFlash(true);
+	mObj->mStage = PROJ_CALIB_BOARD;
+	
+	if (mObj->mCalibrator.numViews() < static_cast<size_t>(mI->g.maxImages))
+		return;
+	
+	mI->updateStatus("Leeds - Calibrating Projector - Solving");
+	mI->p.setFlash(false);
+	
+	if (mObj->mCalibrator() >= 0)
+		mI->c.setProjector(mObj->mResult, mObj->mSize);
+	
+	mObj->mStage = PROJ_CALIB_DONE;
+}
+
+/*
+ * Look for the board in any camera calibrated into the world, as the projector is placed
+ * through it. Raw images as the corners go through solvePnP
+ */
+
+bool StateCalibrateProjector::findBoard() {
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	
+	while (mObj->mDetectors.size() < cams.size())
+		mObj->mDetectors.push_back(boost::shared_ptr<ChessboardDetector>(new ChessboardDetector(mI->g.boardSize)));
+	
+	for (size_t i = 0; i < cams.size(); i++){
+		CameraParameters &p = cams[i]->getParams();
+		if (!p.mCalibrated || p.R.empty() || p.T.empty())
+			continue;
+		
+		SharedFrame frame = cams[i]->getFrame();
+		if (!frame)
+			continue;
+		
+		cv::Mat board;
+		mObj->mCorners.clear();
+		if (mObj->mDetectors[i]->detect(*frame, false, mObj->mCorners, board)) {
+			mObj->mCam = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Decode the fringes and hand the corners over to the calibrator
+ */
+
+void StateCalibrateProjector::addView() {
+	PhaseDecoder decoder(mI->g.phaseSteps, mI->g.phaseFrequencies, mObj->mSize, mI->g.phaseMinModulation);
+	
+	cv::Mat map, mask, modulation;
+	decoder.decode(mObj->mFrames, map, mask, modulation);
+	mObj->mFrames.clear();
+	
+	if (map.empty())
+		return;
+	
+	if (!mObj->mCalibrator.addView(mObj->mCorners, map, mask, mI->c.getCams()[mObj->mCam]->getParams()))
+		cerr << "Leeds - Board corners not covered by the fringes - skipping view" << endl;
+}
+
+/*
+ * Projector calibration draw - show the cameras so the board can be lined up
+ */
+ 
+void StateCalibrateProjector::draw(){
+	mI->c.updateTextures();
+	mI->d.drawCamerasFlat(mI->c.getCams());
+}
+
+
 /*
  * State for scanning update method
  */
@@ -157,15 +303,32 @@ void StateScan::draw(){
 	///\todo really we should put scanning and detecting in update!
 	
 	vector<std::pair<cv::Point2f,CameraParameters > > points;
-
-
-	BOOST_FOREACH (boost::shared_ptr<LeedsCam> cam, mI->c.getCams()) {	
-		cv::Point2f p;	
-		cv::Mat t = cam->getImageRectified();
-		if (mI->c.detectPoint(t, cam->getResult(), p)){
-			points.push_back( std::pair<cv::Point2f,CameraParameters >(p,cam->getParams()) );
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	
+	// With a calibrated projector each camera triangulates against the dot on its own
+	bool paired = mI->c.hasProjector();
+	vector<cv::Point3f> pairedPoints(cams.size());
+	vector<uint8_t> pairedFound(cams.size(), 0);
+	
+	// Only frames taken a while after the dot moved can show it. One frame period for the
+	// frame being exposed as it moved, and one whole frame with it still
+	if (paired) {
+		QPoint dot;
+		boost::posix_time::ptime moved = mI->p.getPoint(dot);
+		boost::posix_time::ptime after = moved + boost::posix_time::microseconds(2000000 / std::max(mI->g.fps, 1));
+		parallelFor(0, cams.size(), 1, boost::bind(&StateScan::detectPaired, this, &pairedPoints, &pairedFound, cv::Point2f(dot.x(), dot.y()), after, _1, _2));
+	}
+	else {
+		BOOST_FOREACH (boost::shared_ptr<LeedsCam> cam, cams) {	
+			cv::Point2f p;	
+			SharedFrame frame = cam->getFrame();
+			if (!frame)
+				continue;
+			if (mI->c.detectPoint(frame->getGrey(0, true), cam->getResult(), p)){
+				points.push_back( std::pair<cv::Point2f,CameraParameters >(p,cam->getParams()) );
+			}
+			
 		}
-		
 	}
 	
 	// If we are drawing results to the screen update textures and draw
@@ -188,6 +351,11 @@ void StateScan::draw(){
 		mI->m.addPoint(result.x,result.y,result.z);
 	}
 	
+	for (size_t i = 0; i < pairedFound.size(); i++){
+		if (pairedFound[i])
+			mI->m.addPoint(pairedPoints[i].x,pairedPoints[i].y,pairedPoints[i].z);
+	}
+	
 	mI->d.drawReferenceQuad();
 	
 	// Now draw -  sending the camera view
@@ -196,13 +364,480 @@ void StateScan::draw(){
 	//mI->m.generate();
 }
 
+/*
+ * Detect the dot in a range of cameras and solve each one against the projector. Frames
+ * from before the dot settled are skipped as they show it where it was
+ */
+
+void StateScan::detectPaired(std::vector<cv::Point3f> *results, std::vector<uint8_t> *found, cv::Point2f dot, boost::posix_time::ptime after, size_t c0, size_t c1) {
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	
+	for (size_t i = c0; i < c1; i++){
+		cv::Point2f p;
+		SharedFrame frame = cams[i]->getFrame();
+		if (!frame || frame->getTime() < after || !mI->c.detectPoint(frame->getGrey(0, true), cams[i]->getResult(), p))
+			continue;
+		
+		vector<std::pair<cv::Point2f,CameraParameters > > views;
+		views.push_back( std::pair<cv::Point2f,CameraParameters >(p, cams[i]->getParams()) );
+		views.push_back( std::pair<cv::Point2f,CameraParameters >(dot, mI->c.getProjector()) );
+		(*results)[i] = mI->c.solveForAll(views);
+		(*found)[i] = 1;
+	}
+}
+
+/*
+ * Planned scanning update - detect at the current position, report it and move on
+ */
+
+void StatePlannedScan::update() {
+	
+	if (mObj->mDone)
+		return;
+	
+	if (!mObj->mStarted) {
+		mObj->mStarted = true;
+		cv::Size proj(mI->p.width(), mI->p.height());
+		mObj->pPlanner.reset(new ScanPlanner(proj, mI->g.planCoarse, mI->g.planFine, mI->g.planJump));
+		mI->p.setMode(PROJECT_PLANNED);
+		
+		if (mObj->pPlanner->next(mObj->mPos))
+			mI->p.setPos(mObj->mPos.x, mObj->mPos.y);
+		else
+			mObj->mDone = true;
+		
+		mObj->mT = 0;
+		return;
+	}
+	
+	mObj->mT += mI->dt;
+	if (mObj->mT < mI->g.scanInterval)
+		return;
+	mObj->mT = 0;
+	
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	vector<cv::Point2f> found(cams.size());
+	vector<uint8_t> hits(cams.size(), 0);
+	parallelFor(0, cams.size(), 1, boost::bind(&StatePlannedScan::detect, this, &found, &hits, _1, _2));
+	
+	vector<std::pair<cv::Point2f,CameraParameters > > views;
+	for (size_t i = 0; i < cams.size(); i++){
+		if (hits[i])
+			views.push_back( std::pair<cv::Point2f,CameraParameters >(found[i], cams[i]->getParams()) );
+	}
+	
+	if (views.size() > 0 && mI->c.hasProjector())
+		views.push_back( std::pair<cv::Point2f,CameraParameters >(cv::Point2f(mObj->mPos.x, mObj->mPos.y), mI->c.getProjector()) );
+	
+	// Only a multi view detection counts as a hit
+	if (views.size() > 1) {
+		cv::Point3f result = mI->c.solveForAll(views);
+		mObj->pPlanner->report(true, result);
+		boost::lock_guard<boost::mutex> lock(mObj->mMutex);
+		mObj->mPoints.push_back(result);
+	}
+	else
+		mObj->pPlanner->report(false);
+	
+	std::stringstream Num;
+	Num << mObj->pPlanner->numVisited() << " visited, " << mObj->pPlanner->numHits() << " hits of " << mObj->pPlanner->numCells();
+	mI->updateStatus("Leeds - Planned Scanning - " + Num.str());
+	
+	if (mObj->pPlanner->next(mObj->mPos))
+		mI->p.setPos(mObj->mPos.x, mObj->mPos.y);
+	else {
+		mI->p.setMode(PROJECT_POINT);
+		mObj->mDone = true;
+	}
+}
+
+/*
+ * Find the dot in a range of cameras
+ */
+
+void StatePlannedScan::detect(std::vector<cv::Point2f> *points, std::vector<uint8_t> *found, size_t c0, size_t c1) {
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	
+	for (size_t i = c0; i < c1; i++){
+		SharedFrame frame = cams[i]->getFrame();
+		if (frame && mI->c.detectPoint(frame->getGrey(0, true), cams[i]->getResult(), (*points)[i]))
+			(*found)[i] = 1;
+	}
+}
+
+/*
+ * Planned scanning draw - pass points over to the mesh on the GL thread
+ */
+
+void StatePlannedScan::draw() {
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mMutex);
+		mI->m.addPoints(mObj->mPoints);
+		mObj->mPoints.clear();
+	}
+	
+	if (mObj->mDone)
+		mF = true;
+	
+	// Detection results, as the continuous scan shows them
+	if (mI->sr){
+		mI->c.updateResults();
+		int idx = 0;
+		
+		BOOST_FOREACH (boost::shared_ptr<LeedsCam> cam, mI->c.getCams()) {
+			cam->bindResult();
+			mI->d.drawResultFlat(idx);
+			cam->unbind();
+			idx++;
+		}
+	}
+	
+	mI->d.drawReferenceQuad();
+	mI->d.drawMeshPoints(mI->m.getPointsVBO(),0.1,0.1,1.0);
+}
+
+/*
+ * Phase scanning update - runs on the update thread, captures once the pattern has settled
+ */
+
+void StatePhaseScan::update() {
+	
+	if (mObj->mDone)
+		return;
+	
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	
+	if (!mObj->mStarted) {
+		mObj->mStarted = true;
+		mObj->mFrames.clear();
+		mObj->mFrames.resize(cams.size());
+		mI->p.setFringes(mI->g.phaseSteps, mI->g.phaseFrequencies);
+		mI->p.setMode(PROJECT_FRINGE);
+		mI->p.setFringe(0);
+		mObj->mT = 0;
+		return;
+	}
+	
+	// Give the projector and the cameras a scan interval to catch up
+	mObj->mT += mI->dt;
+	if (mObj->mT < mI->g.scanInterval)
+		return;
+	
+	// The grey level shares the frame buffer, so holding it keeps the frame out of the pool
+	vector<SharedFrame> frames(cams.size());
+	for (size_t i = 0; i < cams.size(); i++){
+		frames[i] = cams[i]->getFrame();
+		if (!frames[i])
+			return;
+	}
+	for (size_t i = 0; i < cams.size(); i++)
+		mObj->mFrames[i].push_back(frames[i]->getGrey(0));
+	
+	mObj->mFrame++;
+	mObj->mT = 0;
+	
+	std::stringstream Num;
+	Num << mObj->mFrame << " of " << mI->p.numFringes();
+	mI->updateStatus("Leeds - Phase Scanning - Fringe " + Num.str());
+	
+	if (mObj->mFrame < mI->p.numFringes()) {
+		mI->p.setFringe(mObj->mFrame);
+		return;
+	}
+	
+	mI->p.setMode(PROJECT_POINT);
+	mI->updateStatus("Leeds - Phase Scanning - Decoding");
+	solve();
+	mObj->mDone = true;
+}
+
+/*
+ * Decode each camera into projector co-ordinates then triangulate any cell seen by two or more
+ * Raw images are used as solveForAll undistorts the points itself
+ */
+
+void StatePhaseScan::solve() {
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	
+	if (cams.empty() || mObj->mFrames.size() < cams.size()) {
+		cerr << "Leeds - Phase scan has no frames from the cameras to decode" << endl;
+		mObj->mFrames.clear();
+		return;
+	}
+	
+	cv::Size proj(mI->p.width(), mI->p.height());
+	PhaseDecoder decoder(mI->g.phaseSteps, mI->g.phaseFrequencies, proj, mI->g.phaseMinModulation);
+	
+	vector<cv::Mat> cells(cams.size());
+	
+	for (size_t i = 0; i < cams.size(); i++){
+		cv::Mat map, mask, modulation;
+		decoder.decode(mObj->mFrames[i], map, mask, modulation);
+		if (map.empty())
+			return;
+		decoder.accumulate(map, mask, mI->g.phasePitch, cells[i]);
+	}
+	mObj->mFrames.clear();
+	
+	// Rows are independent, each solved into its own list so the points keep their order
+	vector< vector<cv::Point3f> > rows(cells[0].rows);
+	parallelFor(0, rows.size(), 8, boost::bind(&StatePhaseScan::solveRows, this, &cells, &rows, _1, _2));
+	
+	vector<cv::Point3f> points;
+	for (size_t y = 0; y < rows.size(); y++)
+		points.insert(points.end(), rows[y].begin(), rows[y].end());
+	
+	cerr << "Leeds - Phase scan triangulated " << points.size() << " points" << endl;
+	
+	boost::lock_guard<boost::mutex> lock(mObj->mMutex);
+	mObj->mPoints.swap(points);
+}
+
+/*
+ * Triangulate the cells of a range of rows seen by two or more views
+ */
+
+void StatePhaseScan::solveRows(std::vector<cv::Mat> *cells, std::vector< std::vector<cv::Point3f> > *rows, size_t y0, size_t y1) {
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	bool projector = mI->c.hasProjector();
+	
+	for (size_t y = y0; y < y1; y++){
+		for (int x = 0; x < (*cells)[0].cols; x++){
+			vector<std::pair<cv::Point2f,CameraParameters > > views;
+			vector<CalibrationTables*> tables;
+			
+			for (size_t i = 0; i < cams.size(); i++){
+				cv::Vec3f c = (*cells)[i].at<cv::Vec3f>(y,x);
+				if (c[2] > 0) {
+					views.push_back( std::pair<cv::Point2f,CameraParameters >(cv::Point2f(c[0],c[1]), cams[i]->getParams()) );
+					tables.push_back(&cams[i]->getTables());
+				}
+			}
+			
+			// A calibrated projector is one more view, so a single camera is enough
+			if (projector && views.size() > 0){
+				float half = (mI->g.phasePitch - 1) * 0.5f;
+				cv::Point2f centre(x * mI->g.phasePitch + half, y * mI->g.phasePitch + half);
+				views.push_back( std::pair<cv::Point2f,CameraParameters >(centre, mI->c.getProjector()) );
+				tables.push_back(NULL);
+			}
+			
+			if (views.size() > 1)
+				(*rows)[y].push_back(mI->c.solveForAll(views, &tables));
+		}
+	}
+}
+
+/*
+ * Phase scanning draw - hands the points over to the mesh on the GL thread
+ */
+
+void StatePhaseScan::draw() {
+	
+	if (mObj->mDone) {
+		boost::lock_guard<boost::mutex> lock(mObj->mMutex);
+		mI->m.addPoints(mObj->mPoints);
+		mObj->mPoints.clear();
+		mF = true;
+	}
+	
+	mI->d.drawReferenceQuad();
+	mI->d.drawMeshPoints(mI->m.getPointsVBO(),0.1,0.1,1.0);
+}
+
+/*
+ * Stripe scanning update - one projector column per scan interval
+ */
+
+void StateStripeScan::update() {
+	
+	if (mObj->mDone)
+		return;
+	
+	if (!mObj->mStarted) {
+		if (!mI->c.hasProjector()) {
+			cerr << "Leeds - Stripe scanning needs a calibrated projector" << endl;
+			mI->updateStatus("Leeds - Stripe scanning needs a calibrated projector");
+			mObj->mDone = true;
+			return;
+		}
+		mObj->mStarted = true;
+		mI->p.setMode(PROJECT_LINE);
+		mI->p.setLine(0);
+		mObj->mT = 0;
+		return;
+	}
+	
+	mObj->mT += mI->dt;
+	if (mObj->mT < mI->g.scanInterval)
+		return;
+	mObj->mT = 0;
+	
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	cv::Vec4d plane = mI->c.projectorPlane(mI->p.getLine());
+	
+	// Cameras are independent so detect and triangulate them side by side
+	vector< vector<cv::Point3f> > results(cams.size());
+	parallelFor(0, cams.size(), 1, boost::bind(&StateStripeScan::detect, this, &results, plane, _1, _2));
+	
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mMutex);
+		for (size_t i = 0; i < results.size(); i++)
+			mObj->mPoints.insert(mObj->mPoints.end(), results[i].begin(), results[i].end());
+	}
+	
+	std::stringstream Num;
+	Num << mI->p.getLine();
+	mI->updateStatus("Leeds - Stripe Scanning - Column " + Num.str());
+	
+	if (!mI->p.advanceLine()){
+		mI->p.setMode(PROJECT_POINT);
+		mObj->mDone = true;
+	}
+}
+
+/*
+ * Find the stripe in a range of cameras and intersect with the light plane
+ */
+
+void StateStripeScan::detect(std::vector< std::vector<cv::Point3f> > *results, cv::Vec4d plane, size_t c0, size_t c1) {
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	StripeDetector detector(mI->g.stripeThreshold, mI->g.stripeWindow, mI->g.stripeGaussian, mI->g.stripeColumns);
+	
+	for (size_t i = c0; i < c1; i++){
+		SharedFrame frame = cams[i]->getFrame();
+		if (!frame)
+			continue;
+		
+		vector<cv::Point2f> peaks;
+		cv::Mat grey = frame->getGrey(0);
+		detector.detect(grey, peaks);
+		mI->c.solveForPlane(peaks, cams[i]->getParams(), cams[i]->getTables(), plane, (*results)[i]);
+	}
+}
+
+/*
+ * Stripe scanning draw - pass points over to the mesh on the GL thread
+ */
+
+void StateStripeScan::draw() {
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mMutex);
+		mI->m.addPoints(mObj->mPoints);
+		mObj->mPoints.clear();
+	}
+	
+	if (mObj->mDone)
+		mF = true;
+	
+	mI->d.drawReferenceQuad();
+	mI->d.drawMeshPoints(mI->m.getPointsVBO(),0.1,0.1,1.0);
+}
+
+/*
+ * Dot scanning update - one grid of dots per scan interval
+ */
+
+void StateDotScan::update() {
+	
+	if (mObj->mDone)
+		return;
+	
+	if (!mObj->mStarted) {
+		mObj->mStarted = true;
+		mI->p.setDots(mI->g.dotCount);
+		mI->p.setMode(PROJECT_DOTS);
+		mObj->mT = 0;
+		return;
+	}
+	
+	mObj->mT += mI->dt;
+	if (mObj->mT < mI->g.scanInterval)
+		return;
+	mObj->mT = 0;
+	
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	
+	vector< vector<Dot> > dots(cams.size());
+	parallelFor(0, cams.size(), 1, boost::bind(&StateDotScan::detect, this, &dots, _1, _2));
+	
+	// The projector sees every dot so it makes the best reference view when calibrated
+	DotMatcher matcher(mI->g.dotTolerance);
+	
+	if (mI->c.hasProjector()) {
+		vector<QPoint> projected;
+		vector<int> codes;
+		mI->p.getDots(projected, codes);
+		
+		vector<Dot> pdots(projected.size());
+		for (size_t i = 0; i < projected.size(); i++){
+			pdots[i].p = cv::Point2f(projected[i].x(), projected[i].y());
+			pdots[i].code = codes[i];
+		}
+		matcher.addView(pdots, mI->c.getProjector());
+	}
+	
+	for (size_t i = 0; i < cams.size(); i++)
+		matcher.addView(dots[i], cams[i]->getParams());
+	
+	vector< vector< std::pair<cv::Point2f, CameraParameters> > > groups;
+	matcher.match(groups);
+	
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mMutex);
+		for (size_t i = 0; i < groups.size(); i++)
+			mObj->mPoints.push_back(mI->c.solveForAll(groups[i]));
+	}
+	
+	std::stringstream Num;
+	Num << groups.size();
+	mI->updateStatus("Leeds - Dot Scanning - Matched " + Num.str());
+	
+	if (!mI->p.advanceDots()){
+		mI->p.setMode(PROJECT_POINT);
+		mObj->mDone = true;
+	}
+}
+
+/*
+ * Find all the dots in a range of cameras. Raw images as the matcher undistorts
+ */
+
+void StateDotScan::detect(std::vector< std::vector<Dot> > *dots, size_t c0, size_t c1) {
+	vector<boost::shared_ptr<LeedsCam> > &cams = mI->c.getCams();
+	
+	for (size_t i = c0; i < c1; i++){
+		SharedFrame frame = cams[i]->getFrame();
+		if (frame)
+			detectDots(frame->getImage(), mI->g.dotThreshold, (*dots)[i]);
+	}
+}
+
+/*
+ * Dot scanning draw - pass points over to the mesh on the GL thread
+ */
+
+void StateDotScan::draw() {
+	{
+		boost::lock_guard<boost::mutex> lock(mObj->mMutex);
+		mI->m.addPoints(mObj->mPoints);
+		mObj->mPoints.clear();
+	}
+	
+	if (mObj->mDone)
+		mF = true;
+	
+	mI->d.drawReferenceQuad();
+	mI->d.drawMeshPoints(mI->m.getPointsVBO(),0.1,0.1,1.0);
+}
+
 /*
  * Draw the mesh if we have one
  */
 
 void StateDrawMesh::draw() {
 	mI->c.updateTextures();
-	mI->d.drawMesh(mI->m.getMeshVBO(), mI->c.getCams());
+	mI->d.drawMesh(mI->m.getMeshVBO(), mI->c.getCams(), mI->m.getGains());
 //	mI->d.drawNormals(mI->m.getNormalsVBO());
 	
 //	mI->d.drawMeshPoints(mI->m.getPointsFilteredVBO(),1.0,0.1,0.1);
@@ -234,7 +869,7 @@ StateTexturing::~StateTexturing() {
  
   
 void StateToolView::draw() {
-	mI->d.drawToolView(mI->m.getMeshVBO(),mI->c.getCams());
+	mI->d.drawToolView(mI->m.getMeshVBO(),mI->c.getCams(), mI->m.getGains());
 }
 
 
@@ -0,0 +1,335 @@
+/**
+* @brief Binary calibration bundle for all cameras with their derived tables
+* @file store.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 30/07/2012
+*
+*/
+
+#include "store.hpp"
+
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace cv;
+
+static const char sMagic[4] = {'L','D','C','B'};
+static const uint32_t sVersion = 2;
+
+/*
+ * Per camera record ahead of the parameter values
+ */
+
+typedef struct {
+	uint64_t hash;			// Intrinsics the tables were built from
+	uint32_t distortion;	// Number of distortion co-efficients
+	uint32_t calibrated;
+	uint32_t extrinsics;	// R and T were set - when clear they load empty
+	uint32_t reserved;
+}CameraRecord;
+
+
+/*
+ * FNV-1a over the bytes of a run of doubles
+ */
+
+static uint64_t fnv(uint64_t h, const void *d, size_t bytes) {
+	const uint8_t *b = static_cast<const uint8_t*>(d);
+	for (size_t i = 0; i < bytes; i++){
+		h ^= b[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static Mat asDoubles(const Mat &m) {
+	Mat d;
+	if (!m.empty())
+		m.convertTo(d, CV_64F);
+	return d.isContinuous() ? d : d.clone();
+}
+
+uint64_t hashParameters(CameraParameters &p, bool extrinsics) {
+	uint64_t h = 14695981039346656037ULL;
+	Mat v[4] = { asDoubles(p.M), asDoubles(p.D), asDoubles(p.R), asDoubles(p.T) };
+	int n = extrinsics ? 4 : 2;
+	for (int i = 0; i < n; i++){
+		if (!v[i].empty())
+			h = fnv(h, v[i].ptr<double>(), v[i].total() * sizeof(double));
+	}
+	return h;
+}
+
+/*
+ * Build the remap tables and the ray for every pixel
+ */
+
+void CalibrationTables::build(CameraParameters &p, cv::Size size) {
+	// The old tables may be read only views into a mapped bundle
+	mapA.release();
+	mapB.release();
+	
+	initUndistortRectifyMap(p.M, p.D, Mat(), p.M, size, CV_16SC2, mapA, mapB);
+	
+	vector<Point2f> pixels;
+	pixels.reserve(size.area());
+	for (int y = 0; y < size.height; y++){
+		for (int x = 0; x < size.width; x++)
+			pixels.push_back(Point2f(x,y));
+	}
+	
+	vector<Point2f> normalised;
+	undistortPoints(pixels, normalised, p.M, p.D);
+	rays = Mat(normalised, true).reshape(2, size.height);
+	
+	hash = hashParameters(p, false);
+}
+
+bool CalibrationTables::valid(CameraParameters &p) {
+	return !mapA.empty() && hash == hashParameters(p, false);
+}
+
+/*
+ * Normalised, undistorted co-ordinates for pixels, read from the ray table between the four
+ * pixels round each one. Without a table for these intrinsics, or off its edge, undistortPoints
+ * works them out as before
+ */
+
+void CalibrationTables::normalise(const std::vector<cv::Point2f> &pixels, std::vector<cv::Point2f> &normalised, CameraParameters &p) {
+	normalised.resize(pixels.size());
+	if (pixels.size() == 0)
+		return;
+	
+	if (rays.empty() || !valid(p)) {
+		undistortPoints(pixels, normalised, p.M, p.D);
+		return;
+	}
+	
+	vector<Point2f> outside, undistorted;
+	vector<size_t> where;
+	
+	for (size_t i = 0; i < pixels.size(); i++){
+		const Point2f &q = pixels[i];
+		if (!(q.x >= 0.0f && q.y >= 0.0f && q.x <= rays.cols - 1 && q.y <= rays.rows - 1)) {
+			outside.push_back(q);
+			where.push_back(i);
+			continue;
+		}
+		
+		int x0 = static_cast<int>(q.x), y0 = static_cast<int>(q.y);
+		int x1 = min(x0 + 1, rays.cols - 1), y1 = min(y0 + 1, rays.rows - 1);
+		float fx = q.x - x0, fy = q.y - y0;
+		
+		const Vec2f &a = rays.at<Vec2f>(y0, x0);
+		const Vec2f &b = rays.at<Vec2f>(y0, x1);
+		const Vec2f &c = rays.at<Vec2f>(y1, x0);
+		const Vec2f &d = rays.at<Vec2f>(y1, x1);
+		Vec2f r = (a * (1.0f - fx) + b * fx) * (1.0f - fy) + (c * (1.0f - fx) + d * fx) * fy;
+		normalised[i] = Point2f(r[0], r[1]);
+	}
+	
+	if (outside.size() > 0) {
+		undistortPoints(outside, undistorted, p.M, p.D);
+		for (size_t i = 0; i < where.size(); i++)
+			normalised[where[i]] = undistorted[i];
+	}
+}
+
+/*
+ * Store teardown
+ */
+
+CalibrationStore::~CalibrationStore() {
+	release();
+}
+
+void CalibrationStore::release() {
+	mParams.clear();
+	mTables.clear();
+	if (pData)
+		munmap(pData, mSize);
+	pData = NULL;
+	mSize = 0;
+}
+
+/*
+ * Write a run of doubles for a parameter, padding out to the expected count
+ */
+
+static void writeDoubles(ofstream &out, const Mat &m, size_t n) {
+	Mat d = asDoubles(m);
+	for (size_t i = 0; i < n; i++){
+		double v = i < d.total() ? d.ptr<double>()[i] : 0.0;
+		out.write(reinterpret_cast<const char*>(&v), sizeof(double));
+	}
+}
+
+static void writeMat(ofstream &out, const Mat &m) {
+	Mat c = m.isContinuous() ? m : m.clone();
+	out.write(reinterpret_cast<const char*>(c.data), c.total() * c.elemSize());
+}
+
+/*
+ * Save every camera. Any tables that are stale are rebuilt first. The tables passed in may
+ * point into the bundle already mapped from this file, so the new one is written alongside
+ * and renamed over it - the old mapping keeps the old file until it is released
+ */
+
+bool CalibrationStore::save(std::string filename, std::vector<CameraParameters*> &params, std::vector<CalibrationTables*> &tables, cv::Size size) {
+	std::string temp = filename + ".tmp";
+	ofstream out(temp.c_str(), ios::out | ios::binary | ios::trunc);
+	if (!out.is_open()) {
+		cerr << "Leeds - Failed to save calibration bundle " << filename << endl;
+		return false;
+	}
+	
+	CalibrationHeader header;
+	memset(&header, 0, sizeof(CalibrationHeader));
+	memcpy(header.magic, sMagic, 4);
+	header.version = sVersion;
+	header.timestamp = static_cast<uint64_t>(time(NULL));
+	header.cameras = params.size();
+	header.width = size.width;
+	header.height = size.height;
+	
+	header.hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < params.size(); i++){
+		uint64_t h = hashParameters(*params[i]);
+		header.hash = fnv(header.hash, &h, sizeof(uint64_t));
+	}
+	
+	out.write(reinterpret_cast<const char*>(&header), sizeof(CalibrationHeader));
+	
+	for (size_t i = 0; i < params.size(); i++){
+		CameraParameters &p = *params[i];
+		CalibrationTables &t = *tables[i];
+		
+		if (p.mCalibrated && !t.valid(p))
+			t.build(p, size);
+		
+		CameraRecord r;
+		r.hash = t.hash;
+		r.distortion = p.D.total();
+		r.calibrated = p.mCalibrated ? 1 : 0;
+		r.extrinsics = !p.R.empty() && !p.T.empty() ? 1 : 0;
+		r.reserved = 0;
+		out.write(reinterpret_cast<const char*>(&r), sizeof(CameraRecord));
+		
+		writeDoubles(out, p.M, 9);
+		writeDoubles(out, p.D, r.distortion);
+		writeDoubles(out, p.R, 3);
+		writeDoubles(out, p.T, 3);
+		
+		if (r.calibrated) {
+			writeMat(out, t.mapA);
+			writeMat(out, t.mapB);
+			writeMat(out, t.rays);
+		}
+	}
+	
+	out.close();
+	if (out.fail() || rename(temp.c_str(), filename.c_str()) != 0) {
+		cerr << "Leeds - Failed to save calibration bundle " << filename << endl;
+		unlink(temp.c_str());
+		return false;
+	}
+	
+	cout << "Leeds - Saved calibration bundle " << filename << endl;
+	return true;
+}
+
+/*
+ * Map the bundle and point the parameters and tables into it
+ */
+
+bool CalibrationStore::load(std::string filename, cv::Size size) {
+	release();
+	
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(CalibrationHeader))) {
+		close(fd);
+		return false;
+	}
+	
+	mSize = st.st_size;
+	pData = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	if (pData == MAP_FAILED) {
+		pData = NULL;
+		mSize = 0;
+		return false;
+	}
+	
+	const uint8_t *base = static_cast<const uint8_t*>(pData);
+	const uint8_t *end = base + mSize;
+	
+	memcpy(&mHeader, base, sizeof(CalibrationHeader));
+	
+	if (memcmp(mHeader.magic, sMagic, 4) != 0 || mHeader.version != sVersion || 
+		mHeader.width != size.width || mHeader.height != size.height) {
+		cerr << "Leeds - Calibration bundle " << filename << " does not match - ignoring" << endl;
+		release();
+		return false;
+	}
+	
+	const uint8_t *cur = base + sizeof(CalibrationHeader);
+	size_t pixels = size.area();
+	
+	for (uint32_t i = 0; i < mHeader.cameras; i++){
+		CameraRecord r;
+		if (cur + sizeof(CameraRecord) > end)
+			break;
+		memcpy(&r, cur, sizeof(CameraRecord));
+		cur += sizeof(CameraRecord);
+		
+		size_t values = 9 + r.distortion + 3 + 3;
+		size_t tables = r.calibrated ? pixels * (4 + 2 + 8) : 0;
+		if (cur + values * sizeof(double) + tables > end)
+			break;
+		
+		const double *d = reinterpret_cast<const double*>(cur);
+		CameraParameters p;
+		Mat(3, 3, CV_64F, const_cast<double*>(d)).copyTo(p.M);
+		Mat(r.distortion, 1, CV_64F, const_cast<double*>(d + 9)).copyTo(p.D);
+		if (r.extrinsics) {
+			Mat(3, 1, CV_64F, const_cast<double*>(d + 9 + r.distortion)).copyTo(p.R);
+			Mat(3, 1, CV_64F, const_cast<double*>(d + 12 + r.distortion)).copyTo(p.T);
+		}
+		p.mCalibrated = r.calibrated != 0;
+		cur += values * sizeof(double);
+		
+		CalibrationTables t;
+		if (r.calibrated) {
+			uint8_t *m = const_cast<uint8_t*>(cur);
+			t.mapA = Mat(size, CV_16SC2, m);
+			t.mapB = Mat(size, CV_16UC1, m + pixels * 4);
+			t.rays = Mat(size, CV_32FC2, m + pixels * 6);
+			t.hash = r.hash;
+			cur += tables;
+		}
+		
+		mParams.push_back(p);
+		mTables.push_back(t);
+	}
+	
+	if (mParams.size() != mHeader.cameras) {
+		cerr << "Leeds - Calibration bundle " << filename << " is truncated - ignoring" << endl;
+		release();
+		return false;
+	}
+	
+	cout << "Leeds - Loaded calibration bundle " << filename << " from " << mHeader.timestamp << endl;
+	return true;
+}
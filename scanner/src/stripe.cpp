@@ -0,0 +1,102 @@
+/**
+* @brief Line stripe detection for laser style scanning
+* @file stripe.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 18/07/2012
+*
+*/
+
+#include "stripe.hpp"
+
+#include <string.h>
+
+using namespace std;
+using namespace cv;
+
+static const size_t sBandRows = 64;
+
+
+/*
+ * Detect one peak per row. Columns mode just runs the same thing on the transpose
+ */
+
+void StripeDetector::detect(cv::Mat &grey, std::vector<cv::Point2f> &peaks) {
+	
+	Mat img = grey;
+	if (mColumns)
+		img = grey.t();
+	
+	// Per row maximum in one vectorised pass
+	Mat maxes;
+	reduce(img, maxes, 1, CV_REDUCE_MAX);
+	
+	vector<float> found(img.rows, -1.0f);
+	
+	parallelFor(0, img.rows, sBandRows, boost::bind(&StripeDetector::detectBand, this, &img, &maxes, &found, _1, _2));
+	
+	peaks.clear();
+	for (int i = 0; i < img.rows; i++){
+		if (found[i] < 0)
+			continue;
+		if (mColumns)
+			peaks.push_back(Point2f(i, found[i]));
+		else
+			peaks.push_back(Point2f(found[i], i));
+	}
+}
+
+/*
+ * Peak finding for a band of rows. memchr/memrchr find the edges of the brightest run
+ */
+
+void StripeDetector::detectBand(cv::Mat *grey, cv::Mat *maxes, std::vector<float> *found, size_t r0, size_t r1) {
+	
+	for (size_t r = r0; r < r1; r++){
+		uint8_t m = maxes->at<uint8_t>(r,0);
+		if (m < mThreshold)
+			continue;
+		
+		const uint8_t *row = grey->ptr<uint8_t>(r);
+		const uint8_t *first = static_cast<const uint8_t*>(memchr(row, m, grey->cols));
+		const uint8_t *last = static_cast<const uint8_t*>(memrchr(row, m, grey->cols));
+		
+		// Two separate bright spots on one row is a reflection, not our line
+		if (last - first > 2 * mWindow)
+			continue;
+		
+		(*found)[r] = refine(row, grey->cols, first - row, last - row);
+	}
+}
+
+/*
+ * Subpixel position of the peak. Saturated plateaus always use centre of mass
+ */
+
+float StripeDetector::refine(const uint8_t *row, int cols, int first, int last) {
+	
+	int c = (first + last) / 2;
+	
+	if (mGaussian && first == last && c > 0 && c < cols - 1) {
+		float a = log(static_cast<float>(row[c-1]) + 1.0f);
+		float b = log(static_cast<float>(row[c]) + 1.0f);
+		float d = log(static_cast<float>(row[c+1]) + 1.0f);
+		float den = 2.0f * (a - 2.0f * b + d);
+		if (den < 0.0f)
+			return c + (a - d) / den;
+	}
+	
+	int s = max(0, first - mWindow);
+	int e = min(cols - 1, last + mWindow);
+	
+	float sum = 0.0f;
+	float wsum = 0.0f;
+	for (int i = s; i <= e; i++){
+		float w = static_cast<float>(row[i]) - mThreshold;
+		if (w > 0.0f) {
+			sum += w * i;
+			wsum += w;
+		}
+	}
+	
+	return wsum > 0.0f ? sum / wsum : c;
+}
@@ -0,0 +1,353 @@
+/**
+* @brief One pool of worker threads for the whole program
+* @file thread_pool.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 13/08/2012
+*
+*/
+
+#include "thread_pool.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <boost/bind.hpp>
+#include <boost/exception_ptr.hpp>
+
+using namespace std;
+
+boost::thread_specific_ptr<size_t> ThreadPool::sWorkerId;
+
+
+/*
+ * Run the task unless a worker or a waiter already has. Anything it throws is kept for
+ * wait, and logged as nothing may ever wait on it
+ */
+
+void PoolTask::_run() {
+	{
+		boost::lock_guard<boost::mutex> lock(mMutex);
+		if (mState != TASK_QUEUED)
+			return;
+		mState = TASK_RUNNING;
+	}
+
+	try {
+		mFn();
+	}
+	catch (std::exception &e) {
+		cerr << "Leeds - Task failed: " << e.what() << endl;
+		mError = boost::current_exception();
+	}
+	catch (...) {
+		cerr << "Leeds - Task failed" << endl;
+		mError = boost::current_exception();
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(mMutex);
+		mState = TASK_DONE;
+		mFn.clear();	// Let go of anything bound into it
+	}
+	mDone.notify_all();
+}
+
+bool PoolTask::ready() {
+	boost::lock_guard<boost::mutex> lock(mMutex);
+	return mState == TASK_DONE;
+}
+
+void PoolTask::wait() {
+	_run();
+
+	boost::exception_ptr error;
+	{
+		boost::unique_lock<boost::mutex> lock(mMutex);
+		while (mState != TASK_DONE)
+			mDone.wait(lock);
+		error = mError;
+	}
+
+	if (error)
+		boost::rethrow_exception(error);
+}
+
+
+/*
+ * The one pool - one worker per core until setup says otherwise
+ */
+
+ThreadPool& ThreadPool::get() {
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool::ThreadPool() : mAffinity(false), mStarted(false), mQueued(0), mBusy(0), mNextWorker(0), mStop(false) {
+	mSize = std::max(boost::thread::hardware_concurrency(), 1u);
+}
+
+ThreadPool::~ThreadPool() {
+	_stop();
+}
+
+/*
+ * Size the pool. If it is already running the workers finish what they are on, then
+ * anything still queued moves over to the new ones
+ */
+
+void ThreadPool::setup(size_t workers, bool affinity) {
+	if (workers < 1)
+		workers = std::max(boost::thread::hardware_concurrency(), 1u);
+
+	if (workers == mSize && affinity == mAffinity)
+		return;
+
+	_stop();
+
+	deque<TaskFuture> pending;
+	{
+		boost::lock_guard<boost::mutex> lock(mMutex);
+		for (size_t i = 0; i < mWorkers.size(); i++)
+			pending.insert(pending.end(), mWorkers[i].mTasks.begin(), mWorkers[i].mTasks.end());
+
+		mWorkers.clear();
+		mQueued = 0;
+		mSize = workers;
+		mAffinity = affinity;
+	}
+
+	for (size_t i = 0; i < pending.size(); i++)
+		_push(pending[i]);
+
+	cerr << "Leeds - Thread pool of " << mSize << " workers" << (mAffinity ? ", pinned to cores" : "") << endl;
+}
+
+/*
+ * Workers start with the first task. Called with mMutex held
+ */
+
+void ThreadPool::_start() {
+	mWorkers.clear();
+	for (size_t i = 0; i < mSize; i++)
+		mWorkers.push_back(new Worker());
+
+	mStop = false;
+	mNextWorker = 0;
+	for (size_t i = 0; i < mSize; i++)
+		mThreads.push_back(new boost::thread(&ThreadPool::_work, this, i));
+
+	mStarted = true;
+}
+
+/*
+ * Stop and join the workers. Tasks still queued stay on the deques
+ */
+
+void ThreadPool::_stop() {
+	{
+		boost::lock_guard<boost::mutex> lock(mMutex);
+		if (!mStarted)
+			return;
+		mStop = true;
+	}
+	mWake.notify_all();
+
+	for (size_t i = 0; i < mThreads.size(); i++)
+		mThreads[i].join();
+	mThreads.clear();
+
+	boost::lock_guard<boost::mutex> lock(mMutex);
+	mStarted = false;
+}
+
+/*
+ * A snapshot - for sizing work the pool does not schedule itself, like PCL's OpenMP stages
+ */
+
+size_t ThreadPool::idle() {
+	boost::lock_guard<boost::mutex> lock(mMutex);
+	return mBusy < mSize ? mSize - mBusy : 0;
+}
+
+/*
+ * Hand a task to the pool
+ */
+
+TaskFuture ThreadPool::submit(boost::function<void ()> fn) {
+	TaskFuture task(new PoolTask(fn));
+	_push(task);
+	return task;
+}
+
+void ThreadPool::_push(TaskFuture task) {
+	size_t w;
+	{
+		boost::lock_guard<boost::mutex> lock(mMutex);
+		if (!mStarted)
+			_start();
+
+		size_t *id = sWorkerId.get();
+		w = (id && *id < mWorkers.size()) ? *id : mNextWorker++ % mWorkers.size();
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(mWorkers[w].mMutex);
+		mWorkers[w].mTasks.push_back(task);
+	}
+
+	{
+		boost::lock_guard<boost::mutex> lock(mMutex);
+		mQueued++;
+	}
+	mWake.notify_one();
+}
+
+/*
+ * Newest from our own deque, or else the oldest from the next worker along that has any
+ */
+
+bool ThreadPool::_take(size_t id, TaskFuture &task) {
+	size_t n = mWorkers.size();
+	bool found = false;
+
+	for (size_t i = 0; i < n && !found; i++){
+		Worker &w = mWorkers[(id + i) % n];
+		boost::lock_guard<boost::mutex> lock(w.mMutex);
+		if (w.mTasks.empty())
+			continue;
+
+		if (i == 0) {
+			task = w.mTasks.back();
+			w.mTasks.pop_back();
+		}
+		else {
+			task = w.mTasks.front();
+			w.mTasks.pop_front();
+		}
+		found = true;
+	}
+
+	if (found) {
+		boost::lock_guard<boost::mutex> lock(mMutex);
+		mQueued--;
+		mBusy++;
+	}
+	return found;
+}
+
+void ThreadPool::_work(size_t id) {
+	sWorkerId.reset(new size_t(id));
+	if (mAffinity)
+		_pin(id);
+
+	TaskFuture task;
+	while (true) {
+		if (_take(id, task)) {
+			task->_run();
+			task.reset();
+			
+			boost::lock_guard<boost::mutex> lock(mMutex);
+			mBusy--;
+			continue;
+		}
+
+		boost::unique_lock<boost::mutex> lock(mMutex);
+		while (mQueued == 0 && !mStop)
+			mWake.wait(lock);
+		if (mStop)
+			return;
+	}
+}
+
+/*
+ * Keep each worker on one core so the scan and the meshing stop moving each other's caches
+ */
+
+void ThreadPool::_pin(size_t id) {
+	size_t cores = std::max(boost::thread::hardware_concurrency(), 1u);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(id % cores, &set);
+
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		cerr << "Leeds - Could not pin worker " << id << " to a core" << endl;
+}
+
+/*
+ * Split a range into chunks of at least grain and block until all are done. There are a
+ * few chunks per worker so the quicker ones take more. If a chunk throws, the chunks not
+ * yet started are skipped and the first exception is thrown again here
+ */
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, boost::function<void (size_t, size_t)> fn) {
+	if (end <= begin)
+		return;
+
+	size_t n = end - begin;
+	if (grain < 1) grain = 1;
+
+	size_t chunk = std::max(grain, (n + mSize * 4 - 1) / (mSize * 4));
+	if (chunk >= n) {
+		fn(begin, end);
+		return;
+	}
+
+	boost::shared_ptr<Loop> loop(new Loop());
+	loop->mFn = fn;
+	loop->mNext = begin;
+	loop->mEnd = end;
+	loop->mChunk = chunk;
+	loop->mChunks = (n + chunk - 1) / chunk;
+	loop->mDone = 0;
+
+	size_t helpers = std::min(mSize, loop->mChunks) - 1;
+	for (size_t i = 0; i < helpers; i++)
+		submit(boost::bind(&ThreadPool::_runChunks, loop));
+
+	_runChunks(loop);
+
+	boost::exception_ptr error;
+	{
+		boost::unique_lock<boost::mutex> lock(loop->mMutex);
+		while (loop->mDone < loop->mChunks)
+			loop->mFinished.wait(lock);
+		error = loop->mError;
+	}
+
+	if (error)
+		boost::rethrow_exception(error);
+}
+
+void ThreadPool::_runChunks(boost::shared_ptr<Loop> loop) {
+	while (true) {
+		size_t s, e;
+		bool failed;
+		{
+			boost::lock_guard<boost::mutex> lock(loop->mMutex);
+			if (loop->mNext >= loop->mEnd)
+				return;
+			s = loop->mNext;
+			e = std::min(s + loop->mChunk, loop->mEnd);
+			loop->mNext = e;
+			failed = loop->mError;
+		}
+
+		// Still counted when skipped or thrown, or the caller would wait forever
+		boost::exception_ptr error;
+		if (!failed) {
+			try {
+				loop->mFn(s, e);
+			}
+			catch (...) {
+				error = boost::current_exception();
+			}
+		}
+
+		boost::lock_guard<boost::mutex> lock(loop->mMutex);
+		if (error && !loop->mError)
+			loop->mError = error;
+		if (++loop->mDone == loop->mChunks)
+			loop->mFinished.notify_all();
+	}
+}
@@ -11,32 +11,6 @@
 using namespace std;
 using namespace cv;
 
-/*
- * Find Chessboards in the Matrix
- */
-
-bool findChessboard(Mat &cam0, vector<Point2f> &corners, Mat &board, cv::Size &size ) {
-
-	if ( findChessboardCorners(cam0, size, corners, CALIB_CB_ADAPTIVE_THRESH + CALIB_CB_NORMALIZE_IMAGE + CALIB_CB_FAST_CHECK) ) {
-	
-		// Update the view
-		
-		cam0.copyTo(board);
-		drawChessboardCorners(board, size, corners, true);
-		
-		Mat grey = cam0;
-
-		cvtColor( cam0, grey, CV_RGB2GRAY);		
-		cornerSubPix(grey, corners, Size(11,11), Size(-1,-1), TermCriteria(CV_TERMCRIT_ITER+CV_TERMCRIT_EPS, 30, 0.01));
-
-		return true;
-	}
-
-	cam0.copyTo(board);	
-	return false;
-}
-
-
 /*
  * Load Intrinsic Parameters from disk
  */
@@ -97,3 +71,12 @@ bool saveCameraParameters(string filename, CameraParameters &in) {
 
 
 
+
+
+/*
+ * Run fn over [begin,end) in chunks on the shared pool. The calling thread takes chunks too
+ */
+
+void parallelFor(size_t begin, size_t end, size_t grain, boost::function<void (size_t, size_t)> fn) {
+	ThreadPool::get().parallelFor(begin, end, grain, fn);
+}
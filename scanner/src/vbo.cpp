@@ -18,7 +18,11 @@ using namespace boost::assign;
  */
 
 VBOData::VBOData() {
-   
+	mNumBufs = 0;
+	mNumAttribs = 0;
+	mNumElements = 0;
+	mNumIndices = 0;
+	vbo = NULL;
 }
 
 /*
@@ -42,7 +46,7 @@ void VBOData::bind() {
 void VBOData::unbind() {
 	glBindVertexArray(0);
 	
-	for (int id = 0; id < mNumBufs; ++ id){
+	for (int id = 0; id < mNumAttribs; ++ id){
 		glDisableVertexAttribArray(id);
 	}
 }
@@ -126,6 +130,7 @@ void VBOData::compile(size_t buffers) {
 	} 
 	
 	mNumBufs = s;
+	mNumAttribs = s;
 
 	glBindVertexArray(0);
 	
@@ -141,6 +146,106 @@ void VBOData::compile(size_t buffers) {
 	
 }
 
+/*
+ * Pack vertices, normals, texcoords and texids into one buffer with a stride, drawn through
+ * the index buffer. Attributes keep the same numbers compile would give them, less the
+ * index slot, so the shaders do not change
+ */
+
+void VBOData::compileInterleaved(size_t buffers) {
+	mUsed = buffers | VBO_IDCE;
+	
+	size_t n = mVertices.size() / 3;
+	GLsizei floats = 0;
+	if (mUsed & VBO_VERT) floats += 3;
+	if (mUsed & VBO_COLR) floats += 4;
+	if (mUsed & VBO_NORM) floats += 3;
+	if (mUsed & VBO_TEXC) floats += 2;
+	if (mUsed & VBO_TEXI) floats += 1;	// Bit copied GLuint
+	if (mUsed & VBO_BLND) floats += 8;
+	
+	vector<GLfloat> packed(n * floats);
+	for (size_t i = 0; i < n; i++){
+		GLfloat *p = &packed[i * floats];
+		if (mUsed & VBO_VERT) { memcpy(p, &mVertices[i * 3], 3 * sizeof(GLfloat)); p += 3; }
+		if (mUsed & VBO_COLR) { memcpy(p, &mColours[i * 4], 4 * sizeof(GLfloat)); p += 4; }
+		if (mUsed & VBO_NORM) { memcpy(p, &mNormals[i * 3], 3 * sizeof(GLfloat)); p += 3; }
+		if (mUsed & VBO_TEXC) { memcpy(p, &mTexCoords[i * 2], 2 * sizeof(GLfloat)); p += 2; }
+		if (mUsed & VBO_TEXI) { memcpy(p, &vTexIDs[i], sizeof(GLuint)); p += 1; }
+		if (mUsed & VBO_BLND) { memcpy(p, &mBlend[i * 8], 8 * sizeof(GLfloat)); p += 8; }
+	}
+	
+	vbo = new GLuint[2];
+	glGenBuffers(2, vbo);
+	mVID = vbo[0];
+	mIID = vbo[1];
+	mNumBufs = 2;
+	
+	glGenVertexArrays(1,&vao);
+	glBindVertexArray(vao);
+	
+	glBindBuffer(GL_ARRAY_BUFFER, mVID);
+	glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(GLfloat), packed.empty() ? NULL : &packed[0], GL_STATIC_DRAW);
+	
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndices.size() * sizeof(GLuint), mIndices.empty() ? NULL : &mIndices[0], GL_STATIC_DRAW);
+	
+	GLsizei stride = floats * sizeof(GLfloat);
+	size_t offset = 0;
+	int s = 0;
+	
+	if (mUsed & VBO_VERT){
+		glEnableVertexAttribArray(s);
+		glVertexAttribPointer(s,3,GL_FLOAT,GL_FALSE,stride, (GLubyte*) NULL + offset);
+		offset += 3 * sizeof(GLfloat);
+		s++;
+	}
+	if (mUsed & VBO_COLR){
+		glEnableVertexAttribArray(s);
+		glVertexAttribPointer(s,4,GL_FLOAT,GL_FALSE,stride, (GLubyte*) NULL + offset);
+		offset += 4 * sizeof(GLfloat);
+		s++;
+	}
+	if (mUsed & VBO_NORM){
+		glEnableVertexAttribArray(s);
+		glVertexAttribPointer(s,3,GL_FLOAT,GL_FALSE,stride, (GLubyte*) NULL + offset);
+		offset += 3 * sizeof(GLfloat);
+		s++;
+	}
+	if (mUsed & VBO_TEXC){
+		glEnableVertexAttribArray(s);
+		glVertexAttribPointer(s,2,GL_FLOAT,GL_FALSE,stride, (GLubyte*) NULL + offset);
+		offset += 2 * sizeof(GLfloat);
+		s++;
+	}
+	if (mUsed & VBO_TEXI){
+		glEnableVertexAttribArray(s);
+		glVertexAttribIPointer(s,1,GL_UNSIGNED_INT,stride, (GLubyte*) NULL + offset);
+		offset += sizeof(GLuint);
+		s++;
+	}
+	if (mUsed & VBO_BLND){
+		for (int j = 0; j < 2; j++){
+			glEnableVertexAttribArray(s);
+			glVertexAttribPointer(s,4,GL_FLOAT,GL_FALSE,stride, (GLubyte*) NULL + offset);
+			offset += 4 * sizeof(GLfloat);
+			s++;
+		}
+	}
+	
+	mNumAttribs = s;
+	mNumElements = n;
+	mNumIndices = mIndices.size();
+	
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	
+	for (int id = 0; id < mNumAttribs; ++id){
+		glDisableVertexAttribArray(id);
+	}
+}
+
 /*
  * Allocate based on the current size of the arrays
  */
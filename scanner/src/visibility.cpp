@@ -0,0 +1,138 @@
+/**
+* @brief Per camera depth maps for deciding which cameras can see which faces
+* @file visibility.cpp
+* @author Benjamin Blundell <oni@section9.co.uk>
+* @date 06/08/2012
+*
+*/
+
+#include "visibility.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+using namespace cv;
+
+
+/*
+ * Project every vertex once with the full camera model then fill the depth map.
+ * Returns false if the camera has no extrinsics to project with
+ */
+
+bool DepthMap::render(HalfEdgeMesh &mesh, CameraParameters &p) {
+	if (p.R.empty() || p.T.empty() || mesh.numVertices() == 0)
+		return false;
+	
+	pMesh = &mesh;
+	size_t nv = mesh.numVertices();
+	
+	vector<Point3f> points(nv);
+	for (size_t v = 0; v < nv; v++)
+		points[v] = Point3f(mesh.mX[v], mesh.mY[v], mesh.mZ[v]);
+	
+	projectPoints(points, p.R, p.T, p.M, p.D, mUV);
+	
+	// Depth along the axis is just the third row of the camera transform
+	Mat r, t;
+	Rodrigues(p.R, r);
+	r.convertTo(r, CV_64F);
+	p.T.convertTo(t, CV_64F);
+	double r0 = r.at<double>(2,0), r1 = r.at<double>(2,1), r2 = r.at<double>(2,2), tz = t.at<double>(2);
+	
+	mZ.resize(nv);
+	for (size_t v = 0; v < nv; v++)
+		mZ[v] = r0 * points[v].x + r1 * points[v].y + r2 * points[v].z + tz;
+	
+	mDepth = Mat::zeros(mSize, CV_32F);
+	parallelFor(0, mSize.height, 16, boost::bind(&DepthMap::_rasterise, this, _1, _2));
+	
+	return true;
+}
+
+/*
+ * Flag each face this camera can see. out holds one byte per face
+ */
+
+void DepthMap::visible(uint8_t *out, float tolerance) {
+	if (pMesh == NULL)
+		return;
+	parallelFor(0, pMesh->numFaces(), 4096, boost::bind(&DepthMap::_test, this, out, tolerance, _1, _2));
+}
+
+/*
+ * Draw every face that touches rows r0 to r1. Inverse depth interpolates linearly across
+ * the screen, so the nearest surface is the largest value
+ */
+
+void DepthMap::_rasterise(size_t r0, size_t r1) {
+	HalfEdgeMesh &mesh = *pMesh;
+	
+	for (size_t f = 0; f < mesh.numFaces(); f++){
+		uint32_t ia = mesh.vertex(f, 0), ib = mesh.vertex(f, 1), ic = mesh.vertex(f, 2);
+		if (mZ[ia] <= 0.0f || mZ[ib] <= 0.0f || mZ[ic] <= 0.0f)
+			continue;
+		
+		const Point2f &a = mUV[ia], &b = mUV[ib], &c = mUV[ic];
+		
+		int y0 = max(static_cast<int>(r0), static_cast<int>(floorf(min(a.y, min(b.y, c.y)))));
+		int y1 = min(static_cast<int>(r1) - 1, static_cast<int>(ceilf(max(a.y, max(b.y, c.y)))));
+		if (y0 > y1)
+			continue;
+		
+		int x0 = max(0, static_cast<int>(floorf(min(a.x, min(b.x, c.x)))));
+		int x1 = min(mSize.width - 1, static_cast<int>(ceilf(max(a.x, max(b.x, c.x)))));
+		if (x0 > x1)
+			continue;
+		
+		float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (fabsf(area) < 1e-8f)
+			continue;
+		float inv = 1.0f / area;
+		
+		float za = 1.0f / mZ[ia], zb = 1.0f / mZ[ib], zc = 1.0f / mZ[ic];
+		
+		for (int y = y0; y <= y1; y++){
+			float *row = mDepth.ptr<float>(y);
+			float py = y + 0.5f;
+			
+			for (int x = x0; x <= x1; x++){
+				float px = x + 0.5f;
+				float w0 = ((c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x)) * inv;
+				float w1 = ((a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x)) * inv;
+				float w2 = 1.0f - w0 - w1;
+				if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					continue;
+				
+				float z = w0 * za + w1 * zb + w2 * zc;
+				if (z > row[x])
+					row[x] = z;
+			}
+		}
+	}
+}
+
+/*
+ * A face passes if its centre lands in the image and is no further than the nearest
+ * surface there, give or take the tolerance as a fraction of the depth
+ */
+
+void DepthMap::_test(uint8_t *out, float tolerance, size_t f0, size_t f1) {
+	HalfEdgeMesh &mesh = *pMesh;
+	
+	for (size_t f = f0; f < f1; f++){
+		uint32_t ia = mesh.vertex(f, 0), ib = mesh.vertex(f, 1), ic = mesh.vertex(f, 2);
+		float z = (mZ[ia] + mZ[ib] + mZ[ic]) / 3.0f;
+		Point2f c = (mUV[ia] + mUV[ib] + mUV[ic]) * (1.0f / 3.0f);
+		
+		int x = static_cast<int>(floorf(c.x)), y = static_cast<int>(floorf(c.y));
+		if (z <= 0.0f || x < 0 || y < 0 || x >= mSize.width || y >= mSize.height) {
+			out[f] = 0;
+			continue;
+		}
+		
+		float nearest = mDepth.at<float>(y, x);
+		out[f] = nearest <= 0.0f || z * nearest <= 1.0f + tolerance;
+	}
+}